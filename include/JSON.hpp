@@ -9,6 +9,14 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iosfwd>
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
 
 namespace json {
 
@@ -21,6 +29,98 @@ enum class json_format_option
     indent_tab
 };
 
+/**
+ * formatting of NaN and infinity, which are not valid json numbers.
+ */
+enum class json_nonfinite_option
+{
+    null,       // format as null
+    string,     // format as string "NaN", "Infinity" or "-Infinity"
+    error       // reject it, formatting fails
+};
+
+/**
+ * options of formatting json.
+ */
+struct format_options
+{
+    json_format_option option;
+    // indention count, used only when option is {@code json_format_option::indent_space} or
+    // {@code json_format_option::indent_tab}.
+    unsigned indention;
+    // size of the internal buffer used by {@code write}, the peak memory of writing is bounded by it.
+    size_t buffer_size;
+    // number of threads formatting the document, 0 means {@code std::thread::hardware_concurrency()}.
+    // when it is greater than 1, the top levels of the document are split into pieces formatted in parallel,
+    // the output is the same as formatting sequentially.
+    unsigned threads;
+    // containers with at least this many elements are split into chunks when formatting in parallel.
+    size_t parallel_threshold;
+    // formatting of NaN and infinity.
+    json_nonfinite_option nonfinite;
+    // max digits after the decimal point of float numbers, the rest are truncated. by default float numbers are
+    // formatted in the shortest form which is parsed back to the same value.
+    int max_decimal_places;
+
+    format_options(json_format_option o = json_format_option::no_format, unsigned i = 1) // NOLINT
+            : option(o), indention(i), buffer_size(64 * 1024), threads(1), parallel_threshold(4096),
+              nonfinite(json_nonfinite_option::null), max_decimal_places(324) { }
+};
+
+/**
+ * default parse policy. validate the input strictly according to the json standard.
+ */
+struct strict_parse_policy
+{
+    // reject an object which contains the same key more than once.
+    static constexpr bool check_duplicated_key = true;
+    // reject control characters (U+0000 through U+001F) which are not escaped in string value.
+    static constexpr bool check_control_char = true;
+    // print error position and description to {@code std::cerr} when parse failed.
+#ifdef ERROR_LOG
+    static constexpr bool log_error = true;
+#else
+    static constexpr bool log_error = false;
+#endif
+    // max nesting depth of object and array, 0 means no limit. the parsers are recursive, the limit keeps deeply
+    // nested input from overflowing the stack. values skipped or read by projection parsing, json_reader and
+    // cbor_reader are checked against this limit too.
+    static constexpr unsigned max_depth = 1000;
+};
+
+/**
+ * parse policy for trusted input. skip duplicated key detection, control character checks and the nesting limit,
+ * the first value wins when a key is duplicated.
+ */
+struct trusted_parse_policy
+{
+    static constexpr bool check_duplicated_key = false;
+    static constexpr bool check_control_char = false;
+    static constexpr bool log_error = false;
+    static constexpr unsigned max_depth = 0;
+};
+
+/**
+ * parse c-style json string to {@code json_token}, with the parse behavior specified by {@code Policy}.
+ * each policy compiles to a specialized parser, only {@code strict_parse_policy} and {@code trusted_parse_policy}
+ * are instantiated by the library.
+ * @param json c-style json format string.
+ * @param error out param, a code to identify parse error, 0 means no error. {@code nullptr} can be passed.
+ * @return if no error occurs, return a {@code json_token} pointer. return a default empty {@code std::unique_ptr}
+ * object if any errors occur.
+ */
+template<typename Policy>
+std::unique_ptr<json_token> parse(const char *json, int *error);
+
+/**
+ * parse json string to {@code json_token}, with the parse behavior specified by {@code Policy}.
+ */
+template<typename Policy>
+inline std::unique_ptr<json_token> parse(const std::string &json, int *error)
+{
+    return parse<Policy>(json.c_str(), error);
+}
+
 /**
  * parse c-style json string to {@code json_token}.
  * @param json c-style json format string.
@@ -28,7 +128,10 @@ enum class json_format_option
  * @return if no error occurs, return a {@code json_token} pointer, use {@code json_token::get_type} to determine
  * the actual json type. return a default empty {@code std::unique_ptr} object if any errors occur.
  */
-std::unique_ptr<json_token> parse(const char *json, int *error);
+inline std::unique_ptr<json_token> parse(const char *json, int *error)
+{
+    return parse<strict_parse_policy>(json, error);
+}
 
 /**
  * parse json string to {@code json_token}.
@@ -52,6 +155,221 @@ inline std::unique_ptr<json_token> parse(const std::string &json, int *error)
  */
 std::string to_string(const json_token &token, json_format_option option = json_format_option::no_format, unsigned indention = 1);
 
+/**
+ * format json instance with options, e.g. formatting a large document by multiple threads.
+ * @param error optional out param, set to the error code if a non-finite number is rejected
+ * ({@code json_nonfinite_option::error}), and an empty string is returned.
+ */
+std::string to_string(const json_token &token, const format_options &options, int *error = nullptr);
+
+/**
+ * destination of {@code write}. the output is written to it chunk by chunk.
+ */
+class json_sink
+{
+public:
+    virtual ~json_sink() = default;
+
+    /**
+     * @return false if the data can not be written, and the writing stops.
+     */
+    virtual bool write(const char *data, size_t size) = 0;
+
+    virtual bool flush()
+    {
+        return true;
+    }
+};
+
+#ifndef _WIN32
+/**
+ * write to a file descriptor, the descriptor is not closed. POSIX only, {@code file_sink} is portable.
+ */
+class fd_sink : public json_sink
+{
+public:
+    explicit fd_sink(int f) noexcept : fd(f) { }
+
+    bool write(const char *data, size_t size) override;
+
+    /**
+     * write all buffers (e.g. the result of {@code to_iovec}) by {@code writev}, partial writes are continued.
+     */
+    bool writev(const std::vector<iovec> &buffers);
+
+private:
+    int fd;
+};
+#endif
+
+/**
+ * write to a {@code FILE}, it is flushed when writing finishes but not closed.
+ */
+class file_sink : public json_sink
+{
+public:
+    explicit file_sink(std::FILE *f) noexcept : file(f) { }
+
+    bool write(const char *data, size_t size) override;
+
+    bool flush() override;
+
+private:
+    std::FILE *file;
+};
+
+class ostream_sink : public json_sink
+{
+public:
+    explicit ostream_sink(std::ostream &s) noexcept : stream(s) { }
+
+    bool write(const char *data, size_t size) override;
+
+    bool flush() override;
+
+private:
+    std::ostream &stream;
+};
+
+/**
+ * pass each chunk to the callback, which returns false to stop the writing.
+ */
+class callback_sink : public json_sink
+{
+public:
+    explicit callback_sink(std::function<bool(const char *, size_t)> f) : callback(std::move(f)) { }
+
+    bool write(const char *data, size_t size) override;
+
+private:
+    std::function<bool(const char *, size_t)> callback;
+};
+
+/**
+ * builder writing to sink through a fixed-size buffer. it can be passed to {@code format_string},
+ * {@code format_number} and {@code serialize} in place of {@code std::string}.
+ */
+class stream_builder
+{
+public:
+    stream_builder(json_sink &s, size_t size)
+            : sink(s), capacity(size < 64 ? 64 : size), buffer(new char[capacity]), used(0), failed(false) { }
+
+    void push_back(char c)
+    {
+        if (used == capacity) {
+            flush();
+        }
+        buffer[used++] = c;
+    }
+
+    void append(const char *str, size_t size)
+    {
+        if (used + size > capacity) {
+            flush();
+            if (size > capacity) {
+                // too large to be buffered, e.g. a long string.
+                failed = failed || !sink.write(str, size);
+                return;
+            }
+        }
+        std::memcpy(&buffer[used], str, size);
+        used += size;
+    }
+
+    void append(size_t count, char c)
+    {
+        while (count > 0) {
+            if (used == capacity) {
+                flush();
+            }
+            auto n = count < capacity - used ? count : capacity - used;
+            std::memset(&buffer[used], c, n);
+            used += n;
+            count -= n;
+        }
+    }
+
+    /**
+     * write the buffered data to sink, the sink itself is not flushed.
+     * @return false if the sink has failed.
+     */
+    bool flush()
+    {
+        if (used > 0) {
+            failed = failed || !sink.write(&buffer[0], used);
+            used = 0;
+        }
+        return !failed;
+    }
+
+private:
+    json_sink &sink;
+    size_t capacity;
+    std::unique_ptr<char[]> buffer;
+    size_t used;
+    bool failed;
+};
+
+/**
+ * format json instance and write it to {@code sink} through a fixed-size buffer, without building the whole output
+ * in memory. the output is the same as {@code to_string}. when formatting by multiple threads ({@code options.threads}),
+ * the formatted pieces are kept in memory until they are written.
+ * @param token a json instance to be formatted.
+ * @param sink destination of output.
+ * @param options format options, {@code json_format_option} can be passed directly.
+ * @return false if the sink fails, or a non-finite number is rejected (null is written in its place).
+ */
+bool write(const json_token &token, json_sink &sink, const format_options &options = format_options());
+
+#ifndef _WIN32
+/**
+ * format json instance to a list of buffers in order, which can be written by {@code writev} directly. POSIX only.
+ * long string values without escape are referenced in place instead of being copied, other output is stored in
+ * {@code side}. the buffers are valid until {@code token} or {@code side} is modified or destroyed.
+ * @param token a json instance to be formatted.
+ * @param side out param, the buffer storing the output which is not referenced in place. it is cleared first.
+ * @param options format options, {@code json_format_option} can be passed directly.
+ * @param error optional out param, set to the error code if a non-finite number is rejected, and no buffer is returned.
+ */
+std::vector<iovec> to_iovec(const json_token &token, std::string &side, const format_options &options = format_options(),
+                            int *error = nullptr);
+#endif
+
+/**
+ * format string value to json string (quoted and escaped), and append it to {@code builder}.
+ */
+void format_string(const char *str, size_t size, std::string &builder);
+
+/**
+ * format float number value and append it to {@code builder}. NaN and infinity are formatted as null.
+ */
+void format_number(double value, std::string &builder);
+
+/**
+ * format float number value by {@code options.nonfinite} and {@code options.max_decimal_places}.
+ * @return false if the value is rejected by {@code json_nonfinite_option::error}, null is appended in its place.
+ */
+bool format_number(double value, std::string &builder, const format_options &options);
+
+/**
+ * format integer number value and append it to {@code builder}.
+ */
+void format_number(int64_t value, std::string &builder);
+
+/**
+ * format unsigned integer number value and append it to {@code builder}, values above {@code INT64_MAX} are kept.
+ */
+void format_number(uint64_t value, std::string &builder);
+
+void format_string(const char *str, size_t size, stream_builder &builder);
+
+void format_number(double value, stream_builder &builder);
+
+void format_number(int64_t value, stream_builder &builder);
+
+void format_number(uint64_t value, stream_builder &builder);
+
 /**
  * get a human friend description of error code.
  * @param error error code.
@@ -64,7 +382,15 @@ const char *get_error_info(int error) noexcept;
  * @param token source object.
  * @return new object copied from source.
  */
-// std::unique_ptr<json_token> clone(const json_token &token);
+std::unique_ptr<json_token> clone(const json_token &token);
+
+/**
+ * move construct a json token object. children and string value are moved without copying,
+ * and {@code token} is left empty.
+ * @param token source object.
+ * @return new object holding the content of source.
+ */
+std::unique_ptr<json_token> clone(json_token &&token);
 
 
 enum class json_type : int
@@ -173,75 +499,199 @@ public:
 
 /**
  * json array type. An ordered list of instances, from the JSON "array" production.
+ *
+ * an array whose elements are all integer numbers, or all float numbers, is stored packed as a contiguous
+ * {@code std::vector<int64_t>} or {@code std::vector<double>}. parsing and the number {@code add} overloads choose it
+ * automatically. accessing the elements as {@code json_token} unpacks the array transparently, and unpacking is
+ * thread-safe, so a parsed document can still be read by multiple threads.
  */
 class json_array : public json_token
 {
     using container = std::vector<std::unique_ptr<json_token>>;
 
 public:
-    json_array() = default;
+    enum class packing : int
+    {
+        none,
+        int64,
+        float64
+    };
+
+    json_array() noexcept : packed(packing::none), unpacking(false) { }
+
+    json_array(json_array &&other) noexcept
+            : children(std::move(other.children)), ints(std::move(other.ints)), floats(std::move(other.floats)),
+              packed(other.packed.load(std::memory_order_acquire)), unpacking(false)
+    {
+        other.packed.store(packing::none, std::memory_order_relaxed);
+    }
+
+    json_array &operator=(json_array &&other) noexcept
+    {
+        if (this != &other) {
+            children = std::move(other.children);
+            ints = std::move(other.ints);
+            floats = std::move(other.floats);
+            packed.store(other.packed.load(std::memory_order_acquire), std::memory_order_relaxed);
+            other.packed.store(packing::none, std::memory_order_relaxed);
+        }
+        return *this;
+    }
 
     json_type get_type() const noexcept override { return TYPE; }
 
     void reserve(size_t capacity)
     {
-        children.reserve(capacity);
+        switch (get_packing()) {
+            case packing::int64:
+                ints.reserve(capacity);
+                break;
+            case packing::float64:
+                floats.reserve(capacity);
+                break;
+            default:
+                children.reserve(capacity);
+        }
+    }
+
+    /**
+     * release the unused capacity of packed storage.
+     */
+    void shrink_to_fit()
+    {
+        ints.shrink_to_fit();
+        floats.shrink_to_fit();
     }
 
     size_t size() const
     {
-        return children.size();
+        switch (get_packing()) {
+            case packing::int64:
+                return ints.size();
+            case packing::float64:
+                return floats.size();
+            default:
+                return children.size();
+        }
+    }
+
+    /**
+     * packed elements of array. {@code type} is {@code packing::none} and {@code size} is 0 if the elements are
+     * stored as {@code json_token}.
+     */
+    struct packed_view
+    {
+        packing type;
+        const int64_t *ints;
+        const double *floats;
+        size_t size;
+    };
+
+    // packed access
+    packing get_packing() const noexcept
+    {
+        return packed.load(std::memory_order_acquire);
+    }
+
+    /**
+     * load the packing once, with the data and size of it. unlike calling {@code get_packing} and {@code size}
+     * separately, the result stays consistent while another thread unpacks the array.
+     */
+    packed_view get_packed() const noexcept
+    {
+        auto p = get_packing();
+        switch (p) {
+            case packing::int64:
+                return packed_view{p, ints.data(), nullptr, ints.size()};
+            case packing::float64:
+                return packed_view{p, nullptr, floats.data(), floats.size()};
+            default:
+                return packed_view{p, nullptr, nullptr, 0};
+        }
+    }
+
+    /**
+     * store the elements as {@code json_token}. the packed storage is kept until the next modification,
+     * for readers which have got the packed data.
+     */
+    void unpack() const
+    {
+        if (get_packing() != packing::none) {
+            unpack_elements();
+        }
     }
 
     // use to access
     json_token *operator[](size_t index)
     {
+        unpack();
         return children[index].get();
     }
 
     const json_token *operator[](size_t index) const
     {
+        unpack();
         return children[index].get();
     }
 
     json_token *get_value(size_t index)
     {
+        unpack();
         return index >= size() ? nullptr : children[index].get();
     }
 
     const json_token *get_value(size_t index) const
     {
+        unpack();
         return index >= size() ? nullptr : children[index].get();
     }
 
     // iterator
-    auto begin() noexcept -> container::iterator
+    auto begin() -> container::iterator
     {
+        unpack();
         return children.begin();
     }
 
-    auto begin() const noexcept -> container::const_iterator
+    auto begin() const -> container::const_iterator
     {
+        unpack();
         return children.begin();
     }
 
-    auto end() noexcept -> container::iterator
+    auto end() -> container::iterator
     {
+        unpack();
         return children.end();
     }
 
-    auto end() const noexcept -> container::const_iterator
+    auto end() const -> container::const_iterator
     {
+        unpack();
         return children.end();
     }
 
     void add(std::unique_ptr<json_token> &&element)
     {
+        unpack_for_write();
         children.emplace_back(std::move(element));
     }
 
+    void add(int64_t value);
+
+    void add(double value);
+
 private:
-    container children;
+    void unpack_elements() const;
+
+    void unpack_for_write();
+
+    mutable container children;
+    std::vector<int64_t> ints;
+    std::vector<double> floats;
+    mutable std::atomic<packing> packed;
+    // set by the thread which unpacks the array, the others wait for it.
+    mutable std::atomic<bool> unpacking;
 
 public:
     static constexpr json_type TYPE = json_type::array;
@@ -254,17 +704,31 @@ public:
 class json_string_value : public json_token
 {
 public:
-    json_string_value() = default;
+    /**
+     * whether the value contains characters to be escaped when it is formatted. a value known to need no escaping
+     * is copied to the output directly, without scanning it.
+     */
+    enum class escaping : uint8_t
+    {
+        unknown,
+        none,
+        needed
+    };
 
-    explicit json_string_value(const std::string &v) : str_value(v) { }
+    json_string_value() : escape(escaping::none) { }
 
-    explicit json_string_value(std::string &&v) noexcept : str_value(std::move(v)) { }
+    explicit json_string_value(const std::string &v) : str_value(v), escape(escaping::unknown) { }
+
+    explicit json_string_value(std::string &&v) noexcept : str_value(std::move(v)), escape(escaping::unknown) { }
+
+    json_string_value(std::string &&v, escaping e) noexcept : str_value(std::move(v)), escape(e) { }
 
     json_type get_type() const noexcept override { return TYPE; }
 
-    // use to access value
+    // use to access value. the value may be modified through the returned reference, so the escaping becomes unknown.
     std::string &value()
     {
+        escape = escaping::unknown;
         return str_value;
     }
 
@@ -273,8 +737,14 @@ public:
         return str_value;
     }
 
+    escaping get_escaping() const noexcept
+    {
+        return escape;
+    }
+
 private:
     std::string str_value;
+    escaping escape;
 
 public:
     static constexpr json_type TYPE = json_type::string;
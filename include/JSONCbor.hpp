@@ -0,0 +1,163 @@
+//
+// Created by Charles on 2018/7/20.
+//
+
+#ifndef JSONCPP_JSONCBOR_HPP
+#define JSONCPP_JSONCBOR_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "JSON.hpp"
+
+namespace json {
+
+/**
+ * encode json instance to CBOR (RFC 8949). integers are encoded as major type 0/1 in the shortest form, and float
+ * numbers as the shortest float (half, single or double) which holds the same value, so the distinction between
+ * int64 and double is kept. objects and arrays are encoded with definite length.
+ * @param token a json instance to be encoded.
+ * @param out the encoded data is appended to it.
+ */
+void to_cbor(const json_token &token, std::vector<uint8_t> &out);
+
+inline std::vector<uint8_t> to_cbor(const json_token &token)
+{
+    std::vector<uint8_t> out;
+    to_cbor(token, out);
+    return out;
+}
+
+/**
+ * decode CBOR data to {@code json_token}, with the duplicated key check and nesting limit of {@code Policy}.
+ * only {@code strict_parse_policy} and {@code trusted_parse_policy} are instantiated by the library.
+ *
+ * data items are mapped to json types as follows:
+ *
+ * - unsigned and negative integers: int64 number, or float number if it is out of the range of int64.
+ * - half, single and double floats: float number.
+ * - text strings: string. byte strings: string encoded as base64url without padding.
+ * - arrays and maps: array and object, both definite and indefinite length. map keys must be text strings.
+ * - false, true and null: boolean and null. undefined and other simple values: null.
+ * - tags are ignored, the tagged item is decoded.
+ *
+ * @param data CBOR data, which should contain exactly one data item.
+ * @param size size of the data.
+ * @param error out param, a code to identify decode error, 0 means no error. {@code nullptr} can be passed.
+ * @return decoded value, or a default empty {@code std::unique_ptr} object if any errors occur.
+ */
+template<typename Policy>
+std::unique_ptr<json_token> parse_cbor(const uint8_t *data, size_t size, int *error);
+
+inline std::unique_ptr<json_token> parse_cbor(const uint8_t *data, size_t size, int *error)
+{
+    return parse_cbor<strict_parse_policy>(data, size, error);
+}
+
+inline std::unique_ptr<json_token> parse_cbor(const std::vector<uint8_t> &data, int *error)
+{
+    return parse_cbor<strict_parse_policy>(data.data(), data.size(), error);
+}
+
+/**
+ * pull-style CBOR reader with the same interface as {@code json_reader}, so the same deserialization handlers
+ * ({@code deserialize_from_cbor}) can read CBOR without building {@code json_token}. the values are mapped to json
+ * types like {@code parse_cbor}, definite-length text strings are read in place without copying. the nesting depth
+ * of the arrays and maps begun, read or skipped is limited by {@code strict_parse_policy::max_depth}.
+ */
+class cbor_reader
+{
+public:
+    cbor_reader(const uint8_t *data, size_t size) noexcept : cur(data), end(data + size), code(0) { }
+
+    /**
+     * get the type of the next value. {@code json_type::null} is returned if the next value is not a valid item.
+     */
+    json_type peek() noexcept;
+
+    bool begin_object();
+
+    /**
+     * move to the next member of the current map, and read its key.
+     * @param key out param, the key. it is valid until the next call of the reader.
+     * @param length out param, the length of the key.
+     * @return false when the map ends or an error occurs.
+     */
+    bool next_member(const char **key, size_t *length);
+
+    bool begin_array();
+
+    /**
+     * move to the next element of the current array.
+     * @return false when the array ends or an error occurs.
+     */
+    bool next_element() noexcept;
+
+    /**
+     * read string value to {@code value}, its capacity is reused.
+     */
+    bool read_string(std::string &value);
+
+    /**
+     * read string value without copying it if it is a definite-length text string.
+     * @param data out param, the string. it is valid until the next call of the reader.
+     * @param length out param, the length of the string.
+     */
+    bool read_string(const char **data, size_t *length);
+
+    /**
+     * read number value.
+     * @param is_float out param, true if the value is stored in {@code float_value}, otherwise in {@code int_value}.
+     */
+    bool read_number(bool &is_float, int64_t &int_value, double &float_value) noexcept;
+
+    bool read_bool(bool &value) noexcept;
+
+    bool read_null() noexcept;
+
+    /**
+     * read the next value of any type as {@code json_token}.
+     * @return the value, or {@code nullptr} if an error occurs.
+     */
+    std::unique_ptr<json_token> read_token();
+
+    /**
+     * skip the next value of any type without decoding it.
+     */
+    void skip_value() noexcept;
+
+    /**
+     * check that there is nothing after the last value.
+     */
+    bool finish() noexcept;
+
+    /**
+     * error code of the first error, 0 means no error. use {@code get_error_info} to get the description.
+     */
+    int error() const noexcept
+    {
+        return code;
+    }
+
+    /**
+     * current reading position in the data.
+     */
+    const uint8_t *position() const noexcept
+    {
+        return cur;
+    }
+
+private:
+    bool next_item() noexcept;
+
+    const uint8_t *cur;
+    const uint8_t *end;
+    int code;
+    // remaining item count of the open arrays and maps, {@code UINT64_MAX} for indefinite length.
+    std::vector<uint64_t> remaining;
+    std::string scratch;
+};
+
+}
+
+#endif //JSONCPP_JSONCBOR_HPP
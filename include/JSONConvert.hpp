@@ -6,11 +6,23 @@
 #define JSONCPP_JSONCONVERT_H
 
 #include <list>
+#include <iostream>
 #include <cstring>
 #include "JSON.hpp"
+#include "JSONReader.hpp"
+#include "JSONCbor.hpp"
 
 namespace json {
 
+/**
+ * each {@code deserialize_impl} provides two ways of deserialization:
+ *
+ * - {@code deserialize(T &t, const json_token &token)}: from a parsed {@code json_token}. its variant
+ *   {@code deserialize(T &t, json_token &&token)} takes a parsed {@code json_token} which is discarded after
+ *   deserialization, strings and subtrees are moved out of it.
+ * - {@code read(T &t, Reader &reader)}: directly from a pull reader (such as {@code json_reader}), the value which
+ *   does not match the type of {@code T} is skipped.
+ */
 template<typename T>
 struct deserialize_impl
 {
@@ -19,6 +31,18 @@ struct deserialize_impl
         std::cerr << "deserialize impl type: " << typeid(T).name() << std::endl;
         //static_assert(false);
     }
+
+    static void deserialize(T &t, json_token &&token)
+    {
+        deserialize(t, static_cast<const json_token &>(token));
+    }
+
+    template<typename Reader>
+    static void read(T &t, Reader &reader)
+    {
+        std::cerr << "deserialize impl type: " << typeid(T).name() << std::endl;
+        reader.skip_value();
+    }
 };
 
 template<typename T, bool = std::is_arithmetic<typename std::remove_cv<T>::type>::value>
@@ -34,6 +58,76 @@ void deserialize(T &t, const json_token &token)
     handler::deserialize(t, token);
 }
 
+/**
+ * consuming deserialization, strings and subtrees are moved out of {@code token} instead of being copied.
+ * {@code token} should be discarded afterwards.
+ */
+template<typename T>
+void deserialize(T &t, json_token &&token)
+{
+    using handler = typename deserialize_dispatcher<T>::handler;
+    handler::deserialize(t, std::move(token));
+}
+
+/**
+ * deserialize from json text directly, no {@code json_token} is built. unknown keys are skipped without allocation,
+ * and when a key appears more than once, the last one wins.
+ * @param t the object to be deserialized.
+ * @param json json text. like {@code parse}, the text should be terminated by '\0' at {@code json[length]}.
+ * @param length length of the json text.
+ * @param error out param, a code to identify parse error, 0 means no error. {@code nullptr} can be passed.
+ * @return true if no error occurs. members read before the error keep their values.
+ */
+template<typename T>
+bool deserialize_from_text(T &t, const char *json, size_t length, int *error = nullptr)
+{
+    using handler = typename deserialize_dispatcher<T>::handler;
+
+    json_reader reader(json, length);
+    handler::read(t, reader);
+    reader.finish();
+    if (error) {
+        *error = reader.error();
+    }
+    return reader.error() == 0;
+}
+
+template<typename T>
+T deserialize_from_text(const char *json, size_t length, int *error = nullptr)
+{
+    T t = T();
+    deserialize_from_text(t, json, length, error);
+    return t;
+}
+
+template<typename T>
+T deserialize_from_text(const std::string &json, int *error = nullptr)
+{
+    return deserialize_from_text<T>(json.c_str(), json.size(), error);
+}
+
+/**
+ * deserialize from CBOR data directly by {@code cbor_reader}, like {@code deserialize_from_text}.
+ * @param t the object to be deserialized.
+ * @param data CBOR data, which should contain exactly one data item.
+ * @param size size of the data.
+ * @param error out param, a code to identify decode error, 0 means no error. {@code nullptr} can be passed.
+ * @return true if no error occurs. members read before the error keep their values.
+ */
+template<typename T>
+bool deserialize_from_cbor(T &t, const uint8_t *data, size_t size, int *error = nullptr)
+{
+    using handler = typename deserialize_dispatcher<T>::handler;
+
+    cbor_reader reader(data, size);
+    handler::read(t, reader);
+    reader.finish();
+    if (error) {
+        *error = reader.error();
+    }
+    return reader.error() == 0;
+}
+
 template<typename T>
 struct deserialize_arithmetic_impl
 {
@@ -50,6 +144,27 @@ struct deserialize_arithmetic_impl
             t = static_cast<T>((int64_t)num);
         }
     }
+
+    static void deserialize(T &t, json_token &&token)
+    {
+        deserialize(t, static_cast<const json_token &>(token));
+    }
+
+    template<typename Reader>
+    static void read(T &t, Reader &reader)
+    {
+        if (reader.peek() != json_type::number) {
+            reader.skip_value();
+            return;
+        }
+
+        bool is_float;
+        int64_t int_value;
+        double float_value;
+        if (reader.read_number(is_float, int_value, float_value)) {
+            t = is_float ? static_cast<T>(float_value) : static_cast<T>(int_value);
+        }
+    }
 };
 
 template<>
@@ -63,6 +178,22 @@ struct deserialize_arithmetic_impl<bool>
 
         t = (bool)static_cast<const json_bool_value &>(token); // NOLINT
     }
+
+    static void deserialize(bool &t, json_token &&token)
+    {
+        deserialize(t, static_cast<const json_token &>(token));
+    }
+
+    template<typename Reader>
+    static void read(bool &t, Reader &reader)
+    {
+        if (reader.peek() != json_type::boolean) {
+            reader.skip_value();
+            return;
+        }
+
+        reader.read_bool(t);
+    }
 };
 
 template<typename T>
@@ -71,6 +202,56 @@ struct deserialize_dispatcher<T, true>
     typedef deserialize_arithmetic_impl<T> handler;
 };
 
+/**
+ * arithmetic types except bool, arrays of them are converted in bulk by {@code deserialize_numbers}.
+ */
+template<typename T>
+struct is_json_number
+        : std::integral_constant<bool, std::is_arithmetic<T>::value && !std::is_same<typename std::remove_cv<T>::type, bool>::value>
+{
+};
+
+template<typename T, typename S>
+void copy_numbers(T *out, const S *in, size_t count)
+{
+    if (std::is_same<T, S>::value) {
+        std::memcpy(out, in, count * sizeof(T));
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = static_cast<T>(in[i]);
+    }
+}
+
+/**
+ * convert the first {@code count} elements of {@code ary} to {@code out} contiguously, the element which is not
+ * number is left unchanged. packed array is copied directly, with {@code memcpy} if the types match.
+ */
+template<typename T>
+void deserialize_numbers(T *out, const json_array &ary, size_t count)
+{
+    auto packed = ary.get_packed();
+    switch (packed.type) {
+        case json_array::packing::int64:
+            copy_numbers(out, packed.ints, count);
+            return;
+        case json_array::packing::float64:
+            copy_numbers(out, packed.floats, count);
+            return;
+        default:
+            break;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const json_token *element = ary[i];
+        if (element->get_type() != json_type::number) {
+            continue;
+        }
+        const json_number_value &num = static_cast<const json_number_value &>(*element); // NOLINT
+        out[i] = num.is_float_value() ? static_cast<T>((double)num) : static_cast<T>((int64_t)num);
+    }
+}
+
 template<typename T>
 struct deserialize_impl<std::map<std::string, T>>
 {
@@ -89,6 +270,43 @@ struct deserialize_impl<std::map<std::string, T>>
             t.emplace(property.first, std::move(value));
         }
     }
+
+    static void deserialize(std::map<std::string, T> &t, json_token &&token)
+    {
+        using handler = typename deserialize_dispatcher<T>::handler;
+
+        if (token.get_type() != json_type::object) {
+            return;
+        }
+
+        json_object &obj = static_cast<json_object &>(token);
+        for (auto &property : obj) {
+            T value = T();
+            handler::deserialize(value, std::move(*property.second));
+            t.emplace(property.first, std::move(value));
+        }
+    }
+
+    template<typename Reader>
+    static void read(std::map<std::string, T> &t, Reader &reader)
+    {
+        using handler = typename deserialize_dispatcher<T>::handler;
+
+        if (reader.peek() != json_type::object) {
+            reader.skip_value();
+            return;
+        }
+
+        const char *key;
+        size_t length;
+        reader.begin_object();
+        while (reader.next_member(&key, &length)) {
+            std::string property(key, length);
+            T value = T();
+            handler::read(value, reader);
+            t.emplace(std::move(property), std::move(value));
+        }
+    }
 };
 
 template<typename T>
@@ -96,19 +314,76 @@ struct deserialize_impl<std::vector<T>>
 {
     static void deserialize(std::vector<T> &t, const json_token &token)
     {
-        using handler = typename deserialize_dispatcher<T>::handler;
+        if (token.get_type() != json_type::array) {
+            return;
+        }
+
+        append_elements(t, static_cast<const json_array &>(token), is_json_number<T>());
+    }
 
+    static void deserialize(std::vector<T> &t, json_token &&token)
+    {
         if (token.get_type() != json_type::array) {
             return;
         }
 
-        const json_array &ary = static_cast<const json_array &>(token);
+        move_elements(t, static_cast<json_array &>(token), is_json_number<T>());
+    }
+
+    template<typename Reader>
+    static void read(std::vector<T> &t, Reader &reader)
+    {
+        using handler = typename deserialize_dispatcher<T>::handler;
+
+        if (reader.peek() != json_type::array) {
+            reader.skip_value();
+            return;
+        }
+
+        reader.begin_array();
+        while (reader.next_element()) {
+            T value = T();
+            handler::read(value, reader);
+            t.emplace_back(std::move(value));
+        }
+    }
+
+private:
+    static void append_elements(std::vector<T> &t, const json_array &ary, std::true_type)
+    {
+        size_t base = t.size();
+        t.resize(base + ary.size());
+        deserialize_numbers(t.data() + base, ary, ary.size());
+    }
+
+    static void append_elements(std::vector<T> &t, const json_array &ary, std::false_type)
+    {
+        using handler = typename deserialize_dispatcher<T>::handler;
+
+        t.reserve(t.size() + ary.size());
         for (const auto &element : ary) {
             T value = T();
             handler::deserialize(value, *element);
             t.emplace_back(std::move(value));
         }
     }
+
+    static void move_elements(std::vector<T> &t, json_array &ary, std::true_type)
+    {
+        // nothing to move out of number values.
+        append_elements(t, ary, std::true_type());
+    }
+
+    static void move_elements(std::vector<T> &t, json_array &ary, std::false_type)
+    {
+        using handler = typename deserialize_dispatcher<T>::handler;
+
+        t.reserve(t.size() + ary.size());
+        for (auto &element : ary) {
+            t.emplace_back();
+            handler::deserialize(t.back(), std::move(*element));
+        }
+    }
 };
 
 template<typename T>
@@ -129,6 +404,38 @@ struct deserialize_impl<std::list<T>>
             t.emplace_back(std::move(value));
         }
     }
+
+    static void deserialize(std::list<T> &t, json_token &&token)
+    {
+        using handler = typename deserialize_dispatcher<T>::handler;
+
+        if (token.get_type() != json_type::array) {
+            return;
+        }
+
+        json_array &ary = static_cast<json_array &>(token);
+        for (auto &element : ary) {
+            t.emplace_back();
+            handler::deserialize(t.back(), std::move(*element));
+        }
+    }
+
+    template<typename Reader>
+    static void read(std::list<T> &t, Reader &reader)
+    {
+        using handler = typename deserialize_dispatcher<T>::handler;
+
+        if (reader.peek() != json_type::array) {
+            reader.skip_value();
+            return;
+        }
+
+        reader.begin_array();
+        while (reader.next_element()) {
+            t.emplace_back();
+            handler::read(t.back(), reader);
+        }
+    }
 };
 
 template<typename T, size_t N>
@@ -136,8 +443,6 @@ struct deserialize_impl<T[N]>
 {
     static void deserialize(T *t, const json_token &token)
     {
-        using handler = typename deserialize_dispatcher<T>::handler;
-
         if (token.get_type() != json_type::array) {
             return;
         }
@@ -145,10 +450,70 @@ struct deserialize_impl<T[N]>
         const json_array &ary = static_cast<const json_array &>(token);
         size_t count = ary.size();
         count = count > N ? N : count;
+        copy_elements(t, ary, count, is_json_number<T>());
+    }
+
+    static void deserialize(T *t, json_token &&token)
+    {
+        if (token.get_type() != json_type::array) {
+            return;
+        }
+
+        json_array &ary = static_cast<json_array &>(token);
+        size_t count = ary.size();
+        count = count > N ? N : count;
+        move_elements(t, ary, count, is_json_number<T>());
+    }
+
+    template<typename Reader>
+    static void read(T *t, Reader &reader)
+    {
+        using handler = typename deserialize_dispatcher<T>::handler;
+
+        if (reader.peek() != json_type::array) {
+            reader.skip_value();
+            return;
+        }
+
+        size_t i = 0;
+        reader.begin_array();
+        while (reader.next_element()) {
+            if (i < N) {
+                handler::read(t[i++], reader);
+            } else {
+                reader.skip_value();
+            }
+        }
+    }
+
+private:
+    static void copy_elements(T *t, const json_array &ary, size_t count, std::true_type)
+    {
+        deserialize_numbers(t, ary, count);
+    }
+
+    static void copy_elements(T *t, const json_array &ary, size_t count, std::false_type)
+    {
+        using handler = typename deserialize_dispatcher<T>::handler;
+
         for (size_t i = 0; i < count; ++i) {
             handler::deserialize(t[i], *ary[i]);
         }
     }
+
+    static void move_elements(T *t, json_array &ary, size_t count, std::true_type)
+    {
+        deserialize_numbers(t, ary, count);
+    }
+
+    static void move_elements(T *t, json_array &ary, size_t count, std::false_type)
+    {
+        using handler = typename deserialize_dispatcher<T>::handler;
+
+        for (size_t i = 0; i < count; ++i) {
+            handler::deserialize(t[i], std::move(*ary[i]));
+        }
+    }
 };
 
 template<>
@@ -162,6 +527,26 @@ struct deserialize_impl<std::string>
 
         t = static_cast<const json_string_value &>(token).value(); // NOLINT
     }
+
+    static void deserialize(std::string &t, json_token &&token)
+    {
+        if (token.get_type() != json_type::string) {
+            return;
+        }
+
+        t = std::move(static_cast<json_string_value &>(token).value()); // NOLINT
+    }
+
+    template<typename Reader>
+    static void read(std::string &t, Reader &reader)
+    {
+        if (reader.peek() != json_type::string) {
+            reader.skip_value();
+            return;
+        }
+
+        reader.read_string(t);
+    }
 };
 
 template<size_t N>
@@ -185,6 +570,36 @@ struct deserialize_impl<char[N]>
         std::memcpy(t, str.c_str(), count);
         t[count] = '\0';
     }
+
+    static void deserialize(char *t, json_token &&token)
+    {
+        deserialize(t, static_cast<const json_token &>(token));
+    }
+
+    template<typename Reader>
+    static void read(char *t, Reader &reader)
+    {
+        static_assert(N > 0);
+
+        auto type = reader.peek();
+        if (type == json_type::null) {
+            reader.read_null();
+            t[0] = '\0';
+            return;
+        }
+        if (type != json_type::string) {
+            reader.skip_value();
+            return;
+        }
+
+        const char *str;
+        size_t count;
+        if (reader.read_string(&str, &count)) {
+            count = count > (N - 1) ? (N - 1) : count;
+            std::memcpy(t, str, count);
+            t[count] = '\0';
+        }
+    }
 };
 
 template<typename T>
@@ -202,6 +617,34 @@ struct deserialize_impl<std::unique_ptr<T>>
         t.reset(new T());
         handler::deserialize(*t, token);
     }
+
+    static void deserialize(std::unique_ptr<T> &t, json_token &&token)
+    {
+        using handler = typename deserialize_dispatcher<T>::handler;
+
+        if (token.get_type() == json_type::null) {
+            t = nullptr;
+            return;
+        }
+
+        t.reset(new T());
+        handler::deserialize(*t, std::move(token));
+    }
+
+    template<typename Reader>
+    static void read(std::unique_ptr<T> &t, Reader &reader)
+    {
+        using handler = typename deserialize_dispatcher<T>::handler;
+
+        if (reader.peek() == json_type::null) {
+            reader.read_null();
+            t = nullptr;
+            return;
+        }
+
+        t.reset(new T());
+        handler::read(*t, reader);
+    }
 };
 
 template<typename T>
@@ -219,23 +662,571 @@ struct deserialize_impl<std::shared_ptr<T>>
         t = std::make_shared<T>();
         handler::deserialize(*t, token);
     }
+
+    static void deserialize(std::shared_ptr<T> &t, json_token &&token)
+    {
+        using handler = typename deserialize_dispatcher<T>::handler;
+
+        if (token.get_type() == json_type::null) {
+            t = nullptr;
+            return;
+        }
+
+        t = std::make_shared<T>();
+        handler::deserialize(*t, std::move(token));
+    }
+
+    template<typename Reader>
+    static void read(std::shared_ptr<T> &t, Reader &reader)
+    {
+        using handler = typename deserialize_dispatcher<T>::handler;
+
+        if (reader.peek() == json_type::null) {
+            reader.read_null();
+            t = nullptr;
+            return;
+        }
+
+        t = std::make_shared<T>();
+        handler::read(*t, reader);
+    }
+};
+
+/**
+ * keep the subtree as {@code json_token}. the consuming deserialization takes it over without copying.
+ */
+template<>
+struct deserialize_impl<std::unique_ptr<json_token>>
+{
+    static void deserialize(std::unique_ptr<json_token> &t, const json_token &token)
+    {
+        t = clone(token);
+    }
+
+    static void deserialize(std::unique_ptr<json_token> &t, json_token &&token)
+    {
+        t = clone(std::move(token));
+    }
+
+    template<typename Reader>
+    static void read(std::unique_ptr<json_token> &t, Reader &reader)
+    {
+        t = reader.read_token();
+    }
+};
+
+template<typename P>
+struct member_pointer_traits;
+
+template<typename C, typename M>
+struct member_pointer_traits<M C::*>
+{
+    typedef C class_type;
+    typedef M member_type;
+};
+
+/**
+ * hash table from member name to its deserializer, built once for each type registered by {@code DESERIALIZE_CLASS}.
+ * the bucket count is grown until no two names share a bucket (for a few dozen members, a table several times
+ * larger is enough), so that a lookup usually costs one hash and one comparison.
+ */
+template<typename Fn>
+class member_table
+{
+public:
+    void add(const char *name, size_t length, Fn fn)
+    {
+        if (!find(name, length)) {
+            entries.push_back(entry{name, length, fn});
+            build();
+        }
+    }
+
+    Fn find(const char *key, size_t length) const noexcept
+    {
+        if (entries.empty()) {
+            return nullptr;
+        }
+        for (size_t i = hash(key, length) & mask;; i = (i + 1) & mask) {
+            auto n = buckets[i];
+            if (n == 0) {
+                return nullptr;
+            }
+            const entry &e = entries[n - 1];
+            if (e.length == length && std::memcmp(e.name, key, length) == 0) {
+                return e.fn;
+            }
+        }
+    }
+
+private:
+    struct entry
+    {
+        const char *name;
+        size_t length;
+        Fn fn;
+    };
+
+    static size_t hash(const char *key, size_t length) noexcept
+    {
+        // FNV-1a
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < length; ++i) {
+            h = (h ^ static_cast<unsigned char>(key[i])) * 16777619u;
+        }
+        return h;
+    }
+
+    void build()
+    {
+        size_t size = 4;
+        while (size < entries.size() * 2) {
+            size <<= 1;
+        }
+        for (size_t limit = size * 16;; size <<= 1) {
+            mask = size - 1;
+            buckets.assign(size, 0);
+            bool perfect = true;
+            for (size_t n = 0; n < entries.size(); ++n) {
+                size_t i = hash(entries[n].name, entries[n].length) & mask;
+                if (buckets[i] != 0) {
+                    perfect = false;
+                    while (buckets[i] != 0) {
+                        i = (i + 1) & mask;
+                    }
+                }
+                buckets[i] = static_cast<uint32_t>(n + 1);
+            }
+            if (perfect || size >= limit) {
+                return;
+            }
+        }
+    }
+
+    std::vector<entry> entries;
+    std::vector<uint32_t> buckets;
+    size_t mask = 0;
+};
+
+template<typename T, typename Ref, typename M, M T::*member>
+void deserialize_member(T &t, Ref token)
+{
+    deserialize_dispatcher<M>::handler::deserialize(t.*member, std::forward<Ref>(token));
+}
+
+template<typename T, typename Reader, typename M, M T::*member>
+void read_member(T &t, Reader &reader)
+{
+    deserialize_dispatcher<M>::handler::read(t.*member, reader);
+}
+
+template<typename T, typename Ref>
+struct token_member_collector
+{
+    member_table<void (*)(T &, Ref)> &table;
+
+    template<typename P, P member>
+    void visit(const char *name, size_t length)
+    {
+        table.add(name, length, &deserialize_member<T, Ref, typename member_pointer_traits<P>::member_type, member>);
+    }
+};
+
+template<typename T, typename Reader>
+struct reader_member_collector
+{
+    member_table<void (*)(T &, Reader &)> &table;
+
+    template<typename P, P member>
+    void visit(const char *name, size_t length)
+    {
+        table.add(name, length, &read_member<T, Reader, typename member_pointer_traits<P>::member_type, member>);
+    }
 };
 
+/**
+ * @tparam Ref {@code const json_token &} or {@code json_token &&}.
+ */
+template<typename T, typename Ref>
+const member_table<void (*)(T &, Ref)> &token_member_table()
+{
+    static const member_table<void (*)(T &, Ref)> table = [] {
+        member_table<void (*)(T &, Ref)> ret;
+        token_member_collector<T, Ref> collector{ret};
+        deserialize_impl<T>::visit_members(collector);
+        return ret;
+    }();
+    return table;
+}
+
+template<typename T, typename Reader>
+const member_table<void (*)(T &, Reader &)> &reader_member_table()
+{
+    static const member_table<void (*)(T &, Reader &)> table = [] {
+        member_table<void (*)(T &, Reader &)> ret;
+        reader_member_collector<T, Reader> collector{ret};
+        deserialize_impl<T>::visit_members(collector);
+        return ret;
+    }();
+    return table;
+}
+
+/**
+ * iterate the properties of object once, and dispatch each of them to the member with the same name.
+ */
+template<typename T>
+void deserialize_members(T &t, const json_token &token)
+{
+    if (token.get_type() != json_type::object) {
+        return;
+    }
+
+    const auto &table = token_member_table<T, const json_token &>();
+    const json_object &obj = static_cast<const json_object &>(token); // NOLINT
+    for (const auto &property : obj) {
+        auto fn = table.find(property.first.data(), property.first.size());
+        if (fn) {
+            fn(t, *property.second);
+        }
+    }
+}
+
+template<typename T>
+void deserialize_members(T &t, json_token &&token)
+{
+    if (token.get_type() != json_type::object) {
+        return;
+    }
+
+    const auto &table = token_member_table<T, json_token &&>();
+    json_object &obj = static_cast<json_object &>(token); // NOLINT
+    for (auto &property : obj) {
+        auto fn = table.find(property.first.data(), property.first.size());
+        if (fn) {
+            fn(t, std::move(*property.second));
+        }
+    }
+}
+
+template<typename T, typename Reader>
+void read_members(T &t, Reader &reader)
+{
+    if (reader.peek() != json_type::object) {
+        reader.skip_value();
+        return;
+    }
+
+    const auto &table = reader_member_table<T, Reader>();
+    const char *key;
+    size_t length;
+    reader.begin_object();
+    while (reader.next_member(&key, &length)) {
+        auto fn = table.find(key, length);
+        if (fn) {
+            fn(t, reader);
+        } else {
+            reader.skip_value();
+        }
+    }
+}
+
+/**
+ * each {@code serialize_impl} provides {@code template<typename Builder> serialize(const T &t, Builder &builder)},
+ * which formats {@code t} as compact json and appends it to {@code builder}, either {@code std::string} or
+ * {@code stream_builder}.
+ */
+template<typename T>
+struct serialize_impl
+{
+    template<typename Builder>
+    static void serialize(const T &t, Builder &builder)
+    {
+        std::cerr << "serialize impl type: " << typeid(T).name() << std::endl;
+        builder.append("null", 4);
+    }
+};
+
+template<typename T, bool = std::is_arithmetic<typename std::remove_cv<T>::type>::value>
+struct serialize_dispatcher
+{
+    typedef serialize_impl<T> handler;
+};
+
+/**
+ * serialize {@code t} to json text directly, no {@code json_token} is built.
+ * @param t the object to be serialized.
+ * @param builder the json text is appended to it.
+ */
+template<typename T>
+void serialize(const T &t, std::string &builder)
+{
+    using handler = typename serialize_dispatcher<T>::handler;
+    handler::serialize(t, builder);
+}
+
+template<typename T>
+std::string serialize(const T &t)
+{
+    std::string builder;
+    serialize(t, builder);
+    return builder;
+}
+
+/**
+ * serialize {@code t} and write it to {@code sink} through a fixed-size buffer, without building the whole text
+ * in memory.
+ * @return false if the sink fails.
+ */
+template<typename T>
+bool serialize(const T &t, json_sink &sink, size_t buffer_size = 64 * 1024)
+{
+    using handler = typename serialize_dispatcher<T>::handler;
+    stream_builder builder(sink, buffer_size);
+    handler::serialize(t, builder);
+    return builder.flush() && sink.flush();
+}
+
+template<typename T, bool = std::is_floating_point<T>::value>
+struct serialize_arithmetic_impl
+{
+    // unsigned values are formatted as uint64_t, so that values above INT64_MAX are not negative.
+    typedef typename std::conditional<std::is_unsigned<T>::value, uint64_t, int64_t>::type integer_type;
+
+    template<typename Builder>
+    static void serialize(T t, Builder &builder)
+    {
+        format_number(static_cast<integer_type>(t), builder);
+    }
+};
+
+template<typename T>
+struct serialize_arithmetic_impl<T, true>
+{
+    template<typename Builder>
+    static void serialize(T t, Builder &builder)
+    {
+        format_number(static_cast<double>(t), builder);
+    }
+};
+
+template<>
+struct serialize_arithmetic_impl<bool, false>
+{
+    template<typename Builder>
+    static void serialize(bool t, Builder &builder)
+    {
+        if (t) {
+            builder.append("true", 4);
+        } else {
+            builder.append("false", 5);
+        }
+    }
+};
+
+template<typename T>
+struct serialize_dispatcher<T, true>
+{
+    typedef serialize_arithmetic_impl<typename std::remove_cv<T>::type> handler;
+};
+
+template<typename T>
+struct serialize_impl<std::map<std::string, T>>
+{
+    template<typename Builder>
+    static void serialize(const std::map<std::string, T> &t, Builder &builder)
+    {
+        using handler = typename serialize_dispatcher<T>::handler;
+
+        builder.push_back('{');
+        bool first = true;
+        for (const auto &property : t) {
+            if (!first) {
+                builder.push_back(',');
+            }
+            first = false;
+            format_string(property.first.data(), property.first.size(), builder);
+            builder.push_back(':');
+            handler::serialize(property.second, builder);
+        }
+        builder.push_back('}');
+    }
+};
+
+template<typename C, typename T, typename Builder>
+void serialize_elements(const C &t, Builder &builder)
+{
+    using handler = typename serialize_dispatcher<T>::handler;
+
+    builder.push_back('[');
+    bool first = true;
+    for (const auto &element : t) {
+        if (!first) {
+            builder.push_back(',');
+        }
+        first = false;
+        handler::serialize(element, builder);
+    }
+    builder.push_back(']');
+}
+
+template<typename T>
+struct serialize_impl<std::vector<T>>
+{
+    template<typename Builder>
+    static void serialize(const std::vector<T> &t, Builder &builder)
+    {
+        serialize_elements<std::vector<T>, T>(t, builder);
+    }
+};
+
+template<typename T>
+struct serialize_impl<std::list<T>>
+{
+    template<typename Builder>
+    static void serialize(const std::list<T> &t, Builder &builder)
+    {
+        serialize_elements<std::list<T>, T>(t, builder);
+    }
+};
+
+template<typename T, size_t N>
+struct serialize_impl<T[N]>
+{
+    template<typename Builder>
+    static void serialize(const T (&t)[N], Builder &builder)
+    {
+        serialize_elements<T[N], T>(t, builder);
+    }
+};
+
+template<>
+struct serialize_impl<std::string>
+{
+    template<typename Builder>
+    static void serialize(const std::string &t, Builder &builder)
+    {
+        format_string(t.data(), t.size(), builder);
+    }
+};
+
+template<size_t N>
+struct serialize_impl<char[N]>
+{
+    template<typename Builder>
+    static void serialize(const char (&t)[N], Builder &builder)
+    {
+        size_t count = 0;
+        while (count < N && t[count] != '\0') {
+            ++count;
+        }
+        format_string(t, count, builder);
+    }
+};
+
+template<typename T>
+struct serialize_impl<std::unique_ptr<T>>
+{
+    template<typename Builder>
+    static void serialize(const std::unique_ptr<T> &t, Builder &builder)
+    {
+        if (!t) {
+            builder.append("null", 4);
+            return;
+        }
+        serialize_dispatcher<T>::handler::serialize(*t, builder);
+    }
+};
+
+template<typename T>
+struct serialize_impl<std::shared_ptr<T>>
+{
+    template<typename Builder>
+    static void serialize(const std::shared_ptr<T> &t, Builder &builder)
+    {
+        if (!t) {
+            builder.append("null", 4);
+            return;
+        }
+        serialize_dispatcher<T>::handler::serialize(*t, builder);
+    }
+};
+
+/**
+ * member visitor of {@code SERIALIZE_CLASS}, member names are identifiers, so they are appended without escaping.
+ */
+template<typename T, typename Builder>
+struct member_serializer
+{
+    const T &t;
+    Builder &builder;
+    bool first;
+
+    template<typename P, P member>
+    void visit(const char *name, size_t length)
+    {
+        using M = typename member_pointer_traits<P>::member_type;
+
+        if (!first) {
+            builder.push_back(',');
+        }
+        first = false;
+        builder.push_back('\"');
+        builder.append(name, length);
+        builder.append("\":", 2);
+        serialize_dispatcher<M>::handler::serialize(t.*member, builder);
+    }
+};
+
+template<typename T, typename Builder>
+void serialize_members(const T &t, Builder &builder)
+{
+    member_serializer<T, Builder> visitor{t, builder, true};
+    builder.push_back('{');
+    serialize_impl<T>::visit_members(visitor);
+    builder.push_back('}');
+}
+
 }
 
 #define DESERIALIZE(member) \
-    0); v = obj[#member]; \
-    if (v) { json::deserialize(t.member, *v); } (void)(0
+    (visitor.template visit<decltype(&self_type::member), &self_type::member>(#member, sizeof(#member) - 1), 0)
 
 #define DESERIALIZE_CLASS(type, ...) \
 template<> \
 struct deserialize_impl<type> { \
+    using self_type = type; \
+    template<typename Visitor> \
+    static void visit_members(Visitor &visitor) { \
+        int expand[] = {0, ##__VA_ARGS__}; \
+        (void)expand; \
+    } \
     static void deserialize(type &t, const json_token &token) { \
         static_assert(!std::is_const<type>::value); \
-        if (token.get_type() != json_type::object) { return; } \
-        const json_object &obj = static_cast<const json_object &>(token); /* NOLINT */ \
-        const json_token *v = nullptr; \
-        (void)(0, ##__VA_ARGS__ ,0); \
+        json::deserialize_members(t, token); \
+    } \
+    static void deserialize(type &t, json_token &&token) { \
+        json::deserialize_members(t, std::move(token)); \
+    } \
+    template<typename Reader> \
+    static void read(type &t, Reader &reader) { \
+        json::read_members(t, reader); \
+    } \
+}
+
+#define SERIALIZE(member) DESERIALIZE(member)
+
+#define SERIALIZE_CLASS(type, ...) \
+template<> \
+struct serialize_impl<type> { \
+    using self_type = type; \
+    template<typename Visitor> \
+    static void visit_members(Visitor &visitor) { \
+        int expand[] = {0, ##__VA_ARGS__}; \
+        (void)expand; \
+    } \
+    template<typename Builder> \
+    static void serialize(const type &t, Builder &builder) { \
+        json::serialize_members(t, builder); \
     } \
 }
 
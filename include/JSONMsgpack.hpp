@@ -0,0 +1,72 @@
+//
+// Created by Charles on 2018/7/23.
+//
+
+#ifndef JSONCPP_JSONMSGPACK_HPP
+#define JSONCPP_JSONMSGPACK_HPP
+
+#include <cstdint>
+#include <vector>
+#include "JSON.hpp"
+
+namespace json {
+
+/**
+ * encode json instance to MessagePack. integers are encoded in the smallest int format, and float numbers as float32
+ * if the value is kept exactly, otherwise float64, so the distinction between int64 and double is kept.
+ * @param token a json instance to be encoded.
+ * @param out the encoded data is appended to it.
+ */
+void to_msgpack(const json_token &token, std::vector<uint8_t> &out);
+
+inline std::vector<uint8_t> to_msgpack(const json_token &token)
+{
+    std::vector<uint8_t> out;
+    to_msgpack(token, out);
+    return out;
+}
+
+/**
+ * encode json instance to MessagePack into the buffer of caller.
+ * @param buffer destination of the encoded data.
+ * @param size size of the buffer.
+ * @return size of the whole encoded data. if it is greater than {@code size}, only the first {@code size} bytes are
+ * written, and the caller can encode again with a large enough buffer.
+ */
+size_t to_msgpack(const json_token &token, uint8_t *buffer, size_t size);
+
+/**
+ * encode json instance to MessagePack and write it to {@code sink} through a fixed-size buffer, like {@code write}.
+ * @param buffer_size size of the internal buffer.
+ * @return false if the sink fails.
+ */
+bool write_msgpack(const json_token &token, json_sink &sink, size_t buffer_size = 64 * 1024);
+
+/**
+ * decode MessagePack data to {@code json_token} directly, with the duplicated key check and nesting limit of
+ * {@code Policy}. only {@code strict_parse_policy} and {@code trusted_parse_policy} are instantiated by the library.
+ *
+ * int and float formats are decoded as int64 and float numbers (uint64 out of the range of int64 as float number),
+ * bin and ext formats as string encoded as base64url without padding (the ext type is dropped). map keys must be str.
+ *
+ * @param data MessagePack data, which should contain exactly one object.
+ * @param size size of the data.
+ * @param error out param, a code to identify decode error, 0 means no error. {@code nullptr} can be passed.
+ * @return decoded value, or a default empty {@code std::unique_ptr} object if any errors occur.
+ */
+template<typename Policy>
+std::unique_ptr<json_token> parse_msgpack(const uint8_t *data, size_t size, int *error);
+
+inline std::unique_ptr<json_token> parse_msgpack(const uint8_t *data, size_t size, int *error)
+{
+    return parse_msgpack<strict_parse_policy>(data, size, error);
+}
+
+inline std::unique_ptr<json_token> parse_msgpack(const std::vector<uint8_t> &data, int *error)
+{
+    return parse_msgpack<strict_parse_policy>(data.data(), data.size(), error);
+}
+
+}
+
+#endif //JSONCPP_JSONMSGPACK_HPP
@@ -6,9 +6,142 @@
 #define JSONCPP_JSONQUERY_H
 
 #include "JSON.hpp"
+#include "JSONTape.hpp"
 
 namespace json {
 
+/**
+ * parse c-style json string, and only build the values selected by any of the json-path {@code paths}.
+ * other values are skipped without decoding, only their structure is checked. skipped array elements are
+ * replaced by {@code json_null_value} to keep the index of the following elements, and skipped object members
+ * are left out. recursive descent ({@code ..}) and script syntaxes select the whole subtree.
+ * @param json c-style json format string.
+ * @param paths json-path expressions, such as {@code $.hits.hits[*]._id}, or json pointers starting with '/', such as
+ * {@code /hits/hits/0/_id}. "$" or an empty list selects the whole document.
+ * @param error out param, a code to identify parse error, 0 means no error. {@code nullptr} can be passed.
+ * @return the root of the pruned document, or an empty {@code std::unique_ptr} if any errors occur.
+ */
+std::unique_ptr<json_token> parse(const char *json, const std::vector<std::string> &paths, int *error);
+
+inline std::unique_ptr<json_token> parse(const std::string &json, const std::vector<std::string> &paths, int *error)
+{
+    return parse(json.c_str(), paths, error);
+}
+
+class filter_base;
+
+/**
+ * json-path compiled once and evaluated many times, without parsing the path again. evaluation does not modify the
+ * compiled path, so a {@code const compiled_path} can be shared by threads.
+ */
+class compiled_path
+{
+public:
+    compiled_path() noexcept;
+
+    /**
+     * compile {@code path}, see {@code compile}.
+     */
+    explicit compiled_path(const char *path, int *error = nullptr, size_t *error_offset = nullptr);
+
+    explicit compiled_path(const std::string &path, int *error = nullptr, size_t *error_offset = nullptr)
+            : compiled_path(path.c_str(), error, error_offset) { }
+
+    compiled_path(compiled_path &&other) noexcept;
+
+    compiled_path &operator=(compiled_path &&other) noexcept;
+
+    ~compiled_path();
+
+    /**
+     * compile json-path expression, replacing the previous one.
+     * @param path json-path expression, such as {@code $.hits.hits[*]._id}.
+     * @param error out param, {@code QUERY_PATH_SYNTAX_ERROR} if the path is empty or has syntax error, otherwise 0.
+     * {@code nullptr} can be passed.
+     * @param error_offset out param, offset in path where parsing stopped because of syntax error, 0 if there is no
+     * error. {@code nullptr} can be passed.
+     * @return false if the path has syntax error, nothing is selected by the path then.
+     */
+    bool compile(const char *path, int *error = nullptr, size_t *error_offset = nullptr);
+
+    bool valid() const noexcept
+    {
+        return static_cast<bool>(filter);
+    }
+
+    /**
+     * @return the first matched value, or {@code nullptr} if no value matches.
+     */
+    json_token *select_token(json_token &token) const;
+
+    /**
+     * select all matched values into {@code result}, which is cleared first, so its capacity can be reused.
+     */
+    void select_tokens(json_token &token, std::vector<json_token *> &result) const;
+
+    std::vector<json_token *> select_tokens(json_token &token) const
+    {
+        std::vector<json_token *> result;
+        select_tokens(token, result);
+        return result;
+    }
+
+    /**
+     * query tape-format document, start from the root value.
+     * @return index of the first matched value, or {@code json_tape_view::npos} if no value matches.
+     */
+    size_t select_token(const json_tape_view &tape) const;
+
+    void select_tokens(const json_tape_view &tape, std::vector<size_t> &result) const;
+
+    std::vector<size_t> select_tokens(const json_tape_view &tape) const
+    {
+        std::vector<size_t> result;
+        select_tokens(tape, result);
+        return result;
+    }
+
+private:
+    std::unique_ptr<filter_base> filter;
+};
+
+/**
+ * statistics of the process-wide compiled path cache.
+ */
+struct path_cache_stats
+{
+    size_t hits;
+    size_t misses;
+    size_t size;
+    size_t capacity;
+};
+
+/**
+ * set capacity of the process-wide cache of compiled paths, which is used by {@code cached_path} and the
+ * {@code select_token}/{@code select_tokens} functions taking a path string. the least recently used paths are
+ * evicted when it is full. the capacity is 0 by default, which disables the cache.
+ */
+void set_path_cache_capacity(size_t capacity);
+
+path_cache_stats get_path_cache_stats();
+
+/**
+ * remove all cached paths and reset the counters.
+ */
+void clear_path_cache();
+
+/**
+ * get compiled {@code path} from the process-wide cache, it is compiled and added to the cache on a miss. a path
+ * with syntax error is cached too, as an invalid {@code compiled_path}. when the cache is disabled, the path is
+ * compiled every time. the returned path stays valid after it is evicted.
+ */
+std::shared_ptr<const compiled_path> cached_path(const char *path);
+
+inline std::shared_ptr<const compiled_path> cached_path(const std::string &path)
+{
+    return cached_path(path.c_str());
+}
+
 json_token *select_token(json_token &token, const char *path);
 
 inline json_token *select_token(json_token &token, const std::string &path)
@@ -23,6 +156,28 @@ inline std::vector<json_token *> select_tokens(json_token &token, const std::str
     return select_tokens(token, path.c_str());
 }
 
+/**
+ * query tape-format document, start from the root value.
+ * @return index of the first matched value, or {@code json_tape_view::npos} if no value matches.
+ */
+size_t select_token(const json_tape_view &tape, const char *path);
+
+inline size_t select_token(const json_tape_view &tape, const std::string &path)
+{
+    return select_token(tape, path.c_str());
+}
+
+/**
+ * query tape-format document, start from the root value.
+ * @return indices of all matched values.
+ */
+std::vector<size_t> select_tokens(const json_tape_view &tape, const char *path);
+
+inline std::vector<size_t> select_tokens(const json_tape_view &tape, const std::string &path)
+{
+    return select_tokens(tape, path.c_str());
+}
+
 }
 
 #endif //JSONCPP_JSONQUERY_H
@@ -0,0 +1,127 @@
+//
+// Created by Charles on 2018/7/16.
+//
+
+#ifndef JSONCPP_JSONREADER_HPP
+#define JSONCPP_JSONREADER_HPP
+
+#include <string>
+#include "JSON.hpp"
+
+namespace json {
+
+/**
+ * pull-style json reader. values are read one by one from the text without building {@code json_token},
+ * and the caller drives the reading by the structure it expects:
+ *
+ * - call {@code peek} to get the type of the next value, then call the matched {@code read_*} or {@code begin_*}
+ *   method, or {@code skip_value} to skip it.
+ * - after {@code begin_object}, call {@code next_member} until it returns false. each time it returns true, the key
+ *   is returned and exactly one value must be read or skipped.
+ * - after {@code begin_array}, call {@code next_element} until it returns false, and read or skip one value each time.
+ *
+ * the first error is kept, and all methods return false (or do nothing) after an error occurs. the nesting depth of
+ * the objects and arrays begun, read or skipped is limited by {@code strict_parse_policy::max_depth}.
+ */
+class json_reader
+{
+public:
+    /**
+     * @param json json text. like {@code parse}, the text should be terminated by '\0' at {@code json[length]}.
+     * @param length length of the json text.
+     */
+    json_reader(const char *json, size_t length) noexcept : cur(json), end(json + length), first(false), depth(0), code(0) { }
+
+    /**
+     * get the type of the next value. {@code json_type::null} is returned if the next value is not a valid token.
+     */
+    json_type peek() noexcept;
+
+    bool begin_object() noexcept;
+
+    /**
+     * move to the next member of the current object, and read its key.
+     * @param key out param, the key. it is valid until the next call of the reader.
+     * @param length out param, the length of the key.
+     * @return false when the object ends or an error occurs.
+     */
+    bool next_member(const char **key, size_t *length) noexcept;
+
+    bool begin_array() noexcept;
+
+    /**
+     * move to the next element of the current array.
+     * @return false when the array ends or an error occurs.
+     */
+    bool next_element() noexcept;
+
+    /**
+     * read string value to {@code value}, its capacity is reused.
+     */
+    bool read_string(std::string &value);
+
+    /**
+     * read string value without copying it if there is no escape sequence.
+     * @param data out param, the string. it is valid until the next call of the reader.
+     * @param length out param, the length of the string.
+     */
+    bool read_string(const char **data, size_t *length);
+
+    /**
+     * read number value.
+     * @param is_float out param, true if the value is stored in {@code float_value}, otherwise in {@code int_value}.
+     */
+    bool read_number(bool &is_float, int64_t &int_value, double &float_value) noexcept;
+
+    bool read_bool(bool &value) noexcept;
+
+    bool read_null() noexcept;
+
+    /**
+     * read the next value of any type as {@code json_token}.
+     * @return the value, or {@code nullptr} if an error occurs.
+     */
+    std::unique_ptr<json_token> read_token();
+
+    /**
+     * skip the next value of any type without decoding it.
+     */
+    void skip_value() noexcept;
+
+    /**
+     * check that there is nothing but whitespace after the last value.
+     */
+    bool finish() noexcept;
+
+    /**
+     * error code of the first error, 0 means no error. use {@code get_error_info} to get the description.
+     */
+    int error() const noexcept
+    {
+        return code;
+    }
+
+    /**
+     * current reading position in the text.
+     */
+    const char *position() const noexcept
+    {
+        return cur;
+    }
+
+private:
+    bool expect(char c, int error_code) noexcept;
+
+    bool enter(char c, int error_code) noexcept;
+
+    const char *cur;
+    const char *end;
+    bool first;
+    unsigned depth;
+    int code;
+    std::string scratch;
+};
+
+}
+
+#endif //JSONCPP_JSONREADER_HPP
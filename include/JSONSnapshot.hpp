@@ -0,0 +1,86 @@
+//
+// Created by Charles on 2018/7/25.
+//
+
+#ifndef JSONCPP_JSONSNAPSHOT_HPP
+#define JSONCPP_JSONSNAPSHOT_HPP
+
+#include <cstdint>
+#include "JSON.hpp"
+#include "JSONTape.hpp"
+
+namespace json {
+
+/**
+ * write tape-format document as a snapshot, which can be opened by {@code json_snapshot} later without parsing.
+ * the snapshot is a header followed by the tape, the string buffer and the key tables, each section is aligned to
+ * 8 bytes. all references are indices and offsets, so the sections are used in place after mapping. objects with at
+ * least {@code json_tape_view::IndexedObjectSize} members get a key table sorted by key, which is looked up by binary
+ * search. numbers are stored in the native byte order, a snapshot is opened only on a machine with the same one.
+ * @param tape the document, e.g. parsed by {@code parse_tape}.
+ * @param sink destination of the snapshot, such as {@code fd_sink} of a file.
+ * @return false if the sink fails.
+ */
+bool write_snapshot(const json_tape_view &tape, json_sink &sink);
+
+/**
+ * read-only snapshot written by {@code write_snapshot}, mapped into memory. opening only checks the header, values
+ * are read from the mapped bytes when they are accessed, through {@code view()}. the view can be passed to
+ * {@code to_string} and {@code select_tokens} like other tape-format documents.
+ */
+class json_snapshot
+{
+public:
+    json_snapshot() noexcept : mapping(nullptr), mapping_size(0) { }
+
+    json_snapshot(const json_snapshot &) = delete;
+
+    json_snapshot(json_snapshot &&other) noexcept;
+
+    json_snapshot &operator=(const json_snapshot &) = delete;
+
+    json_snapshot &operator=(json_snapshot &&other) noexcept;
+
+    ~json_snapshot()
+    {
+        close();
+    }
+
+    /**
+     * map the snapshot file. a previously opened snapshot is closed first.
+     * @param path path of the snapshot file.
+     * @param error out param, a code to identify the error, 0 means no error. {@code nullptr} can be passed.
+     * @param verify check all entries of the snapshot, for a file which may be corrupted or from an untrusted source.
+     * it reads the whole file. when it is false, only the header and the section bounds are checked, and the tape,
+     * strings and key tables are trusted completely: reading a corrupted one is undefined behavior.
+     * @return true if no error occurs.
+     */
+    bool open(const char *path, int *error = nullptr, bool verify = false);
+
+    /**
+     * use a snapshot already in memory, such as a file mapped by the caller. the memory is not owned, it should be
+     * aligned to 8 bytes and kept valid while the snapshot is in use. {@code verify} is the same as {@code open}.
+     */
+    bool attach(const void *data, size_t size, int *error = nullptr, bool verify = false);
+
+    void close() noexcept;
+
+    bool empty() const noexcept
+    {
+        return tape_view.empty();
+    }
+
+    json_tape_view view() const noexcept
+    {
+        return tape_view;
+    }
+
+private:
+    void *mapping;
+    size_t mapping_size;
+    json_tape_view tape_view;
+};
+
+}
+
+#endif //JSONCPP_JSONSNAPSHOT_HPP
@@ -0,0 +1,388 @@
+//
+// Created by Charles on 2018/7/2.
+//
+
+#ifndef JSONCPP_JSONTAPE_HPP
+#define JSONCPP_JSONTAPE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include "JSON.hpp"
+
+namespace json {
+
+/**
+ * read-only view of a tape-format json document. the document is a contiguous array of 64-bit entries
+ * (the tape), each entry holds a type tag in the highest 8 bits and a payload in the low 56 bits:
+ *
+ * - '{' / '[': payload is the index of the matching '}' / ']' entry.
+ * - '}' / ']': payload is the count of members / elements of the container.
+ * - '"': payload is the offset of the string in string buffer. a string is stored as a 32-bit length,
+ *        the bytes and a trailing '\0'.
+ * - 'l' / 'd': int64 / double number, the raw value is stored in the next entry.
+ * - 't' / 'f' / 'n': true / false / null.
+ *
+ * values are addressed by their index in the tape, the root value is always at index 0. an object member
+ * is stored as a key string entry followed by the value.
+ */
+class json_tape_view
+{
+public:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    json_tape_view() noexcept
+            : tape(nullptr), tape_size(0), strings(nullptr), strings_size(0), directory(nullptr), directory_size(0),
+              tables(nullptr) { }
+
+    json_tape_view(const uint64_t *t, size_t t_size, const char *s, size_t s_size) noexcept
+            : tape(t), tape_size(t_size), strings(s), strings_size(s_size), directory(nullptr), directory_size(0),
+              tables(nullptr) { }
+
+    /**
+     * view with key tables (see {@code json_snapshot}), objects with at least {@code IndexedObjectSize} members are
+     * looked up by binary search.
+     * @param d directory of key tables, pairs of object index and table offset in {@code tb}, sorted by object index.
+     * @param d_size count of pairs in directory.
+     * @param tb key tables, each one holds the key indices of an object sorted by the key.
+     */
+    json_tape_view(const uint64_t *t, size_t t_size, const char *s, size_t s_size, const uint64_t *d, size_t d_size,
+                   const uint64_t *tb) noexcept
+            : tape(t), tape_size(t_size), strings(s), strings_size(s_size), directory(d), directory_size(d_size),
+              tables(tb) { }
+
+    bool empty() const noexcept
+    {
+        return tape_size == 0;
+    }
+
+    size_t root() const noexcept
+    {
+        return 0;
+    }
+
+    json_type get_type(size_t index) const noexcept
+    {
+        switch (tag(index)) {
+            case '{':
+                return json_type::object;
+            case '[':
+                return json_type::array;
+            case '"':
+                return json_type::string;
+            case 'l':
+            case 'd':
+                return json_type::number;
+            case 't':
+            case 'f':
+                return json_type::boolean;
+            default:
+                return json_type::null;
+        }
+    }
+
+    /**
+     * index of the value next to the value at {@code index}. containers are skipped in O(1).
+     */
+    size_t next(size_t index) const noexcept
+    {
+        switch (tag(index)) {
+            case '{':
+            case '[':
+                return payload(index) + 1;
+            case 'l':
+            case 'd':
+                return index + 2;
+            default:
+                return index + 1;
+        }
+    }
+
+    /**
+     * index of the first child of the container at {@code index}. for object, it is the first key.
+     */
+    size_t begin(size_t index) const noexcept
+    {
+        return index + 1;
+    }
+
+    /**
+     * index of the closing entry of the container at {@code index}.
+     */
+    size_t end(size_t index) const noexcept
+    {
+        return payload(index);
+    }
+
+    /**
+     * count of members of object, or count of elements of array.
+     */
+    size_t size(size_t index) const noexcept
+    {
+        return payload(end(index));
+    }
+
+    /**
+     * get value index of the property in object.
+     * @return value index, or {@code npos} if not found.
+     */
+    size_t find(size_t object, const char *key, size_t length) const noexcept
+    {
+        auto table = key_table(object);
+        if (table) {
+            // the first one of the duplicated keys is placed first in table.
+            size_t low = 0;
+            size_t high = size(object);
+            while (low < high) {
+                auto mid = low + (high - low) / 2;
+                if (compare_key(static_cast<size_t>(table[mid]), key, length) < 0) {
+                    low = mid + 1;
+                } else {
+                    high = mid;
+                }
+            }
+            if (low < size(object) && compare_key(static_cast<size_t>(table[low]), key, length) == 0) {
+                return static_cast<size_t>(table[low]) + 1;
+            }
+            return npos;
+        }
+        for (size_t i = begin(object), e = end(object); i < e; i = next(i + 1)) {
+            if (string_size(i) == length && std::memcmp(string_data(i), key, length) == 0) {
+                return i + 1;
+            }
+        }
+        return npos;
+    }
+
+    size_t find(size_t object, const std::string &key) const noexcept
+    {
+        return find(object, key.c_str(), key.size());
+    }
+
+    /**
+     * compare the key at {@code index} with {@code key}, by bytes and then by length. it is the order of key tables.
+     */
+    int compare_key(size_t index, const char *key, size_t length) const noexcept
+    {
+        auto size = string_size(index);
+        auto r = std::memcmp(string_data(index), key, size < length ? size : length);
+        if (r != 0) {
+            return r;
+        }
+        return size < length ? -1 : size > length ? 1 : 0;
+    }
+
+    /**
+     * key table of the object at {@code index}, {@code nullptr} if it has no table.
+     */
+    const uint64_t *key_table(size_t index) const noexcept
+    {
+        if (directory_size == 0 || size(index) < IndexedObjectSize) {
+            return nullptr;
+        }
+        size_t low = 0;
+        size_t high = directory_size;
+        while (low < high) {
+            auto mid = low + (high - low) / 2;
+            if (directory[mid * 2] < index) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        if (low < directory_size && directory[low * 2] == index) {
+            return tables + directory[low * 2 + 1];
+        }
+        return nullptr;
+    }
+
+    /**
+     * get index of the n-th element of array. elements before it are skipped one by one.
+     * @return element index, or {@code npos} if out of range.
+     */
+    size_t at(size_t array, size_t n) const noexcept
+    {
+        size_t i = begin(array);
+        for (size_t e = end(array); i < e && n > 0; --n) {
+            i = next(i);
+        }
+        return i < end(array) ? i : npos;
+    }
+
+    // scalar access
+    const char *string_data(size_t index) const noexcept
+    {
+        return strings + payload(index) + sizeof(uint32_t);
+    }
+
+    size_t string_size(size_t index) const noexcept
+    {
+        uint32_t length;
+        std::memcpy(&length, strings + payload(index), sizeof(uint32_t));
+        return length;
+    }
+
+    std::string get_string(size_t index) const
+    {
+        return std::string(string_data(index), string_size(index));
+    }
+
+    bool is_float(size_t index) const noexcept
+    {
+        return tag(index) == 'd';
+    }
+
+    int64_t get_int(size_t index) const noexcept
+    {
+        if (is_float(index)) {
+            return static_cast<int64_t>(get_double(index));
+        }
+        return static_cast<int64_t>(tape[index + 1]);
+    }
+
+    double get_double(size_t index) const noexcept
+    {
+        if (!is_float(index)) {
+            return static_cast<double>(static_cast<int64_t>(tape[index + 1]));
+        }
+        double d;
+        std::memcpy(&d, &tape[index + 1], sizeof(double));
+        return d;
+    }
+
+    bool get_bool(size_t index) const noexcept
+    {
+        return tag(index) == 't';
+    }
+
+    // raw access
+    const uint64_t *data() const noexcept
+    {
+        return tape;
+    }
+
+    size_t entry_count() const noexcept
+    {
+        return tape_size;
+    }
+
+    const char *string_buffer() const noexcept
+    {
+        return strings;
+    }
+
+    size_t string_buffer_size() const noexcept
+    {
+        return strings_size;
+    }
+
+    const uint64_t *key_directory() const noexcept
+    {
+        return directory;
+    }
+
+    size_t key_directory_size() const noexcept
+    {
+        return directory_size;
+    }
+
+    const uint64_t *key_tables() const noexcept
+    {
+        return tables;
+    }
+
+    char tag(size_t index) const noexcept
+    {
+        return static_cast<char>(tape[index] >> TagShift);
+    }
+
+    uint64_t payload(size_t index) const noexcept
+    {
+        return tape[index] & PayloadMask;
+    }
+
+private:
+    const uint64_t *tape;
+    size_t tape_size;
+    const char *strings;
+    size_t strings_size;
+    const uint64_t *directory;
+    size_t directory_size;
+    const uint64_t *tables;
+
+public:
+    // objects with at least this many members have key tables in snapshot.
+    static constexpr size_t IndexedObjectSize = 16;
+    static constexpr unsigned TagShift = 56;
+    static constexpr uint64_t PayloadMask = (static_cast<uint64_t>(1) << TagShift) - 1;
+};
+
+
+/**
+ * tape-format json document, owns the tape and the string buffer. see {@code json_tape_view} for the layout.
+ */
+class json_tape
+{
+public:
+    json_tape() = default;
+
+    json_tape_view view() const noexcept
+    {
+        return json_tape_view(tape.data(), tape.size(), strings.data(), strings.size());
+    }
+
+    bool empty() const noexcept
+    {
+        return tape.empty();
+    }
+
+    void clear() noexcept
+    {
+        tape.clear();
+        strings.clear();
+    }
+
+private:
+    friend class tape_builder;
+
+    std::vector<uint64_t> tape;
+    std::string strings;
+};
+
+/**
+ * parse c-style json string to tape-format document. the tape's memory is reused if it is not empty.
+ * only {@code strict_parse_policy} and {@code trusted_parse_policy} are instantiated by the library. when
+ * duplicated keys are not checked, all of them are kept in the tape and {@code find} returns the first one.
+ * @param json c-style json format string.
+ * @param tape out param, the parsed document. it is cleared if any errors occur.
+ * @param error out param, a code to identify parse error, 0 means no error. {@code nullptr} can be passed.
+ * @return true if no error occurs.
+ */
+template<typename Policy>
+bool parse_tape(const char *json, json_tape &tape, int *error);
+
+inline bool parse_tape(const char *json, json_tape &tape, int *error)
+{
+    return parse_tape<strict_parse_policy>(json, tape, error);
+}
+
+inline bool parse_tape(const std::string &json, json_tape &tape, int *error)
+{
+    return parse_tape<strict_parse_policy>(json.c_str(), tape, error);
+}
+
+/**
+ * format the value at {@code index} of tape-format document. the output is the same as {@code to_string}
+ * of the equivalent {@code json_token}, except that object members keep the document order.
+ */
+std::string to_string(const json_tape_view &tape, size_t index, json_format_option option = json_format_option::no_format,
+                      unsigned indention = 1);
+
+inline std::string to_string(const json_tape &tape, json_format_option option = json_format_option::no_format,
+                             unsigned indention = 1)
+{
+    return to_string(tape.view(), 0, option, indention);
+}
+
+}
+
+#endif //JSONCPP_JSONTAPE_HPP
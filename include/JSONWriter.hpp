@@ -0,0 +1,159 @@
+//
+// Created by Charles on 2018/7/23.
+//
+
+#ifndef JSONCPP_JSONWRITER_HPP
+#define JSONCPP_JSONWRITER_HPP
+
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include "JSON.hpp"
+
+namespace json {
+
+/**
+ * push-style json writer, the counterpart of {@code json_reader}. values are formatted one by one without building
+ * {@code json_token}, commas and indention are handled by the writer:
+ *
+ * - in object, call {@code key} before each value.
+ * - a container is opened by {@code begin_object} / {@code begin_array}, and closed by the matched {@code end_*}.
+ * - top-level values are separated by '\n', so a sequence of records can be written as json lines.
+ *
+ * the output is the same as {@code to_string} of the equivalent {@code json_token}, for all {@code json_format_option}.
+ * after a misuse (e.g. value without key in object) or a failure of sink, {@code good} returns false and
+ * all methods do nothing.
+ */
+class json_writer
+{
+public:
+    /**
+     * append the output to {@code output}.
+     */
+    explicit json_writer(std::string &output, const format_options &options = format_options());
+
+    /**
+     * write the output to {@code sink} through a buffer of {@code options.buffer_size}.
+     */
+    explicit json_writer(json_sink &sink, const format_options &options = format_options());
+
+    json_writer(const json_writer &) = delete;
+
+    json_writer &operator=(const json_writer &) = delete;
+
+    /**
+     * the buffered output is flushed.
+     */
+    ~json_writer();
+
+    json_writer &begin_object();
+
+    json_writer &end_object();
+
+    json_writer &begin_array();
+
+    json_writer &end_array();
+
+    json_writer &key(const char *name, size_t length);
+
+    json_writer &key(const std::string &name)
+    {
+        return key(name.data(), name.size());
+    }
+
+    json_writer &key(const char *name)
+    {
+        return key(name, std::strlen(name));
+    }
+
+    json_writer &value(int64_t v);
+
+    json_writer &value(uint64_t v);
+
+    /**
+     * write float number by {@code format_options::nonfinite} and {@code format_options::max_decimal_places},
+     * the writer fails if NaN or infinity is rejected.
+     */
+    json_writer &value(double v);
+
+    json_writer &value(bool v);
+
+    json_writer &value(const char *str, size_t length);
+
+    json_writer &value(const std::string &str)
+    {
+        return value(str.data(), str.size());
+    }
+
+    json_writer &value(const char *str)
+    {
+        return value(str, std::strlen(str));
+    }
+
+    json_writer &value(std::nullptr_t);
+
+    template<typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, json_writer &>::type value(T v)
+    {
+        return value(static_cast<typename std::conditional<std::is_unsigned<T>::value, uint64_t, int64_t>::type>(v));
+    }
+
+    json_writer &value(float v)
+    {
+        return value(static_cast<double>(v));
+    }
+
+    /**
+     * write a json instance as value.
+     */
+    json_writer &value(const json_token &token);
+
+    /**
+     * write the buffered output to sink.
+     * @return false if an error occurs.
+     */
+    bool flush();
+
+    bool good() const noexcept
+    {
+        return !failed;
+    }
+
+    /**
+     * nesting depth of the containers being written.
+     */
+    size_t depth() const noexcept
+    {
+        return levels.size();
+    }
+
+private:
+    struct level
+    {
+        char type;      // '{' or '['
+        size_t count;
+    };
+
+    bool before_value();
+
+    void after_value();
+
+    json_writer &begin_container(char type);
+
+    json_writer &end_container(char type);
+
+    void indent(size_t level_count);
+
+    std::string buffer;
+    std::string &output;
+    json_sink *sink;
+    format_options options;
+    std::vector<level> levels;
+    bool pending_key;
+    bool has_root;
+    bool failed;
+};
+
+}
+
+#endif //JSONCPP_JSONWRITER_HPP
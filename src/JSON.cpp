@@ -5,15 +5,27 @@
 #include <iostream>
 #include <cstring>
 #include <sstream>
+#include <algorithm>
+#include <cerrno>
+#include <thread>
+#include <climits>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 #include "JSON.hpp"
 #include "JSONUtils.hpp"
 
 using namespace json;
 
 
-static std::unique_ptr<json_token> read_token(const char **str, int *error);
+template<typename Policy>
+static std::unique_ptr<json_token> read_token(const char **str, int *error, unsigned depth);
 
-static std::unique_ptr<json_token> read_object(const char **object_str, int *error)
+template<typename Policy>
+static std::unique_ptr<json_token> read_object(const char **object_str, int *error, unsigned depth)
 {
     auto str = skip_whitespace(*object_str, 1);
     auto *ptr = new json_object();
@@ -30,7 +42,7 @@ static std::unique_ptr<json_token> read_object(const char **object_str, int *err
             return nullptr;
         }
         ++str;
-        auto key = read_json_string(&str, error);
+        auto key = read_json_string<Policy::check_control_char>(&str, error);
         if (*error != NO_ERROR) {
             return nullptr;
         }
@@ -41,14 +53,14 @@ static std::unique_ptr<json_token> read_object(const char **object_str, int *err
             return nullptr;
         }
         ++str;
-        auto value = read_token(&str, error);
+        auto value = read_token<Policy>(&str, error, depth);
         if (*error != NO_ERROR) {
             return nullptr;
         }
 
         // insert key and value
         auto ret = ptr->put(std::move(key), std::move(value));
-        if (!json_assert(ret)) {
+        if (Policy::check_duplicated_key && !json_assert(ret)) {
             *error = OBJECT_DUPLICATED_KEY;
             return nullptr;
         }
@@ -68,7 +80,8 @@ static std::unique_ptr<json_token> read_object(const char **object_str, int *err
     }
 }
 
-static std::unique_ptr<json_token> read_array(const char **array_str, int *error)
+template<typename Policy>
+static std::unique_ptr<json_token> read_array(const char **array_str, int *error, unsigned depth)
 {
     auto str = skip_whitespace(*array_str, 1);
     auto *ptr = new json_array();
@@ -80,11 +93,26 @@ static std::unique_ptr<json_token> read_array(const char **array_str, int *error
     }
 
     while (true) {
-        auto elem = read_token(&str, error);
-        if (*error != NO_ERROR) {
-            return nullptr;
+        str = skip_whitespace(str);
+        if (std::strchr("{[\"tfn", *str) == nullptr || *str == '\0') {
+            // numbers are added without token, so that the array can be packed.
+            number_union number{};
+            auto is_float = read_json_number(&str, error, number);
+            if (*error != NO_ERROR) {
+                return nullptr;
+            }
+            if (is_float) {
+                ptr->add(number.float_value);
+            } else {
+                ptr->add(number.int_value);
+            }
+        } else {
+            auto elem = read_token<Policy>(&str, error, depth);
+            if (*error != NO_ERROR) {
+                return nullptr;
+            }
+            ptr->add(std::move(elem));
         }
-        ptr->add(std::move(elem));
 
         str = skip_whitespace(str);
         if (*str == ',') {
@@ -96,23 +124,29 @@ static std::unique_ptr<json_token> read_array(const char **array_str, int *error
             *error = ARRAY_PARSE_ERROR;
             return nullptr;
         }
+        if (ptr->get_packing() != json_array::packing::none) {
+            ptr->shrink_to_fit();
+        }
         *array_str = str + 1;
         return array_ptr;
     }
 }
 
+template<typename Policy>
 static std::unique_ptr<json_token> read_value(const char **value_str, int *error)
 {
     auto str = *value_str;
     if (*str == '\"') {
         // Parse string value
         ++str;
-        auto value = read_json_string(&str, error);
+        bool escape_free = false;
+        auto value = read_json_string<Policy::check_control_char>(&str, error, '\"', &escape_free);
         if (*error != NO_ERROR) {
             return nullptr;
         }
         *value_str = str;
-        return std::unique_ptr<json_token>(new json_string_value(std::move(value)));
+        auto escape = escape_free ? json_string_value::escaping::none : json_string_value::escaping::needed;
+        return std::unique_ptr<json_token>(new json_string_value(std::move(value), escape));
     }
     if (std::strncmp(str, "true", 4) == 0) {
         *value_str = str + 4;
@@ -139,38 +173,41 @@ static std::unique_ptr<json_token> read_value(const char **value_str, int *error
     return std::unique_ptr<json_token>(new json_number_value(number.int_value));
 }
 
-std::unique_ptr<json_token> read_token(const char **str, int *error)
+template<typename Policy>
+std::unique_ptr<json_token> read_token(const char **str, int *error, unsigned depth)
 {
     auto tmp = skip_whitespace(*str);
     *str = tmp;
 
-    if (*tmp == '{') {
-        return read_object(str, error);
-    }
-
-    if (*tmp == '[') {
-        return read_array(str, error);
+    if (*tmp == '{' || *tmp == '[') {
+        if (Policy::max_depth != 0 && depth >= Policy::max_depth) {
+            *error = NESTING_DEPTH_EXCEEDED;
+            return nullptr;
+        }
+        if (*tmp == '{') {
+            return read_object<Policy>(str, error, depth + 1);
+        }
+        return read_array<Policy>(str, error, depth + 1);
     }
 
-    return read_value(str, error);
+    return read_value<Policy>(str, error);
 }
 
+template<typename Policy>
 std::unique_ptr<json_token> json::parse(const char *json, int *error)
 {
-#ifdef ERROR_LOG
     const char *start = json;
-#endif
     int code = NO_ERROR;
-    auto ret = read_token(&json, &code);
+    auto ret = read_token<Policy>(&json, &code, 0);
     if (error) {
         *error = code;
     }
 
     if (code != NO_ERROR) {
-#ifdef ERROR_LOG
-        std::cerr << "unexcepted end character near byte position " << static_cast<int64_t>(json - start)
-                  << ", error code: " << code << ", info: " << GetErrorInfo(code) << std::endl;
-#endif
+        if (Policy::log_error) {
+            std::cerr << "unexcepted end character near byte position " << static_cast<int64_t>(json - start)
+                      << ", error code: " << code << ", info: " << get_error_info(code) << std::endl;
+        }
         return nullptr;     // read token error
     }
     if (assert_end_str(json)) {
@@ -180,12 +217,90 @@ std::unique_ptr<json_token> json::parse(const char *json, int *error)
     if (error) {
         *error = UNEXPECTED_END_CHAR;
     }
-#ifdef ERROR_LOG
-    std::cerr << "unexcepted end character near byte position " << static_cast<int64_t>(json - start) << std::endl;
-#endif
+    if (Policy::log_error) {
+        std::cerr << "unexcepted end character near byte position " << static_cast<int64_t>(json - start) << std::endl;
+    }
     return nullptr;
 }
 
+template std::unique_ptr<json_token> json::parse<strict_parse_policy>(const char *json, int *error);
+template std::unique_ptr<json_token> json::parse<trusted_parse_policy>(const char *json, int *error);
+
+void json_array::unpack_elements() const
+{
+    bool expected = false;
+    if (!unpacking.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+        // another thread is unpacking this array, it is done when the packing is cleared.
+        while (packed.load(std::memory_order_acquire) != packing::none) {
+            std::this_thread::yield();
+        }
+        return;
+    }
+    auto p = packed.load(std::memory_order_relaxed);
+    if (p == packing::none) {
+        unpacking.store(false, std::memory_order_release);
+        return;
+    }
+
+    container tokens;
+    if (p == packing::int64) {
+        tokens.reserve(ints.size());
+        for (auto value : ints) {
+            tokens.emplace_back(new json_number_value(value));
+        }
+    } else {
+        tokens.reserve(floats.size());
+        for (auto value : floats) {
+            tokens.emplace_back(new json_number_value(value));
+        }
+    }
+    children = std::move(tokens);
+    packed.store(packing::none, std::memory_order_release);
+    unpacking.store(false, std::memory_order_release);
+}
+
+void json_array::unpack_for_write()
+{
+    unpack();
+    if (!ints.empty() || !floats.empty()) {
+        std::vector<int64_t>().swap(ints);
+        std::vector<double>().swap(floats);
+    }
+}
+
+void json_array::add(int64_t value)
+{
+    auto p = get_packing();
+    if (p == packing::none && children.empty()) {
+        unpack_for_write();
+        packed.store(p = packing::int64, std::memory_order_relaxed);
+    }
+    if (p == packing::int64) {
+        ints.push_back(value);
+        return;
+    }
+    add(std::unique_ptr<json_token>(new json_number_value(value)));
+}
+
+void json_array::add(double value)
+{
+    auto p = get_packing();
+    if (p == packing::none && children.empty()) {
+        unpack_for_write();
+        packed.store(p = packing::float64, std::memory_order_relaxed);
+    }
+    if (p == packing::float64) {
+        floats.push_back(value);
+        return;
+    }
+    add(std::unique_ptr<json_token>(new json_number_value(value)));
+}
+
+std::unique_ptr<json_token> json::read_json_token(const char **str, int *error, unsigned depth)
+{
+    return read_token<strict_parse_policy>(str, error, depth);
+}
+
 constexpr char hex_digit[] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
 constexpr char escape[256] = {
 #define Z16 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
@@ -201,282 +316,1078 @@ constexpr char escape[256] = {
 #undef Z16
 };
 
-static void format_string(const std::string &value, std::string &builder)
+/**
+ * find the first character which needs escaping in [str, end), or {@code end} if there is none.
+ * 32 / 16 bytes are checked at a time with AVX2 / SSE2.
+ */
+static const char *find_escape(const char *str, const char *end)
+{
+#if defined(__AVX2__)
+    const __m256i control = _mm256_set1_epi8(0x1F);
+    const __m256i quote = _mm256_set1_epi8('\"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i slash = _mm256_set1_epi8('/');
+    const __m256i del = _mm256_set1_epi8(0x7F);
+    for (; end - str >= 32; str += 32) {
+        auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(str));
+        // unsigned chunk <= 0x1F
+        auto m = _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, control), chunk);
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(chunk, quote));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(chunk, backslash));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(chunk, slash));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(chunk, del));
+        auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(m));
+        if (mask != 0) {
+            return str + __builtin_ctz(mask);
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i control16 = _mm_set1_epi8(0x1F);
+    const __m128i quote16 = _mm_set1_epi8('\"');
+    const __m128i backslash16 = _mm_set1_epi8('\\');
+    const __m128i slash16 = _mm_set1_epi8('/');
+    const __m128i del16 = _mm_set1_epi8(0x7F);
+    for (; end - str >= 16; str += 16) {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(str));
+        auto m = _mm_cmpeq_epi8(_mm_min_epu8(chunk, control16), chunk);
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(chunk, quote16));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(chunk, backslash16));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(chunk, slash16));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(chunk, del16));
+        auto mask = static_cast<unsigned>(_mm_movemask_epi8(m));
+        if (mask != 0) {
+            return str + __builtin_ctz(mask);
+        }
+    }
+#endif
+    while (str < end && !escape[static_cast<unsigned char>(*str)]) {
+        ++str;
+    }
+    return str;
+}
+
+/**
+ * formatting functions below are templates of the output {@code Builder}, which is either {@code std::string}
+ * or {@code stream_builder}. a builder provides {@code push_back(char)}, {@code append(const char *, size_t)}
+ * and {@code append(size_t, char)}. separators are written before elements, never removed afterwards.
+ */
+template<typename Builder>
+static void write_string(const char *str, size_t size, Builder &builder)
 {
-    auto str = value.c_str();
-    auto end = str + value.size();
+    auto end = str + size;
 
     builder.push_back('\"');
     while (true) {
         auto start = str;
-        while (!escape[static_cast<unsigned char>(*str)] && str < end) {
-            ++str;
-        }
+        str = find_escape(str, end);
         if (start != str) {
-            builder.append(start, end - start);
+            builder.append(start, str - start);
         }
         if (str == end) {
             break;
         }
 
+        auto c = static_cast<unsigned char>(*str);
         builder.push_back('\\');
-        builder.push_back(escape[static_cast<unsigned char>(*str)]);
-        if (escape[static_cast<unsigned char>(*str)] == 'u') {
+        builder.push_back(escape[c]);
+        if (escape[c] == 'u') {
             builder.append("00", 2);
-            builder.push_back(hex_digit[static_cast<unsigned char>(*str) >> 4u]);
-            builder.push_back(hex_digit[static_cast<unsigned char>(*str) & 0x0fu]);
+            builder.push_back(hex_digit[c >> 4u]);
+            builder.push_back(hex_digit[c & 0x0fu]);
         }
         ++str;
     }
     builder.push_back('\"');
 }
 
-static void format_number(const json_number_value &num, std::string &builder)
+/**
+ * write string value, which is copied directly if it is known to need no escaping.
+ */
+template<typename Builder>
+static void write_string_value(const json_string_value &token, Builder &builder)
+{
+    auto &value = token.value();
+    if (token.get_escaping() == json_string_value::escaping::none) {
+        builder.push_back('\"');
+        builder.append(value.data(), value.size());
+        builder.push_back('\"');
+    } else {
+        write_string(value.data(), value.size(), builder);
+    }
+}
+
+#ifndef _WIN32
+namespace {
+
+/**
+ * builder producing a list of buffers. the output is appended to the side buffer, except the strings referenced in
+ * place by {@code reference}. the buffers are recorded by offset while building, because the side buffer may be
+ * reallocated.
+ */
+class iovec_builder
+{
+public:
+    explicit iovec_builder(std::string &s) : side(s), run_start(0)
+    {
+        side.clear();
+    }
+
+    void push_back(char c)
+    {
+        side.push_back(c);
+    }
+
+    void append(const char *str, size_t size)
+    {
+        side.append(str, size);
+    }
+
+    void append(size_t count, char c)
+    {
+        side.append(count, c);
+    }
+
+    void reference(const char *str, size_t size)
+    {
+        close_run();
+        segments.push_back(segment{str, 0, size});
+    }
+
+    std::vector<iovec> finish()
+    {
+        close_run();
+        std::vector<iovec> buffers;
+        buffers.reserve(segments.size());
+        for (const auto &seg : segments) {
+            auto data = seg.data ? seg.data : &side[seg.offset];
+            buffers.push_back(iovec{const_cast<char *>(data), seg.size});
+        }
+        return buffers;
+    }
+
+private:
+    // a string referenced in place, or a range of side buffer if {@code data} is nullptr.
+    struct segment
+    {
+        const char *data;
+        size_t offset;
+        size_t size;
+    };
+
+    void close_run()
+    {
+        if (side.size() > run_start) {
+            segments.push_back(segment{nullptr, run_start, side.size() - run_start});
+            run_start = side.size();
+        }
+    }
+
+    std::string &side;
+    size_t run_start;
+    std::vector<segment> segments;
+};
+
+}
+
+// strings shorter than it are cheaper to copy than to add a buffer for.
+constexpr size_t MinReferencedSize = 64;
+
+/**
+ * reference long strings without escape in place.
+ */
+static void write_string(const char *str, size_t size, iovec_builder &builder)
+{
+    if (size >= MinReferencedSize && find_escape(str, str + size) == str + size) {
+        builder.push_back('\"');
+        builder.reference(str, size);
+        builder.push_back('\"');
+    } else {
+        write_string<iovec_builder>(str, size, builder);
+    }
+}
+
+static void write_string_value(const json_string_value &token, iovec_builder &builder)
+{
+    auto &value = token.value();
+    if (value.size() >= MinReferencedSize && token.get_escaping() == json_string_value::escaping::none) {
+        builder.push_back('\"');
+        builder.reference(value.data(), value.size());
+        builder.push_back('\"');
+    } else {
+        write_string(value.data(), value.size(), builder);
+    }
+}
+#endif
+
+namespace {
+
+/**
+ * options of formatting float numbers, {@code failed} is set if a non-finite number is rejected.
+ */
+struct number_format
+{
+    explicit number_format(const format_options &options)
+            : nonfinite(options.nonfinite), max_decimal_places(options.max_decimal_places), failed(false) { }
+
+    json_nonfinite_option nonfinite;
+    int max_decimal_places;
+    bool failed;
+};
+
+}
+
+template<typename Builder>
+static void write_number(double value, Builder &builder, number_format &numbers)
 {
     constexpr uint64_t ExponentMask = 0x7FF0000000000000;
 
     char tmp[64];
-    if (num.is_float_value()) {
-        auto v = (double)num;
-        union
-        {
-            double d;
-            uint64_t i64;
-        } u = {v};
-        if ((u.i64 & ExponentMask) == ExponentMask) {
-            builder.append("0.0", 3);      // todo: add nan and inf support
+    union
+    {
+        double d;
+        uint64_t i64;
+    } u = {value};
+    if ((u.i64 & ExponentMask) == ExponentMask) {
+        if (numbers.nonfinite == json_nonfinite_option::string) {
+            if (value != value) {
+                builder.append("\"NaN\"", 5);
+            } else if (value > 0) {
+                builder.append("\"Infinity\"", 10);
+            } else {
+                builder.append("\"-Infinity\"", 11);
+            }
             return;
         }
+        // null keeps the output valid even if it is rejected.
+        numbers.failed = numbers.failed || numbers.nonfinite == json_nonfinite_option::error;
+        builder.append("null", 4);
+        return;
+    }
 
-        auto end = dtoa(v, tmp);
-        builder.append(tmp, end - tmp);
-    } else {
-        auto i = (int64_t)num;
-        auto end = i64toa(i, tmp);
-        builder.append(tmp, end - tmp);
+    auto end = dtoa(value, tmp, numbers.max_decimal_places);
+    builder.append(tmp, end - tmp);
+}
+
+template<typename Builder>
+static void write_number(int64_t value, Builder &builder)
+{
+    char tmp[32];
+    auto end = i64toa(value, tmp);
+    builder.append(tmp, end - tmp);
+}
+
+template<typename Builder>
+static void write_number(uint64_t value, Builder &builder)
+{
+    char tmp[32];
+    auto end = u64toa(value, tmp);
+    builder.append(tmp, end - tmp);
+}
+
+void json::format_string(const char *str, size_t size, std::string &builder)
+{
+    write_string(str, size, builder);
+}
+
+void json::format_number(double value, std::string &builder)
+{
+    number_format numbers{format_options()};
+    write_number(value, builder, numbers);
+}
+
+bool json::format_number(double value, std::string &builder, const format_options &options)
+{
+    number_format numbers(options);
+    write_number(value, builder, numbers);
+    return !numbers.failed;
+}
+
+void json::format_number(int64_t value, std::string &builder)
+{
+    write_number(value, builder);
+}
+
+void json::format_number(uint64_t value, std::string &builder)
+{
+    write_number(value, builder);
+}
+
+void json::format_string(const char *str, size_t size, stream_builder &builder)
+{
+    write_string(str, size, builder);
+}
+
+void json::format_number(double value, stream_builder &builder)
+{
+    number_format numbers{format_options()};
+    write_number(value, builder, numbers);
+}
+
+void json::format_number(int64_t value, stream_builder &builder)
+{
+    write_number(value, builder);
+}
+
+void json::format_number(uint64_t value, stream_builder &builder)
+{
+    write_number(value, builder);
+}
+
+template<typename Builder>
+static void format_scalar(const json_token &token, Builder &builder, number_format &numbers)
+{
+    switch (token.get_type()) {
+        case json_type::string:
+            write_string_value(static_cast<const json_string_value &>(token), builder); // NOLINT
+            break;
+        case json_type::number: {
+            auto &num = static_cast<const json_number_value &>(token); // NOLINT
+            if (num.is_float_value()) {
+                write_number((double)num, builder, numbers);
+            } else {
+                write_number((int64_t)num, builder);
+            }
+            break;
+        }
+        case json_type::boolean: {
+            if ((bool)static_cast<const json_bool_value &>(token)) { // NOLINT
+                builder.append("true", 4);
+            } else {
+                builder.append("false", 5);
+            }
+            break;
+        }
+        default: {
+            builder.append("null", 4);
+            break;
+        }
     }
 }
 
-static void format_token(const json_token &token, std::string &builder, char indent, unsigned base, unsigned level);
+/**
+ * write integers, each one is indented by {@code indent_count} and they are separated by {@code separator}.
+ * the integers are formatted into a block on the stack and appended to builder once per block.
+ */
+template<typename Builder>
+static void write_numbers(const int64_t *values, size_t count, const char *separator, size_t length,
+                          size_t indent_count, char indent, Builder &builder)
+{
+    constexpr size_t MaxJointLength = 64;
+    constexpr size_t BlockSize = 4096;
+
+    auto joint_length = length + indent_count;
+    if (joint_length > MaxJointLength) {
+        for (size_t i = 0; i < count; ++i) {
+            if (i > 0) {
+                builder.append(separator, length);
+            }
+            builder.append(indent_count, indent);
+            write_number(values[i], builder);
+        }
+        return;
+    }
 
-static void format_object(const json_object &obj, std::string &builder, char indent, unsigned base, unsigned level)
+    char joint[MaxJointLength];
+    std::memcpy(joint, separator, length);
+    std::memset(joint + length, indent, indent_count);
+    char block[BlockSize];
+    auto block_count = (BlockSize - joint_length) / (20 + joint_length);
+    builder.append(indent_count, indent);
+    for (size_t begin = 0; begin < count; begin += block_count) {
+        auto n = count - begin < block_count ? count - begin : block_count;
+        auto p = block;
+        if (begin > 0) {
+            std::memcpy(p, joint, joint_length);
+            p += joint_length;
+        }
+        p = i64toa(values + begin, n, joint, joint_length, p);
+        builder.append(block, p - block);
+    }
+}
+
+template<typename Builder>
+static void format_packed_array(const json_array::packed_view &packed, Builder &builder, const char *separator,
+                                size_t indent_count, char indent, number_format &numbers)
+{
+    auto length = std::strlen(separator);
+    if (packed.type == json_array::packing::int64) {
+        write_numbers(packed.ints, packed.size, separator, length, indent_count, indent, builder);
+        return;
+    }
+    for (size_t i = 0; i < packed.size; ++i) {
+        if (i > 0) {
+            builder.append(separator, length);
+        }
+        builder.append(indent_count, indent);
+        write_number(packed.floats[i], builder, numbers);
+    }
+}
+
+template<typename Builder>
+static void format_token(const json_token &token, Builder &builder, char indent, unsigned base, unsigned level,
+                         number_format &numbers);
+
+template<typename Builder>
+static void format_object(const json_object &obj, Builder &builder, char indent, unsigned base, unsigned level,
+                          number_format &numbers)
 {
     size_t count = base * (level + 1);
     builder.append("{\n", 2);
     if (obj.size() > 0) {
+        bool first = true;
         for (const auto &property : obj) {
+            if (!first) {
+                builder.append(",\n", 2);
+            }
+            first = false;
             builder.append(count, indent);
-            format_string(property.first, builder);
+            write_string(property.first.data(), property.first.size(), builder);
             builder.append(": ", 2);
-            format_token(*property.second, builder, indent, base, level + 1);
-            builder.append(",\n", 2);
+            format_token(*property.second, builder, indent, base, level + 1, numbers);
         }
-        builder.pop_back();
-        builder.pop_back();
         builder.push_back('\n');
     }
     builder.append(count - base, indent);
     builder.push_back('}');
 }
 
-static void format_array(const json_array &ary, std::string &builder, char indent, unsigned base, unsigned level)
+template<typename Builder>
+static void format_array(const json_array &ary, Builder &builder, char indent, unsigned base, unsigned level,
+                         number_format &numbers)
 {
     size_t count = base * (level + 1);
     builder.append("[\n", 2);
-    if (ary.size() > 0) {
+    auto packed = ary.get_packed();
+    if (packed.type != json_array::packing::none) {
+        if (packed.size > 0) {
+            format_packed_array(packed, builder, ",\n", count, indent, numbers);
+            builder.push_back('\n');
+        }
+    } else if (ary.size() > 0) {
+        bool first = true;
         for (const auto &element : ary) {
+            if (!first) {
+                builder.append(",\n", 2);
+            }
+            first = false;
             builder.append(count, indent);
-            format_token(*element, builder, indent, base, level + 1);
-            builder.append(",\n", 2);
+            format_token(*element, builder, indent, base, level + 1, numbers);
         }
-        builder.pop_back();
-        builder.pop_back();
         builder.push_back('\n');
     }
     builder.append(count - base, indent);
     builder.push_back(']');
 }
 
-void format_token(const json_token &token, std::string &builder, char indent, unsigned base, unsigned level)
+template<typename Builder>
+void format_token(const json_token &token, Builder &builder, char indent, unsigned base, unsigned level,
+                  number_format &numbers)
 {
     switch (token.get_type()) {
         case json_type::object:
-            format_object(static_cast<const json_object &>(token), builder, indent, base, level); // NOLINT
+            format_object(static_cast<const json_object &>(token), builder, indent, base, level, numbers); // NOLINT
             break;
         case json_type::array:
-            format_array(static_cast<const json_array &>(token), builder, indent, base, level); // NOLINT
-            break;
-        case json_type::string:
-            format_string(static_cast<const json_string_value &>(token).value(), builder); // NOLINT
-            break;
-        case json_type::number:
-            format_number(static_cast<const json_number_value &>(token), builder); // NOLINT
-            break;
-        case json_type::boolean: {
-            if ((bool)static_cast<const json_bool_value &>(token)) { // NOLINT
-                builder.append("true", 4);
-            } else {
-                builder.append("false", 5);
-            }
+            format_array(static_cast<const json_array &>(token), builder, indent, base, level, numbers); // NOLINT
             break;
-        }
-        case json_type::null: {
-            builder.append("null", 4);
+        default:
+            format_scalar(token, builder, numbers);
             break;
-        }
     }
 }
 
-static void format_token(const json_token &token, std::string &builder);
+template<typename Builder>
+static void format_token(const json_token &token, Builder &builder, number_format &numbers);
 
-static void format_object(const json_object &obj, std::string &builder)
+template<typename Builder>
+static void format_object(const json_object &obj, Builder &builder, number_format &numbers)
 {
     builder.push_back('{');
-    if (obj.size() > 0) {
-        for (const auto &property : obj) {
-            format_string(property.first, builder);
-            builder.push_back(':');
-            format_token(*property.second, builder);
+    bool first = true;
+    for (const auto &property : obj) {
+        if (!first) {
             builder.push_back(',');
         }
-        builder.pop_back();
+        first = false;
+        write_string(property.first.data(), property.first.size(), builder);
+        builder.push_back(':');
+        format_token(*property.second, builder, numbers);
     }
     builder.push_back('}');
 }
 
-static void format_array(const json_array &ary, std::string &builder)
+template<typename Builder>
+static void format_array(const json_array &ary, Builder &builder, number_format &numbers)
 {
     builder.push_back('[');
-    if (ary.size() > 0) {
+    auto packed = ary.get_packed();
+    if (packed.type != json_array::packing::none) {
+        format_packed_array(packed, builder, ",", 0, ' ', numbers);
+    } else {
+        bool first = true;
         for (const auto &element : ary) {
-            format_token(*element, builder);
-            builder.push_back(',');
+            if (!first) {
+                builder.push_back(',');
+            }
+            first = false;
+            format_token(*element, builder, numbers);
         }
-        builder.pop_back();
     }
     builder.push_back(']');
 }
 
-void format_token(const json_token &token, std::string &builder)
+template<typename Builder>
+void format_token(const json_token &token, Builder &builder, number_format &numbers)
 {
     switch (token.get_type()) {
         case json_type::object:
-            format_object(static_cast<const json_object &>(token), builder); // NOLINT
+            format_object(static_cast<const json_object &>(token), builder, numbers); // NOLINT
             break;
         case json_type::array:
-            format_array(static_cast<const json_array &>(token), builder); // NOLINT
+            format_array(static_cast<const json_array &>(token), builder, numbers); // NOLINT
             break;
-        case json_type::string:
-            format_string(static_cast<const json_string_value &>(token).value(), builder); // NOLINT
+        default:
+            format_scalar(token, builder, numbers);
             break;
-        case json_type::number:
-            format_number(static_cast<const json_number_value &>(token), builder); // NOLINT
+    }
+}
+
+template<typename Builder>
+static bool format_root(const json_token &token, Builder &builder, const format_options &options)
+{
+    number_format numbers(options);
+    switch (options.option) {
+        case json_format_option::indent_space:
+            format_token(token, builder, ' ', options.indention, 0, numbers);
             break;
-        case json_type::boolean: {
-            if ((bool)static_cast<const json_bool_value &>(token)) { // NOLINT
-                builder.append("true", 4);
+        case json_format_option::indent_tab:
+            format_token(token, builder, '\t', options.indention, 0, numbers);
+            break;
+        default:
+            format_token(token, builder, numbers);
+    }
+    return !numbers.failed;
+}
+
+namespace {
+
+/**
+ * formats the top levels of a document as a sequence of pieces, which are formatted independently and joined in order.
+ * containers with at least {@code parallel_threshold} elements are split into chunks of elements. smaller containers
+ * near the root are descended into, so that their children become separate pieces, and anything deeper is formatted
+ * as a whole. the separators and indention around the pieces are written in the same way as {@code format_token}.
+ */
+class parallel_formatter
+{
+public:
+    explicit parallel_formatter(const format_options &options)
+            : indent(options.option == json_format_option::indent_tab ? '\t' : ' '), base(options.indention),
+              pretty(options.option != json_format_option::no_format),
+              threshold(std::max<size_t>(options.parallel_threshold, 1)),
+              threads(options.threads == 0 ? std::max(std::thread::hardware_concurrency(), 1u) : options.threads),
+              numbers(options), last_is_task(true) { }
+
+    /**
+     * format {@code token}, the pieces are available in {@code result} after it returns.
+     * @return false if a non-finite number is rejected.
+     */
+    bool format(const json_token &token);
+
+    const std::vector<std::string> &result() const noexcept
+    {
+        return pieces;
+    }
+
+private:
+    // containers deeper than it are not descended into.
+    static constexpr unsigned MaxDepth = 3;
+    // chunks per thread of a split container, more chunks balance the load better.
+    static constexpr size_t ChunksPerThread = 4;
+    static constexpr size_t MinChunkSize = 256;
+    static constexpr size_t MaxTasksPerThread = 64;
+
+    template<typename Builder>
+    void format_value(const json_token &token, Builder &builder, unsigned level, number_format &format) const
+    {
+        if (pretty) {
+            format_token(token, builder, indent, base, level, format);
+        } else {
+            format_token(token, builder, format);
+        }
+    }
+
+    /**
+     * write the separator and indention before the {@code index}-th element of a container at {@code level}.
+     */
+    template<typename Builder>
+    void format_prefix(Builder &builder, size_t index, unsigned level) const
+    {
+        if (index > 0) {
+            if (pretty) {
+                builder.append(",\n", 2);
             } else {
-                builder.append("false", 5);
+                builder.push_back(',');
             }
-            break;
         }
-        case json_type::null: {
-            builder.append("null", 4);
-            break;
+        if (pretty) {
+            builder.append(base * (level + 1), indent);
+        }
+    }
+
+    /**
+     * format packed integers, the first one is the element at {@code index} of the array.
+     */
+    template<typename Builder>
+    void format_numbers(const int64_t *values, size_t count, Builder &builder, size_t index, unsigned level) const
+    {
+        if (pretty) {
+            if (index > 0) {
+                builder.append(",\n", 2);
+            }
+            write_numbers(values, count, ",\n", 2, base * (level + 1), indent, builder);
+        } else {
+            if (index > 0) {
+                builder.push_back(',');
+            }
+            write_numbers(values, count, ",", 1, 0, indent, builder);
         }
     }
+
+    template<typename Builder>
+    void format_key(const std::string &key, Builder &builder) const
+    {
+        write_string(key.data(), key.size(), builder);
+        if (pretty) {
+            builder.append(": ", 2);
+        } else {
+            builder.push_back(':');
+        }
+    }
+
+    void format_open(char c)
+    {
+        auto &text = literal();
+        text.push_back(c);
+        if (pretty) {
+            text.push_back('\n');
+        }
+    }
+
+    void format_close(char c, size_t size, unsigned level)
+    {
+        auto &text = literal();
+        if (pretty) {
+            if (size > 0) {
+                text.push_back('\n');
+            }
+            text.append(base * level, indent);
+        }
+        text.push_back(c);
+    }
+
+    /**
+     * the piece which the text formatted by the current thread is appended to.
+     */
+    std::string &literal()
+    {
+        if (last_is_task) {
+            pieces.emplace_back();
+            last_is_task = false;
+        }
+        return pieces.back();
+    }
+
+    void add_task(std::function<void(std::string &, number_format &)> &&task)
+    {
+        pieces.emplace_back();
+        tasks.emplace_back(pieces.size() - 1, std::move(task));
+        last_is_task = true;
+    }
+
+    size_t chunk_size(size_t size) const noexcept
+    {
+        auto chunks = static_cast<size_t>(threads) * ChunksPerThread;
+        auto step = (size + chunks - 1) / chunks;
+        return step < MinChunkSize ? MinChunkSize : step;
+    }
+
+    void plan(const json_token &token, unsigned level, unsigned depth);
+
+    void plan_object(const json_object &obj, unsigned level, unsigned depth);
+
+    void plan_array(const json_array &ary, unsigned level, unsigned depth);
+
+    void run();
+
+    char indent;
+    unsigned base;
+    bool pretty;
+    size_t threshold;
+    unsigned threads;
+    // used by the planning thread, each worker thread has its own copy.
+    number_format numbers;
+    bool last_is_task;
+    std::vector<std::string> pieces;
+    // index of the piece and the function formatting it.
+    std::vector<std::pair<size_t, std::function<void(std::string &, number_format &)>>> tasks;
+};
+
+}
+
+bool parallel_formatter::format(const json_token &token)
+{
+    plan(token, 0, 0);
+    run();
+    return !numbers.failed;
 }
 
-static size_t estimate_size(const json_token &token)
+void parallel_formatter::plan(const json_token &token, unsigned level, unsigned depth)
 {
     size_t size = 0;
-    switch (token.get_type()) {
-        case json_type::object: {
-            size = 2;   // "{}".size();
-            const auto &obj = static_cast<const json_object &>(token); // NOLINT
-            for (auto &item : obj) {
-                size += item.first.size() + 4 + estimate_size(*item.second);    // 4: "\"\":,".size();
+    if (token.get_type() == json_type::object) {
+        size = static_cast<const json_object &>(token).size();  // NOLINT
+    } else if (token.get_type() == json_type::array) {
+        size = static_cast<const json_array &>(token).size();   // NOLINT
+    }
+
+    // stop descending when there are enough pieces to keep all threads busy.
+    bool descend = size >= threshold || (depth < MaxDepth && tasks.size() < threads * MaxTasksPerThread);
+    if (size == 0 || !descend) {
+        if (size == 0) {
+            format_value(token, literal(), level, numbers);
+        } else {
+            auto *value = &token;
+            add_task([this, value, level](std::string &text, number_format &format) {
+                format_value(*value, text, level, format);
+            });
+        }
+        return;
+    }
+
+    if (token.get_type() == json_type::object) {
+        plan_object(static_cast<const json_object &>(token), level, depth); // NOLINT
+    } else {
+        plan_array(static_cast<const json_array &>(token), level, depth);   // NOLINT
+    }
+}
+
+void parallel_formatter::plan_object(const json_object &obj, unsigned level, unsigned depth)
+{
+    format_open('{');
+    if (obj.size() >= threshold) {
+        auto step = chunk_size(obj.size());
+        auto it = obj.begin();
+        for (size_t index = 0; index < obj.size(); index += step) {
+            auto first = it;
+            for (size_t i = 0; i < step && it != obj.end(); ++i) {
+                ++it;
             }
-            break;
+            auto last = it;
+            add_task([this, first, last, index, level](std::string &text, number_format &format) {
+                size_t i = index;
+                for (auto cur = first; cur != last; ++cur, ++i) {
+                    format_prefix(text, i, level);
+                    format_key(cur->first, text);
+                    format_value(*cur->second, text, level + 1, format);
+                }
+            });
         }
-        case json_type::array: {
-            size = 2;   // "[]".size();
-            const auto &array = static_cast<const json_array &>(token); // NOLINT
-            for (auto &item : array) {
-                size += estimate_size(*item) + 1;   // 1: ",".size();
+    } else {
+        size_t index = 0;
+        for (const auto &property : obj) {
+            auto &text = literal();
+            format_prefix(text, index++, level);
+            format_key(property.first, text);
+            plan(*property.second, level + 1, depth + 1);
+        }
+    }
+    format_close('}', obj.size(), level);
+}
+
+void parallel_formatter::plan_array(const json_array &ary, unsigned level, unsigned depth)
+{
+    format_open('[');
+    auto packed = ary.get_packed();
+    auto size = packed.type != json_array::packing::none ? packed.size : ary.size();
+    if (size >= threshold) {
+        auto step = chunk_size(size);
+        for (size_t index = 0; index < size; index += step) {
+            auto last = std::min(index + step, size);
+            add_task([this, &ary, packed, index, last, level](std::string &text, number_format &format) {
+                if (packed.type == json_array::packing::int64) {
+                    format_numbers(packed.ints + index, last - index, text, index, level);
+                    return;
+                }
+                for (size_t i = index; i < last; ++i) {
+                    format_prefix(text, i, level);
+                    if (packed.type == json_array::packing::float64) {
+                        write_number(packed.floats[i], text, format);
+                    } else {
+                        format_value(*ary[i], text, level + 1, format);
+                    }
+                }
+            });
+        }
+    } else if (packed.type != json_array::packing::none) {
+        // a small packed array has no container to descend into.
+        auto &text = literal();
+        if (packed.type == json_array::packing::int64) {
+            format_numbers(packed.ints, size, text, 0, level);
+        } else {
+            for (size_t i = 0; i < size; ++i) {
+                format_prefix(text, i, level);
+                write_number(packed.floats[i], text, numbers);
             }
-            break;
         }
-        case json_type::string:
-            return static_cast<const json_string_value &>(token).value().size() + 7;    // NOLINT
-        case json_type::number:
-            return static_cast<const json_number_value &>(token).is_float_value() ? 20 : 12;    // NOLINT
-        case json_type::boolean:
-            return 5;
-        case json_type::null:
-            return 4;
+    } else {
+        size_t index = 0;
+        for (const auto &element : ary) {
+            format_prefix(literal(), index++, level);
+            plan(*element, level + 1, depth + 1);
+        }
     }
+    format_close(']', size, level);
+}
 
-    return size;
+void parallel_formatter::run()
+{
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    auto work = [this, &next, &failed]() {
+        auto format = numbers;
+        format.failed = false;
+        for (size_t i = next++; i < tasks.size(); i = next++) {
+            tasks[i].second(pieces[tasks[i].first], format);
+        }
+        if (format.failed) {
+            failed = true;
+        }
+    };
+
+    std::vector<std::thread> workers;
+    auto count = std::min<size_t>(threads, tasks.size());
+    for (size_t i = 1; i < count; ++i) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    numbers.failed = numbers.failed || failed;
 }
 
-static size_t estimate_size(const json_token &token, unsigned indent, unsigned level)
+std::string json::to_string(const json_token &token, json_format_option option, unsigned int indention)
+{
+    return to_string(token, format_options(option, indention));
+}
+
+std::string json::to_string(const json_token &token, const format_options &options, int *error)
+{
+    constexpr size_t InitialCapacity = 256;
+
+    if (error) {
+        *error = NO_ERROR;
+    }
+    std::string builder;
+    if (options.threads != 1) {
+        parallel_formatter formatter(options);
+        if (!formatter.format(token)) {
+            if (error) {
+                *error = NUMBER_NOT_FINITE;
+            }
+            return builder;
+        }
+        size_t size = 0;
+        for (const auto &piece : formatter.result()) {
+            size += piece.size();
+        }
+        builder.reserve(size);
+        for (const auto &piece : formatter.result()) {
+            builder.append(piece);
+        }
+        return builder;
+    }
+
+    // single pass: instead of walking the tree to estimate the size, let the string grow geometrically.
+    builder.reserve(InitialCapacity);
+    if (!format_root(token, builder, options)) {
+        if (error) {
+            *error = NUMBER_NOT_FINITE;
+        }
+        builder.clear();
+    }
+    return builder;
+}
+
+bool json::write(const json_token &token, json_sink &sink, const format_options &options)
+{
+    stream_builder builder(sink, options.buffer_size);
+    bool formatted;
+    if (options.threads != 1) {
+        parallel_formatter formatter(options);
+        formatted = formatter.format(token);
+        for (const auto &piece : formatter.result()) {
+            builder.append(piece.data(), piece.size());
+        }
+    } else {
+        formatted = format_root(token, builder, options);
+    }
+    return builder.flush() && sink.flush() && formatted;
+}
+
+#ifndef _WIN32
+std::vector<iovec> json::to_iovec(const json_token &token, std::string &side, const format_options &options, int *error)
+{
+    iovec_builder builder(side);
+    bool formatted = format_root(token, builder, options);
+    if (error) {
+        *error = formatted ? NO_ERROR : NUMBER_NOT_FINITE;
+    }
+    if (!formatted) {
+        side.clear();
+        return std::vector<iovec>();
+    }
+    return builder.finish();
+}
+
+bool fd_sink::write(const char *data, size_t size)
+{
+    while (size > 0) {
+        auto n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool fd_sink::writev(const std::vector<iovec> &buffers)
+{
+#ifdef IOV_MAX
+    constexpr size_t MaxBuffers = IOV_MAX;
+#else
+    constexpr size_t MaxBuffers = 1024;
+#endif
+
+    std::vector<iovec> pending(buffers);
+    auto cur = pending.data();
+    auto end = cur + pending.size();
+    while (cur != end) {
+        auto count = std::min(static_cast<size_t>(end - cur), MaxBuffers);
+        auto n = ::writev(fd, cur, static_cast<int>(count));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        // skip the written buffers, and adjust the partially written one.
+        auto written = static_cast<size_t>(n);
+        while (cur != end && written >= cur->iov_len) {
+            written -= cur->iov_len;
+            ++cur;
+        }
+        if (written > 0) {
+            cur->iov_base = static_cast<char *>(cur->iov_base) + written;
+            cur->iov_len -= written;
+        }
+    }
+    return true;
+}
+#endif
+
+bool file_sink::write(const char *data, size_t size)
+{
+    if (size == 0) {
+        return true;    // data may be null, which fwrite does not accept.
+    }
+    return std::fwrite(data, 1, size, file) == size;
+}
+
+bool file_sink::flush()
+{
+    return std::fflush(file) == 0;
+}
+
+bool ostream_sink::write(const char *data, size_t size)
+{
+    return static_cast<bool>(stream.write(data, static_cast<std::streamsize>(size)));
+}
+
+bool ostream_sink::flush()
+{
+    return static_cast<bool>(stream.flush());
+}
+
+bool callback_sink::write(const char *data, size_t size)
+{
+    return callback(data, size);
+}
+
+std::unique_ptr<json_token> json::clone(const json_token &token)
 {
-    size_t size = 0;
     switch (token.get_type()) {
         case json_type::object: {
-            auto count = indent * (level + 1);
-            size = 3 + count - indent;  // 3: "{\n}".size();
-            const auto &obj = static_cast<const json_object &>(token); // NOLINT
-            for (auto &item : obj) {
-                size += item.first.size() + count + 6 + estimate_size(*item.second, indent, level + 1);    // 4: "\"\": ,\n".size();
+            auto &obj = static_cast<const json_object &>(token);
+            auto *ptr = new json_object();
+            std::unique_ptr<json_token> ret(ptr);
+            for (const auto &property : obj) {
+                ptr->put(property.first, clone(*property.second));
             }
-            break;
+            return ret;
         }
         case json_type::array: {
-            auto count = indent * (level + 1);
-            size = 2 + count - indent;
-            const auto &array = static_cast<const json_array &>(token); // NOLINT
-            for (auto &item : array) {
-                size += count + estimate_size(*item) + 2;   // 2: ",\n".size();
+            auto &ary = static_cast<const json_array &>(token);
+            auto *ptr = new json_array();
+            std::unique_ptr<json_token> ret(ptr);
+            auto packed = ary.get_packed();
+            if (packed.type == json_array::packing::int64) {
+                for (size_t i = 0; i < packed.size; ++i) {
+                    ptr->add(packed.ints[i]);
+                }
+                return ret;
             }
-            break;
+            if (packed.type == json_array::packing::float64) {
+                for (size_t i = 0; i < packed.size; ++i) {
+                    ptr->add(packed.floats[i]);
+                }
+                return ret;
+            }
+            ptr->reserve(ary.size());
+            for (const auto &element : ary) {
+                ptr->add(clone(*element));
+            }
+            return ret;
         }
         case json_type::string:
-            return static_cast<const json_string_value &>(token).value().size() + 7;    // NOLINT
+            return std::unique_ptr<json_token>(new json_string_value(static_cast<const json_string_value &>(token)));
         case json_type::number:
-            return static_cast<const json_number_value &>(token).is_float_value() ? 20 : 12;    // NOLINT
+            return std::unique_ptr<json_token>(new json_number_value(static_cast<const json_number_value &>(token)));
         case json_type::boolean:
-            return 5;
-        case json_type::null:
-            return 4;
+            return std::unique_ptr<json_token>(new json_bool_value(static_cast<const json_bool_value &>(token)));
+        default:
+            return std::unique_ptr<json_token>(new json_null_value());
     }
-
-    return size;
 }
 
-std::string json::to_string(const json_token &token, json_format_option option, unsigned int indention)
+std::unique_ptr<json_token> json::clone(json_token &&token)
 {
-    std::string builder;
-    if (option == json_format_option::no_format) {
-        auto size = estimate_size(token);
-        builder.reserve(size);
-    } else {
-        auto size = estimate_size(token, indention, 0);
-        builder.reserve(size);
-    }
-
-    switch (option) {
-        case json_format_option::indent_space:
-            format_token(token, builder, ' ', indention, 0);
-            break;
-        case json_format_option::indent_tab:
-            format_token(token, builder, '\t', indention, 0);
-            break;
+    switch (token.get_type()) {
+        case json_type::object:
+            return std::unique_ptr<json_token>(new json_object(std::move(static_cast<json_object &>(token))));
+        case json_type::array:
+            return std::unique_ptr<json_token>(new json_array(std::move(static_cast<json_array &>(token))));
+        case json_type::string:
+            return std::unique_ptr<json_token>(new json_string_value(std::move(static_cast<json_string_value &>(token))));
         default:
-            format_token(token, builder);
+            return clone(static_cast<const json_token &>(token));
     }
-    return builder;
 }
 
 const char *json::get_error_info(int error) noexcept
@@ -512,6 +1423,18 @@ const char *json::get_error_info(int error) noexcept
             return "Unexpected token. Only support json standard primitive types.";
         case UNEXPECTED_END_CHAR:
             return "Unexpected character at the end, NULL character needed.";
+        case NESTING_DEPTH_EXCEEDED:
+            return "Nesting depth of object and array exceeds the limit.";
+        case QUERY_PATH_SYNTAX_ERROR:
+            return "JsonPath syntax error.";
+        case NUMBER_NOT_FINITE:
+            return "NaN or infinity can not be formatted as json number.";
+        case BINARY_DATA_TRUNCATED:
+            return "Binary data ends in the middle of a value.";
+        case BINARY_DATA_MALFORMED:
+            return "Binary data is malformed, check the reserved or unexpected bytes.";
+        case FILE_ACCESS_ERROR:
+            return "File can not be opened or mapped.";
         default:
             return "Unknown error code.";
     }
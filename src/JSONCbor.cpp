@@ -0,0 +1,881 @@
+//
+// Created by Charles on 2018/7/20.
+//
+
+#include <iostream>
+#include <cmath>
+#include <cstring>
+#include "JSONCbor.hpp"
+#include "JSONUtils.hpp"
+
+using namespace json;
+
+namespace {
+
+enum : uint8_t
+{
+    major_unsigned = 0,
+    major_negative,
+    major_bytes,
+    major_text,
+    major_array,
+    major_map,
+    major_tag,
+    major_simple
+};
+
+constexpr uint8_t break_byte = 0xff;
+
+/**
+ * the initial byte and the argument of a data item.
+ */
+struct cbor_head
+{
+    uint8_t major;
+    // additional information, the low 5 bits of the initial byte.
+    uint8_t info;
+    uint64_t argument;
+
+    bool indefinite() const noexcept
+    {
+        return info == 31;
+    }
+};
+
+}
+
+static bool read_head(const uint8_t **data, const uint8_t *end, cbor_head &head, int *error)
+{
+    auto p = *data;
+    if (p == end) {
+        *error = BINARY_DATA_TRUNCATED;
+        return false;
+    }
+    head.major = static_cast<uint8_t>(*p >> 5u);
+    head.info = static_cast<uint8_t>(*p & 0x1fu);
+    ++p;
+
+    if (head.info < 24) {
+        head.argument = head.info;
+    } else if (head.info <= 27) {
+        auto n = static_cast<size_t>(1u << (head.info - 24u));
+        if (static_cast<size_t>(end - p) < n) {
+            *error = BINARY_DATA_TRUNCATED;
+            return false;
+        }
+        uint64_t value = 0;
+        for (size_t i = 0; i < n; ++i) {
+            value = (value << 8u) | p[i];
+        }
+        p += n;
+        head.argument = value;
+        // a simple value in the extra byte must not be one of the values encoded in the initial byte.
+        if (head.major == major_simple && head.info == 24 && value < 32) {
+            *error = BINARY_DATA_MALFORMED;
+            return false;
+        }
+    } else if (head.info == 31 && head.major != major_unsigned && head.major != major_negative
+               && head.major != major_tag) {
+        head.argument = 0;  // indefinite length, or the break of it.
+    } else {
+        *error = BINARY_DATA_MALFORMED;
+        return false;
+    }
+    *data = p;
+    return true;
+}
+
+/**
+ * read the head of the next data item, the tags before it are skipped.
+ */
+static bool read_item_head(const uint8_t **data, const uint8_t *end, cbor_head &head, int *error)
+{
+    do {
+        if (!read_head(data, end, head, error)) {
+            return false;
+        }
+    } while (head.major == major_tag);
+    return true;
+}
+
+/**
+ * check the definite item count of an array or map, each item takes one byte at least.
+ */
+static bool check_count(const uint8_t *data, const uint8_t *end, const cbor_head &head, int *error)
+{
+    auto per_item = head.major == major_map ? 2u : 1u;
+    if (!head.indefinite() && head.argument > static_cast<uint64_t>(end - data) / per_item) {
+        *error = BINARY_DATA_TRUNCATED;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * check the break of indefinite length item, and consume it.
+ */
+static bool read_break(const uint8_t **data, const uint8_t *end, int *error)
+{
+    if (*data == end) {
+        *error = BINARY_DATA_TRUNCATED;
+        return false;
+    }
+    if (**data == break_byte) {
+        ++*data;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * append the content of a byte or text string, the chunks of indefinite length string are joined.
+ * @param value the string is skipped if it is {@code nullptr}.
+ */
+static bool append_string(const uint8_t **data, const uint8_t *end, const cbor_head &head, std::string *value,
+                          int *error)
+{
+    if (!head.indefinite()) {
+        if (head.argument > static_cast<uint64_t>(end - *data)) {
+            *error = BINARY_DATA_TRUNCATED;
+            return false;
+        }
+        if (value) {
+            value->append(reinterpret_cast<const char *>(*data), static_cast<size_t>(head.argument));
+        }
+        *data += head.argument;
+        return true;
+    }
+
+    while (!read_break(data, end, error)) {
+        cbor_head chunk{};
+        if (*error != NO_ERROR || !read_head(data, end, chunk, error)) {
+            return false;
+        }
+        if (chunk.major != head.major || chunk.indefinite()) {
+            *error = BINARY_DATA_MALFORMED;
+            return false;
+        }
+        if (!append_string(data, end, chunk, value, error)) {
+            return false;
+        }
+    }
+    return *error == NO_ERROR;
+}
+
+/**
+ * read the value of a text string, or a byte string as base64url.
+ */
+static bool read_string_value(const uint8_t **data, const uint8_t *end, const cbor_head &head, std::string &value,
+                              int *error)
+{
+    if (head.major == major_text) {
+        return append_string(data, end, head, &value, error);
+    }
+    std::string bytes;
+    if (!append_string(data, end, head, &bytes, error)) {
+        return false;
+    }
+    append_base64url(bytes.data(), bytes.size(), value);
+    return true;
+}
+
+static double half_to_double(uint64_t half)
+{
+    auto exponent = static_cast<int>((half >> 10u) & 0x1fu);
+    auto mantissa = static_cast<double>(half & 0x3ffu);
+    double value;
+    if (exponent == 0) {
+        value = std::ldexp(mantissa, -24);
+    } else if (exponent != 31) {
+        value = std::ldexp(mantissa + 1024, exponent - 25);
+    } else {
+        value = mantissa == 0 ? INFINITY : NAN;
+    }
+    return (half & 0x8000u) ? -value : value;
+}
+
+/**
+ * get the number of an integer or float item.
+ * @return false if the item is not a number.
+ */
+static bool to_number(const cbor_head &head, number_union &number, bool &is_float)
+{
+    constexpr auto max_int = static_cast<uint64_t>(std::numeric_limits<int64_t>::max());
+
+    switch (head.major) {
+        case major_unsigned:
+            is_float = head.argument > max_int;
+            if (is_float) {
+                number.float_value = static_cast<double>(head.argument);
+            } else {
+                number.int_value = static_cast<int64_t>(head.argument);
+            }
+            return true;
+        case major_negative:
+            // the value is -1 - argument.
+            is_float = head.argument > max_int;
+            if (is_float) {
+                number.float_value = -1.0 - static_cast<double>(head.argument);
+            } else {
+                number.int_value = -1 - static_cast<int64_t>(head.argument);
+            }
+            return true;
+        case major_simple:
+            is_float = true;
+            if (head.info == 25) {
+                number.float_value = half_to_double(head.argument);
+            } else if (head.info == 26) {
+                float value;
+                auto bits = static_cast<uint32_t>(head.argument);
+                std::memcpy(&value, &bits, sizeof(value));
+                number.float_value = value;
+            } else if (head.info == 27) {
+                std::memcpy(&number.float_value, &head.argument, sizeof(double));
+            } else {
+                return false;
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * whether the item is decoded as null: null, undefined and the unassigned simple values.
+ */
+static bool is_null_item(const cbor_head &head)
+{
+    return head.major == major_simple && (head.info < 20 || head.info == 22 || head.info == 23 || head.info == 24);
+}
+
+template<typename Policy>
+static std::unique_ptr<json_token> read_item(const uint8_t **data, const uint8_t *end, int *error, unsigned depth);
+
+template<typename Policy>
+static std::unique_ptr<json_token> read_value(const uint8_t **data, const uint8_t *end, const cbor_head &head,
+                                              int *error, unsigned depth);
+
+template<typename Policy>
+static std::unique_ptr<json_token> read_map(const uint8_t **data, const uint8_t *end, const cbor_head &head,
+                                            int *error, unsigned depth)
+{
+    auto *ptr = new json_object();
+    std::unique_ptr<json_token> object_ptr(ptr);
+    if (!check_count(*data, end, head, error)) {
+        return nullptr;
+    }
+
+    for (uint64_t i = 0; head.indefinite() || i < head.argument; ++i) {
+        if (head.indefinite() && read_break(data, end, error)) {
+            break;
+        }
+        cbor_head key_head{};
+        if (*error != NO_ERROR || !read_item_head(data, end, key_head, error)) {
+            return nullptr;
+        }
+        if (key_head.major != major_text) {
+            *error = OBJECT_KEY_SYNTAX_ERROR;
+            return nullptr;
+        }
+        std::string key;
+        if (!append_string(data, end, key_head, &key, error)) {
+            return nullptr;
+        }
+
+        auto value = read_item<Policy>(data, end, error, depth);
+        if (*error != NO_ERROR) {
+            return nullptr;
+        }
+        auto ret = ptr->put(std::move(key), std::move(value));
+        if (Policy::check_duplicated_key && !ret) {
+            *error = OBJECT_DUPLICATED_KEY;
+            return nullptr;
+        }
+    }
+    return object_ptr;
+}
+
+template<typename Policy>
+static std::unique_ptr<json_token> read_array(const uint8_t **data, const uint8_t *end, const cbor_head &head,
+                                              int *error, unsigned depth)
+{
+    auto *ptr = new json_array();
+    std::unique_ptr<json_token> array_ptr(ptr);
+    if (!check_count(*data, end, head, error)) {
+        return nullptr;
+    }
+
+    for (uint64_t i = 0; head.indefinite() || i < head.argument; ++i) {
+        if (head.indefinite() && read_break(data, end, error)) {
+            break;
+        }
+        cbor_head elem_head{};
+        if (*error != NO_ERROR || !read_item_head(data, end, elem_head, error)) {
+            return nullptr;
+        }
+        // numbers are added without token, so that the array can be packed.
+        number_union number{};
+        bool is_float = false;
+        if (to_number(elem_head, number, is_float)) {
+            if (is_float) {
+                ptr->add(number.float_value);
+            } else {
+                ptr->add(number.int_value);
+            }
+            continue;
+        }
+        auto elem = read_value<Policy>(data, end, elem_head, error, depth);
+        if (*error != NO_ERROR) {
+            return nullptr;
+        }
+        ptr->add(std::move(elem));
+    }
+    if (ptr->get_packing() != json_array::packing::none) {
+        ptr->shrink_to_fit();
+    }
+    return array_ptr;
+}
+
+template<typename Policy>
+std::unique_ptr<json_token> read_value(const uint8_t **data, const uint8_t *end, const cbor_head &head, int *error,
+                                       unsigned depth)
+{
+    switch (head.major) {
+        case major_bytes:
+        case major_text: {
+            std::string value;
+            if (!read_string_value(data, end, head, value, error)) {
+                return nullptr;
+            }
+            return std::unique_ptr<json_token>(new json_string_value(std::move(value)));
+        }
+        case major_array:
+        case major_map:
+            if (Policy::max_depth != 0 && depth >= Policy::max_depth) {
+                *error = NESTING_DEPTH_EXCEEDED;
+                return nullptr;
+            }
+            if (head.major == major_map) {
+                return read_map<Policy>(data, end, head, error, depth + 1);
+            }
+            return read_array<Policy>(data, end, head, error, depth + 1);
+        default:
+            break;
+    }
+
+    number_union number{};
+    bool is_float = false;
+    if (to_number(head, number, is_float)) {
+        if (is_float) {
+            return std::unique_ptr<json_token>(new json_number_value(number.float_value));
+        }
+        return std::unique_ptr<json_token>(new json_number_value(number.int_value));
+    }
+    if (head.info == 20 || head.info == 21) {
+        return std::unique_ptr<json_token>(new json_bool_value(head.info == 21));
+    }
+    if (is_null_item(head)) {
+        return std::unique_ptr<json_token>(new json_null_value());
+    }
+    *error = BINARY_DATA_MALFORMED;     // unexpected break
+    return nullptr;
+}
+
+template<typename Policy>
+std::unique_ptr<json_token> read_item(const uint8_t **data, const uint8_t *end, int *error, unsigned depth)
+{
+    cbor_head head{};
+    if (!read_item_head(data, end, head, error)) {
+        return nullptr;
+    }
+    return read_value<Policy>(data, end, head, error, depth);
+}
+
+template<typename Policy>
+std::unique_ptr<json_token> json::parse_cbor(const uint8_t *data, size_t size, int *error)
+{
+    int code = NO_ERROR;
+    auto cur = data;
+    auto ret = read_item<Policy>(&cur, data + size, &code, 0);
+    if (code == NO_ERROR && cur != data + size) {
+        code = UNEXPECTED_END_CHAR;
+    }
+    if (error) {
+        *error = code;
+    }
+    if (code != NO_ERROR) {
+        if (Policy::log_error) {
+            std::cerr << "decode CBOR failed near byte position " << static_cast<int64_t>(cur - data)
+                      << ", error code: " << code << ", info: " << get_error_info(code) << std::endl;
+        }
+        return nullptr;
+    }
+    return ret;
+}
+
+template std::unique_ptr<json_token> json::parse_cbor<strict_parse_policy>(const uint8_t *data, size_t size, int *error);
+template std::unique_ptr<json_token> json::parse_cbor<trusted_parse_policy>(const uint8_t *data, size_t size, int *error);
+
+/**
+ * skip an item at nesting {@code depth}, arrays and maps are limited by {@code strict_parse_policy::max_depth} like
+ * {@code read_item}.
+ */
+static void skip_item(const uint8_t **data, const uint8_t *end, int *error, unsigned depth)
+{
+    cbor_head head{};
+    if (!read_item_head(data, end, head, error)) {
+        return;
+    }
+    switch (head.major) {
+        case major_bytes:
+        case major_text:
+            append_string(data, end, head, nullptr, error);
+            break;
+        case major_array:
+        case major_map:
+            if (strict_parse_policy::max_depth != 0 && depth >= strict_parse_policy::max_depth) {
+                *error = NESTING_DEPTH_EXCEEDED;
+            } else if (head.indefinite()) {
+                while (!read_break(data, end, error) && *error == NO_ERROR) {
+                    skip_item(data, end, error, depth + 1);
+                    if (head.major == major_map && *error == NO_ERROR) {
+                        skip_item(data, end, error, depth + 1);
+                    }
+                }
+            } else if (check_count(*data, end, head, error)) {
+                auto count = head.major == major_map ? head.argument * 2 : head.argument;
+                for (uint64_t i = 0; i < count && *error == NO_ERROR; ++i) {
+                    skip_item(data, end, error, depth + 1);
+                }
+            }
+            break;
+        case major_simple:
+            if (head.indefinite()) {
+                *error = BINARY_DATA_MALFORMED;     // unexpected break
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void write_head(uint8_t major, uint64_t argument, std::vector<uint8_t> &out)
+{
+    uint8_t buffer[9];
+    auto initial = static_cast<uint8_t>(major << 5u);
+    size_t size;
+    if (argument < 24) {
+        buffer[0] = static_cast<uint8_t>(initial | argument);
+        size = 0;
+    } else if (argument <= 0xffu) {
+        buffer[0] = static_cast<uint8_t>(initial | 24u);
+        size = 1;
+    } else if (argument <= 0xffffu) {
+        buffer[0] = static_cast<uint8_t>(initial | 25u);
+        size = 2;
+    } else if (argument <= 0xffffffffu) {
+        buffer[0] = static_cast<uint8_t>(initial | 26u);
+        size = 4;
+    } else {
+        buffer[0] = static_cast<uint8_t>(initial | 27u);
+        size = 8;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        buffer[size - i] = static_cast<uint8_t>(argument >> (i * 8));
+    }
+    out.insert(out.end(), buffer, buffer + size + 1);
+}
+
+static void write_integer(int64_t value, std::vector<uint8_t> &out)
+{
+    if (value >= 0) {
+        write_head(major_unsigned, static_cast<uint64_t>(value), out);
+    } else {
+        write_head(major_negative, ~static_cast<uint64_t>(value), out);  // -1 - value
+    }
+}
+
+/**
+ * convert float to half if the value is kept exactly.
+ */
+static bool float_to_half(float value, uint16_t &half)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    auto sign = static_cast<uint16_t>((bits >> 16u) & 0x8000u);
+    auto exponent = static_cast<int>((bits >> 23u) & 0xffu) - 127;
+    uint32_t mantissa = bits & 0x7fffffu;
+
+    if ((bits & 0x7fffffffu) == 0) {
+        half = sign;
+        return true;
+    }
+    if (exponent == 128) {
+        half = static_cast<uint16_t>(sign | 0x7c00u);  // infinity, NaN is handled by the caller.
+        return mantissa == 0;
+    }
+    if (exponent > 15 || exponent < -24) {
+        return false;
+    }
+    if (exponent >= -14) {
+        half = static_cast<uint16_t>(sign | ((exponent + 15) << 10) | (mantissa >> 13u));
+        return (mantissa & 0x1fffu) == 0;
+    }
+    // subnormal half
+    mantissa |= 0x800000u;
+    auto shift = static_cast<unsigned>(-1 - exponent);
+    half = static_cast<uint16_t>(sign | (mantissa >> shift));
+    return (mantissa & ((1u << shift) - 1)) == 0;
+}
+
+static void write_float(double value, std::vector<uint8_t> &out)
+{
+    uint16_t half;
+    if (value != value) {
+        const uint8_t nan[] = {0xf9, 0x7e, 0x00};
+        out.insert(out.end(), nan, nan + 3);
+        return;
+    }
+    auto single = static_cast<float>(value);
+    if (single == value && float_to_half(single, half)) {
+        const uint8_t buffer[] = {0xf9, static_cast<uint8_t>(half >> 8u), static_cast<uint8_t>(half)};
+        out.insert(out.end(), buffer, buffer + 3);
+        return;
+    }
+
+    uint64_t bits;
+    uint8_t buffer[9];
+    size_t size;
+    if (single == value) {
+        uint32_t single_bits;
+        std::memcpy(&single_bits, &single, sizeof(single));
+        bits = single_bits;
+        buffer[0] = 0xfa;
+        size = 4;
+    } else {
+        std::memcpy(&bits, &value, sizeof(value));
+        buffer[0] = 0xfb;
+        size = 8;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        buffer[size - i] = static_cast<uint8_t>(bits >> (i * 8));
+    }
+    out.insert(out.end(), buffer, buffer + size + 1);
+}
+
+static void write_text(const std::string &value, std::vector<uint8_t> &out)
+{
+    write_head(major_text, value.size(), out);
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+static void write_item(const json_token &token, std::vector<uint8_t> &out)
+{
+    switch (token.get_type()) {
+        case json_type::object: {
+            const auto &obj = static_cast<const json_object &>(token); // NOLINT
+            write_head(major_map, obj.size(), out);
+            for (const auto &property : obj) {
+                write_text(property.first, out);
+                write_item(*property.second, out);
+            }
+            break;
+        }
+        case json_type::array: {
+            const auto &ary = static_cast<const json_array &>(token); // NOLINT
+            auto packed = ary.get_packed();
+            size_t size = packed.type != json_array::packing::none ? packed.size : ary.size();
+            write_head(major_array, size, out);
+            if (packed.type == json_array::packing::int64) {
+                for (size_t i = 0; i < size; ++i) {
+                    write_integer(packed.ints[i], out);
+                }
+            } else if (packed.type == json_array::packing::float64) {
+                for (size_t i = 0; i < size; ++i) {
+                    write_float(packed.floats[i], out);
+                }
+            } else {
+                for (const auto &element : ary) {
+                    write_item(*element, out);
+                }
+            }
+            break;
+        }
+        case json_type::string:
+            write_text(static_cast<const json_string_value &>(token).value(), out); // NOLINT
+            break;
+        case json_type::number: {
+            const auto &num = static_cast<const json_number_value &>(token); // NOLINT
+            if (num.is_float_value()) {
+                write_float(static_cast<double>(num), out);
+            } else {
+                write_integer(static_cast<int64_t>(num), out);
+            }
+            break;
+        }
+        case json_type::boolean:
+            out.push_back(static_cast<bool>(static_cast<const json_bool_value &>(token)) ? 0xf5 : 0xf4); // NOLINT
+            break;
+        case json_type::null:
+            out.push_back(0xf6);
+            break;
+    }
+}
+
+void json::to_cbor(const json_token &token, std::vector<uint8_t> &out)
+{
+    write_item(token, out);
+}
+
+json_type cbor_reader::peek() noexcept
+{
+    if (code != NO_ERROR) {
+        return json_type::null;
+    }
+    while (cur != end && (*cur >> 5u) == major_tag) {
+        cbor_head tag{};
+        if (!read_head(&cur, end, tag, &code)) {
+            return json_type::null;
+        }
+    }
+    if (cur == end) {
+        code = BINARY_DATA_TRUNCATED;
+        return json_type::null;
+    }
+
+    auto info = *cur & 0x1fu;
+    switch (*cur >> 5u) {
+        case major_unsigned:
+        case major_negative:
+            return json_type::number;
+        case major_bytes:
+        case major_text:
+            return json_type::string;
+        case major_array:
+            return json_type::array;
+        case major_map:
+            return json_type::object;
+        default:
+            if (info == 20 || info == 21) {
+                return json_type::boolean;
+            }
+            if (info >= 25 && info <= 27) {
+                return json_type::number;
+            }
+            if (info >= 28) {
+                code = BINARY_DATA_MALFORMED;
+            }
+            return json_type::null;
+    }
+}
+
+bool cbor_reader::begin_object()
+{
+    cbor_head head{};
+    if (code != NO_ERROR || !read_item_head(&cur, end, head, &code)) {
+        return false;
+    }
+    if (head.major != major_map) {
+        code = OBJECT_PARSE_ERROR;
+        return false;
+    }
+    if (!check_count(cur, end, head, &code)) {
+        return false;
+    }
+    if (strict_parse_policy::max_depth != 0 && remaining.size() >= strict_parse_policy::max_depth) {
+        code = NESTING_DEPTH_EXCEEDED;
+        return false;
+    }
+    remaining.push_back(head.indefinite() ? UINT64_MAX : head.argument);
+    return true;
+}
+
+bool cbor_reader::next_item() noexcept
+{
+    if (code != NO_ERROR || remaining.empty()) {
+        return false;
+    }
+    auto &count = remaining.back();
+    if (count == UINT64_MAX) {
+        if (read_break(&cur, end, &code)) {
+            remaining.pop_back();
+            return false;
+        }
+        return code == NO_ERROR;
+    }
+    if (count == 0) {
+        remaining.pop_back();
+        return false;
+    }
+    --count;
+    return true;
+}
+
+bool cbor_reader::next_member(const char **key, size_t *length)
+{
+    if (!next_item()) {
+        return false;
+    }
+    cbor_head head{};
+    if (!read_item_head(&cur, end, head, &code)) {
+        return false;
+    }
+    if (head.major != major_text) {
+        code = OBJECT_KEY_SYNTAX_ERROR;
+        return false;
+    }
+    if (!head.indefinite() && head.argument <= static_cast<uint64_t>(end - cur)) {
+        *key = reinterpret_cast<const char *>(cur);
+        *length = static_cast<size_t>(head.argument);
+        cur += head.argument;
+        return true;
+    }
+    scratch.clear();
+    if (!append_string(&cur, end, head, &scratch, &code)) {
+        return false;
+    }
+    *key = scratch.data();
+    *length = scratch.size();
+    return true;
+}
+
+bool cbor_reader::begin_array()
+{
+    cbor_head head{};
+    if (code != NO_ERROR || !read_item_head(&cur, end, head, &code)) {
+        return false;
+    }
+    if (head.major != major_array) {
+        code = ARRAY_PARSE_ERROR;
+        return false;
+    }
+    if (!check_count(cur, end, head, &code)) {
+        return false;
+    }
+    if (strict_parse_policy::max_depth != 0 && remaining.size() >= strict_parse_policy::max_depth) {
+        code = NESTING_DEPTH_EXCEEDED;
+        return false;
+    }
+    remaining.push_back(head.indefinite() ? UINT64_MAX : head.argument);
+    return true;
+}
+
+bool cbor_reader::next_element() noexcept
+{
+    return next_item();
+}
+
+bool cbor_reader::read_string(std::string &value)
+{
+    cbor_head head{};
+    if (code != NO_ERROR || !read_item_head(&cur, end, head, &code)) {
+        return false;
+    }
+    if (head.major != major_text && head.major != major_bytes) {
+        code = STRING_PARSE_ERROR;
+        return false;
+    }
+    value.clear();
+    return read_string_value(&cur, end, head, value, &code);
+}
+
+bool cbor_reader::read_string(const char **data, size_t *length)
+{
+    cbor_head head{};
+    if (code != NO_ERROR || !read_item_head(&cur, end, head, &code)) {
+        return false;
+    }
+    if (head.major != major_text && head.major != major_bytes) {
+        code = STRING_PARSE_ERROR;
+        return false;
+    }
+    // fast path: point into the data if it is a definite-length text string.
+    if (head.major == major_text && !head.indefinite() && head.argument <= static_cast<uint64_t>(end - cur)) {
+        *data = reinterpret_cast<const char *>(cur);
+        *length = static_cast<size_t>(head.argument);
+        cur += head.argument;
+        return true;
+    }
+
+    scratch.clear();
+    if (!read_string_value(&cur, end, head, scratch, &code)) {
+        return false;
+    }
+    *data = scratch.data();
+    *length = scratch.size();
+    return true;
+}
+
+bool cbor_reader::read_number(bool &is_float, int64_t &int_value, double &float_value) noexcept
+{
+    cbor_head head{};
+    if (code != NO_ERROR || !read_item_head(&cur, end, head, &code)) {
+        return false;
+    }
+    number_union number{};
+    if (!to_number(head, number, is_float)) {
+        code = UNEXPECTED_TOKEN;
+        return false;
+    }
+    if (is_float) {
+        float_value = number.float_value;
+    } else {
+        int_value = number.int_value;
+    }
+    return true;
+}
+
+bool cbor_reader::read_bool(bool &value) noexcept
+{
+    cbor_head head{};
+    if (code != NO_ERROR || !read_item_head(&cur, end, head, &code)) {
+        return false;
+    }
+    if (head.major != major_simple || (head.info != 20 && head.info != 21)) {
+        code = UNEXPECTED_TOKEN;
+        return false;
+    }
+    value = head.info == 21;
+    return true;
+}
+
+bool cbor_reader::read_null() noexcept
+{
+    cbor_head head{};
+    if (code != NO_ERROR || !read_item_head(&cur, end, head, &code)) {
+        return false;
+    }
+    if (!is_null_item(head)) {
+        code = UNEXPECTED_TOKEN;
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<json_token> cbor_reader::read_token()
+{
+    if (code != NO_ERROR) {
+        return nullptr;
+    }
+    return read_item<strict_parse_policy>(&cur, end, &code, static_cast<unsigned>(remaining.size()));
+}
+
+void cbor_reader::skip_value() noexcept
+{
+    if (code != NO_ERROR) {
+        return;
+    }
+    skip_item(&cur, end, &code, static_cast<unsigned>(remaining.size()));
+}
+
+bool cbor_reader::finish() noexcept
+{
+    if (code != NO_ERROR) {
+        return false;
+    }
+    if (cur != end) {
+        code = UNEXPECTED_END_CHAR;
+        return false;
+    }
+    return true;
+}
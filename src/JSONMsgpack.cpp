@@ -0,0 +1,589 @@
+//
+// Created by Charles on 2018/7/23.
+//
+
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include "JSONMsgpack.hpp"
+#include "JSONUtils.hpp"
+
+using namespace json;
+
+namespace {
+
+/**
+ * the type and the length or value of an object, decoded from its format byte and the following bytes.
+ */
+struct msgpack_head
+{
+    json_type type;
+    // string stored as bin or ext, it is decoded as base64url.
+    bool binary;
+    bool is_float;
+    // value of number, or boolean in {@code int_value}.
+    number_union number;
+    // bytes of string, elements of array or pairs of map.
+    uint64_t length;
+};
+
+}
+
+static bool read_uint(const uint8_t **data, const uint8_t *end, size_t n, uint64_t &value, int *error)
+{
+    if (static_cast<size_t>(end - *data) < n) {
+        *error = BINARY_DATA_TRUNCATED;
+        return false;
+    }
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; ++i) {
+        v = (v << 8u) | (*data)[i];
+    }
+    *data += n;
+    value = v;
+    return true;
+}
+
+static bool read_head(const uint8_t **data, const uint8_t *end, msgpack_head &head, int *error)
+{
+    constexpr auto max_int = static_cast<uint64_t>(std::numeric_limits<int64_t>::max());
+
+    if (*data == end) {
+        *error = BINARY_DATA_TRUNCATED;
+        return false;
+    }
+    uint8_t format = *(*data)++;
+    head.binary = false;
+    head.is_float = false;
+
+    // fix formats
+    if (format <= 0x7f || format >= 0xe0) {
+        head.type = json_type::number;
+        head.number.int_value = static_cast<int8_t>(format);
+        return true;
+    }
+    if (format < 0xc0) {
+        head.type = format < 0x90 ? json_type::object : format < 0xa0 ? json_type::array : json_type::string;
+        head.length = format < 0xa0 ? format & 0x0fu : format & 0x1fu;
+        return true;
+    }
+
+    uint64_t value = 0;
+    switch (format) {
+        case 0xc0:
+            head.type = json_type::null;
+            return true;
+        case 0xc2:
+        case 0xc3:
+            head.type = json_type::boolean;
+            head.number.int_value = format == 0xc3;
+            return true;
+        case 0xc4:
+        case 0xc5:
+        case 0xc6:  // bin 8/16/32
+            head.type = json_type::string;
+            head.binary = true;
+            return read_uint(data, end, size_t(1) << (format - 0xc4u), head.length, error);
+        case 0xc7:
+        case 0xc8:
+        case 0xc9:  // ext 8/16/32, the type byte follows the length.
+            head.type = json_type::string;
+            head.binary = true;
+            return read_uint(data, end, size_t(1) << (format - 0xc7u), head.length, error)
+                   && read_uint(data, end, 1, value, error);
+        case 0xca:
+            if (!read_uint(data, end, 4, value, error)) {
+                return false;
+            }
+            {
+                float single;
+                auto bits = static_cast<uint32_t>(value);
+                std::memcpy(&single, &bits, sizeof(single));
+                head.number.float_value = single;
+            }
+            head.type = json_type::number;
+            head.is_float = true;
+            return true;
+        case 0xcb:
+            if (!read_uint(data, end, 8, value, error)) {
+                return false;
+            }
+            std::memcpy(&head.number.float_value, &value, sizeof(double));
+            head.type = json_type::number;
+            head.is_float = true;
+            return true;
+        case 0xcc:
+        case 0xcd:
+        case 0xce:
+        case 0xcf:  // uint 8/16/32/64
+            if (!read_uint(data, end, size_t(1) << (format - 0xccu), value, error)) {
+                return false;
+            }
+            head.type = json_type::number;
+            head.is_float = value > max_int;
+            if (head.is_float) {
+                head.number.float_value = static_cast<double>(value);
+            } else {
+                head.number.int_value = static_cast<int64_t>(value);
+            }
+            return true;
+        case 0xd0:
+        case 0xd1:
+        case 0xd2:
+        case 0xd3: {    // int 8/16/32/64
+            auto n = size_t(1) << (format - 0xd0u);
+            if (!read_uint(data, end, n, value, error)) {
+                return false;
+            }
+            auto shift = static_cast<unsigned>(64 - n * 8);
+            head.type = json_type::number;
+            head.number.int_value = static_cast<int64_t>(value << shift) >> shift;  // sign extension
+            return true;
+        }
+        case 0xd4:
+        case 0xd5:
+        case 0xd6:
+        case 0xd7:
+        case 0xd8:  // fixext 1/2/4/8/16
+            head.type = json_type::string;
+            head.binary = true;
+            head.length = uint64_t(1) << (format - 0xd4u);
+            return read_uint(data, end, 1, value, error);
+        case 0xd9:
+        case 0xda:
+        case 0xdb:  // str 8/16/32
+            head.type = json_type::string;
+            return read_uint(data, end, size_t(1) << (format - 0xd9u), head.length, error);
+        case 0xdc:
+        case 0xdd:  // array 16/32
+            head.type = json_type::array;
+            return read_uint(data, end, format == 0xdc ? 2 : 4, head.length, error);
+        case 0xde:
+        case 0xdf:  // map 16/32
+            head.type = json_type::object;
+            return read_uint(data, end, format == 0xde ? 2 : 4, head.length, error);
+        default:    // 0xc1 is never used
+            *error = BINARY_DATA_MALFORMED;
+            return false;
+    }
+}
+
+static bool read_string(const uint8_t **data, const uint8_t *end, const msgpack_head &head, std::string &value,
+                        int *error)
+{
+    if (head.length > static_cast<uint64_t>(end - *data)) {
+        *error = BINARY_DATA_TRUNCATED;
+        return false;
+    }
+    auto str = reinterpret_cast<const char *>(*data);
+    auto length = static_cast<size_t>(head.length);
+    if (head.binary) {
+        append_base64url(str, length, value);
+    } else {
+        value.assign(str, length);
+    }
+    *data += length;
+    return true;
+}
+
+template<typename Policy>
+static std::unique_ptr<json_token> read_value(const uint8_t **data, const uint8_t *end, const msgpack_head &head,
+                                              int *error, unsigned depth);
+
+template<typename Policy>
+static std::unique_ptr<json_token> read_map(const uint8_t **data, const uint8_t *end, const msgpack_head &head,
+                                            int *error, unsigned depth)
+{
+    auto *ptr = new json_object();
+    std::unique_ptr<json_token> object_ptr(ptr);
+    // each pair takes two bytes at least.
+    if (head.length > static_cast<uint64_t>(end - *data) / 2) {
+        *error = BINARY_DATA_TRUNCATED;
+        return nullptr;
+    }
+
+    for (uint64_t i = 0; i < head.length; ++i) {
+        msgpack_head key_head{};
+        if (!read_head(data, end, key_head, error)) {
+            return nullptr;
+        }
+        if (key_head.type != json_type::string || key_head.binary) {
+            *error = OBJECT_KEY_SYNTAX_ERROR;
+            return nullptr;
+        }
+        std::string key;
+        if (!read_string(data, end, key_head, key, error)) {
+            return nullptr;
+        }
+
+        msgpack_head value_head{};
+        if (!read_head(data, end, value_head, error)) {
+            return nullptr;
+        }
+        auto value = read_value<Policy>(data, end, value_head, error, depth);
+        if (*error != NO_ERROR) {
+            return nullptr;
+        }
+        auto ret = ptr->put(std::move(key), std::move(value));
+        if (Policy::check_duplicated_key && !ret) {
+            *error = OBJECT_DUPLICATED_KEY;
+            return nullptr;
+        }
+    }
+    return object_ptr;
+}
+
+template<typename Policy>
+static std::unique_ptr<json_token> read_array(const uint8_t **data, const uint8_t *end, const msgpack_head &head,
+                                              int *error, unsigned depth)
+{
+    auto *ptr = new json_array();
+    std::unique_ptr<json_token> array_ptr(ptr);
+    if (head.length > static_cast<uint64_t>(end - *data)) {
+        *error = BINARY_DATA_TRUNCATED;
+        return nullptr;
+    }
+
+    for (uint64_t i = 0; i < head.length; ++i) {
+        msgpack_head elem_head{};
+        if (!read_head(data, end, elem_head, error)) {
+            return nullptr;
+        }
+        // numbers are added without token, so that the array can be packed.
+        if (elem_head.type == json_type::number) {
+            if (elem_head.is_float) {
+                ptr->add(elem_head.number.float_value);
+            } else {
+                ptr->add(elem_head.number.int_value);
+            }
+            continue;
+        }
+        auto elem = read_value<Policy>(data, end, elem_head, error, depth);
+        if (*error != NO_ERROR) {
+            return nullptr;
+        }
+        ptr->add(std::move(elem));
+    }
+    if (ptr->get_packing() != json_array::packing::none) {
+        ptr->shrink_to_fit();
+    }
+    return array_ptr;
+}
+
+template<typename Policy>
+std::unique_ptr<json_token> read_value(const uint8_t **data, const uint8_t *end, const msgpack_head &head, int *error,
+                                       unsigned depth)
+{
+    switch (head.type) {
+        case json_type::object:
+        case json_type::array:
+            if (Policy::max_depth != 0 && depth >= Policy::max_depth) {
+                *error = NESTING_DEPTH_EXCEEDED;
+                return nullptr;
+            }
+            if (head.type == json_type::object) {
+                return read_map<Policy>(data, end, head, error, depth + 1);
+            }
+            return read_array<Policy>(data, end, head, error, depth + 1);
+        case json_type::string: {
+            std::string value;
+            if (!read_string(data, end, head, value, error)) {
+                return nullptr;
+            }
+            return std::unique_ptr<json_token>(new json_string_value(std::move(value)));
+        }
+        case json_type::number:
+            if (head.is_float) {
+                return std::unique_ptr<json_token>(new json_number_value(head.number.float_value));
+            }
+            return std::unique_ptr<json_token>(new json_number_value(head.number.int_value));
+        case json_type::boolean:
+            return std::unique_ptr<json_token>(new json_bool_value(head.number.int_value != 0));
+        default:
+            return std::unique_ptr<json_token>(new json_null_value());
+    }
+}
+
+template<typename Policy>
+std::unique_ptr<json_token> json::parse_msgpack(const uint8_t *data, size_t size, int *error)
+{
+    int code = NO_ERROR;
+    auto cur = data;
+    auto end = data + size;
+    std::unique_ptr<json_token> ret;
+    msgpack_head head{};
+    if (read_head(&cur, end, head, &code)) {
+        ret = read_value<Policy>(&cur, end, head, &code, 0);
+    }
+    if (code == NO_ERROR && cur != end) {
+        code = UNEXPECTED_END_CHAR;
+    }
+    if (error) {
+        *error = code;
+    }
+    if (code != NO_ERROR) {
+        if (Policy::log_error) {
+            std::cerr << "decode MessagePack failed near byte position " << static_cast<int64_t>(cur - data)
+                      << ", error code: " << code << ", info: " << get_error_info(code) << std::endl;
+        }
+        return nullptr;
+    }
+    return ret;
+}
+
+template std::unique_ptr<json_token> json::parse_msgpack<strict_parse_policy>(const uint8_t *data, size_t size, int *error);
+template std::unique_ptr<json_token> json::parse_msgpack<trusted_parse_policy>(const uint8_t *data, size_t size, int *error);
+
+namespace {
+
+class vector_output
+{
+public:
+    explicit vector_output(std::vector<uint8_t> &o) noexcept : out(o) { }
+
+    void append(const uint8_t *data, size_t size)
+    {
+        out.insert(out.end(), data, data + size);
+    }
+
+private:
+    std::vector<uint8_t> &out;
+};
+
+/**
+ * write to the buffer of caller, the bytes beyond its capacity are only counted.
+ */
+class buffer_output
+{
+public:
+    buffer_output(uint8_t *b, size_t c) noexcept : buffer(b), capacity(c), used(0) { }
+
+    void append(const uint8_t *data, size_t size) noexcept
+    {
+        if (used < capacity) {
+            std::memcpy(buffer + used, data, std::min(size, capacity - used));
+        }
+        used += size;
+    }
+
+    size_t size() const noexcept
+    {
+        return used;
+    }
+
+private:
+    uint8_t *buffer;
+    size_t capacity;
+    size_t used;
+};
+
+/**
+ * write to {@code json_sink} through a fixed-size buffer.
+ */
+class sink_output
+{
+public:
+    sink_output(json_sink &s, size_t size)
+            : sink(s), capacity(size < 64 ? 64 : size), buffer(new uint8_t[capacity]), used(0), failed(false) { }
+
+    void append(const uint8_t *data, size_t size)
+    {
+        if (used + size > capacity) {
+            flush();
+            if (size > capacity) {
+                // too large to be buffered, e.g. a long string.
+                failed = failed || !sink.write(reinterpret_cast<const char *>(data), size);
+                return;
+            }
+        }
+        std::memcpy(&buffer[used], data, size);
+        used += size;
+    }
+
+    bool flush()
+    {
+        if (used > 0) {
+            failed = failed || !sink.write(reinterpret_cast<const char *>(&buffer[0]), used);
+            used = 0;
+        }
+        return !failed;
+    }
+
+private:
+    json_sink &sink;
+    size_t capacity;
+    std::unique_ptr<uint8_t[]> buffer;
+    size_t used;
+    bool failed;
+};
+
+}
+
+/**
+ * write a format byte followed by {@code n} bytes of {@code value} in big-endian.
+ */
+template<typename Output>
+static void write_format(uint8_t format, uint64_t value, size_t n, Output &out)
+{
+    uint8_t buffer[9];
+    buffer[0] = format;
+    for (size_t i = 0; i < n; ++i) {
+        buffer[n - i] = static_cast<uint8_t>(value >> (i * 8));
+    }
+    out.append(buffer, n + 1);
+}
+
+template<typename Output>
+static void write_integer(int64_t value, Output &out)
+{
+    if (value >= 0) {
+        auto u = static_cast<uint64_t>(value);
+        if (u <= 0x7f) {
+            write_format(static_cast<uint8_t>(u), 0, 0, out);
+        } else if (u <= 0xff) {
+            write_format(0xcc, u, 1, out);
+        } else if (u <= 0xffff) {
+            write_format(0xcd, u, 2, out);
+        } else if (u <= 0xffffffff) {
+            write_format(0xce, u, 4, out);
+        } else {
+            write_format(0xcf, u, 8, out);
+        }
+        return;
+    }
+
+    auto u = static_cast<uint64_t>(value);
+    if (value >= -32) {
+        write_format(static_cast<uint8_t>(u), 0, 0, out);
+    } else if (value >= std::numeric_limits<int8_t>::min()) {
+        write_format(0xd0, u, 1, out);
+    } else if (value >= std::numeric_limits<int16_t>::min()) {
+        write_format(0xd1, u, 2, out);
+    } else if (value >= std::numeric_limits<int32_t>::min()) {
+        write_format(0xd2, u, 4, out);
+    } else {
+        write_format(0xd3, u, 8, out);
+    }
+}
+
+template<typename Output>
+static void write_float(double value, Output &out)
+{
+    auto single = static_cast<float>(value);
+    if (single == value) {
+        uint32_t bits;
+        std::memcpy(&bits, &single, sizeof(single));
+        write_format(0xca, bits, 4, out);
+    } else {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(value));
+        write_format(0xcb, bits, 8, out);
+    }
+}
+
+/**
+ * write the header of array or map.
+ * @param fix format byte of fixarray or fixmap with size 0.
+ * @param format16 format byte of array 16 or map 16, the 32-bit format is the next one.
+ */
+template<typename Output>
+static void write_container(size_t size, uint8_t fix, uint8_t format16, Output &out)
+{
+    if (size < 16) {
+        write_format(static_cast<uint8_t>(fix | size), 0, 0, out);
+    } else if (size <= 0xffff) {
+        write_format(format16, size, 2, out);
+    } else {
+        write_format(static_cast<uint8_t>(format16 + 1), size, 4, out);
+    }
+}
+
+template<typename Output>
+static void write_str(const std::string &value, Output &out)
+{
+    size_t size = value.size();
+    if (size < 32) {
+        write_format(static_cast<uint8_t>(0xa0 | size), 0, 0, out);
+    } else if (size <= 0xff) {
+        write_format(0xd9, size, 1, out);
+    } else if (size <= 0xffff) {
+        write_format(0xda, size, 2, out);
+    } else {
+        write_format(0xdb, size, 4, out);
+    }
+    out.append(reinterpret_cast<const uint8_t *>(value.data()), size);
+}
+
+template<typename Output>
+static void write_item(const json_token &token, Output &out)
+{
+    switch (token.get_type()) {
+        case json_type::object: {
+            const auto &obj = static_cast<const json_object &>(token); // NOLINT
+            write_container(obj.size(), 0x80, 0xde, out);
+            for (const auto &property : obj) {
+                write_str(property.first, out);
+                write_item(*property.second, out);
+            }
+            break;
+        }
+        case json_type::array: {
+            const auto &ary = static_cast<const json_array &>(token); // NOLINT
+            auto packed = ary.get_packed();
+            size_t size = packed.type != json_array::packing::none ? packed.size : ary.size();
+            write_container(size, 0x90, 0xdc, out);
+            if (packed.type == json_array::packing::int64) {
+                for (size_t i = 0; i < size; ++i) {
+                    write_integer(packed.ints[i], out);
+                }
+            } else if (packed.type == json_array::packing::float64) {
+                for (size_t i = 0; i < size; ++i) {
+                    write_float(packed.floats[i], out);
+                }
+            } else {
+                for (const auto &element : ary) {
+                    write_item(*element, out);
+                }
+            }
+            break;
+        }
+        case json_type::string:
+            write_str(static_cast<const json_string_value &>(token).value(), out); // NOLINT
+            break;
+        case json_type::number: {
+            const auto &num = static_cast<const json_number_value &>(token); // NOLINT
+            if (num.is_float_value()) {
+                write_float(static_cast<double>(num), out);
+            } else {
+                write_integer(static_cast<int64_t>(num), out);
+            }
+            break;
+        }
+        case json_type::boolean:
+            write_format(static_cast<bool>(static_cast<const json_bool_value &>(token)) ? 0xc3 : 0xc2, 0, 0, out); // NOLINT
+            break;
+        case json_type::null:
+            write_format(0xc0, 0, 0, out);
+            break;
+    }
+}
+
+void json::to_msgpack(const json_token &token, std::vector<uint8_t> &out)
+{
+    vector_output output(out);
+    write_item(token, output);
+}
+
+size_t json::to_msgpack(const json_token &token, uint8_t *buffer, size_t size)
+{
+    buffer_output output(buffer, size);
+    write_item(token, output);
+    return output.size();
+}
+
+bool json::write_msgpack(const json_token &token, json_sink &sink, size_t buffer_size)
+{
+    sink_output output(sink, buffer_size);
+    write_item(token, output);
+    return output.flush() && sink.flush();
+}
@@ -0,0 +1,235 @@
+//
+// Created by Charles on 2018/7/9.
+//
+
+#include <cstring>
+#include "JSONQuery.hpp"
+#include "JSONQueryFilter.hpp"
+#include "JSONUtils.hpp"
+
+using namespace json;
+
+namespace {
+
+/**
+ * filters to be matched against the children of the value being parsed. filters of all nesting levels
+ * share one stack, a level uses the range [begin, end) of it.
+ */
+struct projection_state
+{
+    std::vector<const filter_base *> stack;
+};
+
+/**
+ * the filters selecting a child. {@code whole} means the whole subtree of the child is selected.
+ */
+struct child_projection
+{
+    size_t begin;
+    size_t end;
+    bool whole;
+
+    bool empty() const noexcept
+    {
+        return !whole && begin == end;
+    }
+};
+
+}
+
+template<typename F>
+static child_projection project_child(projection_state &state, size_t begin, size_t end, F &&project)
+{
+    child_projection child{state.stack.size(), state.stack.size(), false};
+    for (size_t i = begin; i < end; ++i) {
+        auto filter = state.stack[i];
+        auto r = project(filter);
+        if (r == filter_base::projection::none) {
+            continue;
+        }
+        if (r == filter_base::projection::whole || !filter->next_filter()) {
+            child.whole = true;
+            break;
+        }
+        state.stack.push_back(filter->next_filter());
+    }
+    child.end = state.stack.size();
+    return child;
+}
+
+static std::unique_ptr<json_token> read_projected(const char **str, int *error, projection_state &state, size_t begin,
+                                                  size_t end, unsigned depth);
+
+/**
+ * read or skip a child at nesting {@code depth}, the limit of {@code strict_parse_policy} applies to all of them.
+ */
+static std::unique_ptr<json_token> read_child(const char **str, int *error, projection_state &state,
+                                              const child_projection &child, unsigned depth)
+{
+    if (child.whole) {
+        return read_json_token(str, error, depth);
+    }
+    if (child.empty()) {
+        skip_json_value(str, error, strict_parse_policy::max_depth, depth);
+        return nullptr;
+    }
+    return read_projected(str, error, state, child.begin, child.end, depth);
+}
+
+static std::unique_ptr<json_token> read_projected_object(const char **object_str, int *error, projection_state &state,
+                                                         size_t begin, size_t end, unsigned depth)
+{
+    auto str = skip_whitespace(*object_str, 1);
+    auto *ptr = new json_object();
+    std::unique_ptr<json_token> object_ptr(ptr);
+    if (*str == '}') {
+        *object_str = str + 1;
+        return object_ptr;
+    }
+
+    while (true) {
+        if (!assert_equal(*str, '\"')) {
+            *error = OBJECT_KEY_SYNTAX_ERROR;
+            return nullptr;
+        }
+        ++str;
+        auto key = read_json_string(&str, error);
+        if (*error != NO_ERROR) {
+            return nullptr;
+        }
+
+        str = skip_whitespace(str);
+        if (!assert_equal(*str, ':')) {
+            *error = OBJECT_KV_SYNTAX_ERROR;
+            return nullptr;
+        }
+        ++str;
+
+        auto child = project_child(state, begin, end, [&key](const filter_base *filter) {
+            return filter->project_member(key);
+        });
+        auto value = read_child(&str, error, state, child, depth);
+        state.stack.resize(child.begin);
+        if (*error != NO_ERROR) {
+            return nullptr;
+        }
+        if (value && !json_assert(ptr->put(std::move(key), std::move(value)))) {
+            *error = OBJECT_DUPLICATED_KEY;
+            return nullptr;
+        }
+
+        str = skip_whitespace(str);
+        if (*str == ',') {
+            str = skip_whitespace(str, 1);
+            continue;
+        }
+        if (!json_assert(*str == '}')) {
+            *error = OBJECT_PARSE_ERROR;
+            return nullptr;
+        }
+
+        *object_str = str + 1;
+        return object_ptr;
+    }
+}
+
+static std::unique_ptr<json_token> read_projected_array(const char **array_str, int *error, projection_state &state,
+                                                        size_t begin, size_t end, unsigned depth)
+{
+    auto str = skip_whitespace(*array_str, 1);
+    auto *ptr = new json_array();
+    std::unique_ptr<json_token> array_ptr(ptr);
+    if (*str == ']') {
+        *array_str = str + 1;
+        return array_ptr;
+    }
+
+    for (uint64_t index = 0;; ++index) {
+        auto child = project_child(state, begin, end, [index](const filter_base *filter) {
+            return filter->project_element(index);
+        });
+        auto elem = read_child(&str, error, state, child, depth);
+        state.stack.resize(child.begin);
+        if (*error != NO_ERROR) {
+            return nullptr;
+        }
+        // keep the index of the following elements unchanged.
+        ptr->add(elem ? std::move(elem) : std::unique_ptr<json_token>(new json_null_value()));
+
+        str = skip_whitespace(str);
+        if (*str == ',') {
+            ++str;
+            continue;
+        }
+        if (!assert_equal(*str, ']')) {
+            *error = ARRAY_PARSE_ERROR;
+            return nullptr;
+        }
+        *array_str = str + 1;
+        return array_ptr;
+    }
+}
+
+std::unique_ptr<json_token> read_projected(const char **str, int *error, projection_state &state, size_t begin,
+                                           size_t end, unsigned depth)
+{
+    auto tmp = skip_whitespace(*str);
+    *str = tmp;
+
+    if (*tmp == '{' || *tmp == '[') {
+        if (strict_parse_policy::max_depth != 0 && depth >= strict_parse_policy::max_depth) {
+            *error = NESTING_DEPTH_EXCEEDED;
+            return nullptr;
+        }
+        if (*tmp == '{') {
+            return read_projected_object(str, error, state, begin, end, depth + 1);
+        }
+        return read_projected_array(str, error, state, begin, end, depth + 1);
+    }
+
+    // the filters expect children, a primitive value never matches.
+    skip_json_value(str, error, strict_parse_policy::max_depth, depth);
+    return nullptr;
+}
+
+std::unique_ptr<json_token> json::parse(const char *json, const std::vector<std::string> &paths, int *error)
+{
+    std::vector<std::unique_ptr<filter_base>> filters;
+    projection_state state;
+    bool whole = paths.empty();
+    for (const auto &path : paths) {
+        auto filter = path[0] == '/' ? parse_pointer(path.c_str()) : parse_filter(path.c_str());
+        if (!filter) {
+            const char *p = skip_whitespace(path.c_str());
+            if (std::strcmp(p, "$") != 0) {
+                if (error) {
+                    *error = QUERY_PATH_SYNTAX_ERROR;
+                }
+                return nullptr;
+            }
+            whole = true;   // "$" selects the whole document.
+            continue;
+        }
+        state.stack.push_back(filter.get());
+        filters.push_back(std::move(filter));
+    }
+    if (whole) {
+        return parse(json, error);
+    }
+
+    int code = NO_ERROR;
+    auto ret = read_projected(&json, &code, state, 0, state.stack.size(), 0);
+    if (code == NO_ERROR && !assert_end_str(json)) {
+        code = UNEXPECTED_END_CHAR;
+    }
+    if (error) {
+        *error = code;
+    }
+    if (code != NO_ERROR) {
+        return nullptr;
+    }
+    if (!ret) {
+        ret.reset(new json_null_value());   // root is a primitive value.
+    }
+    return ret;
+}
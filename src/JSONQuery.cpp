@@ -2,6 +2,9 @@
 // Created by Charles on 2018/1/25.
 //
 
+#include <list>
+#include <mutex>
+#include <unordered_map>
 #include "JSONQuery.hpp"
 #include "JSONQueryFilter.hpp"
 #include "JSONUtils.hpp"
@@ -18,7 +21,12 @@ class sentry_filter final : public filter_base
 protected:
     void do_filter(json_token &token, std::vector<json_token *> &result, bool single) noexcept override
     {
-        filter_next(token, result, single);
+        filter_next(token_document(), &token, result, single);
+    }
+
+    void do_filter(const json_tape_view &tape, size_t index, std::vector<size_t> &result, bool single) noexcept override
+    {
+        filter_next(tape_document(tape), index, result, single);
     }
 };
 
@@ -50,6 +58,92 @@ enum class parser_state
     bracket_wildcard
 };
 
+/**
+ * LRU cache of compiled paths keyed by path string. a miss compiles the path without holding the lock.
+ */
+class path_cache
+{
+public:
+    std::shared_ptr<const compiled_path> get(const char *path)
+    {
+        std::string key(path);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(key);
+            if (it != index.end()) {
+                ++hits;
+                entries.splice(entries.begin(), entries, it->second);
+                return it->second->second;
+            }
+            ++misses;
+        }
+
+        std::shared_ptr<const compiled_path> compiled(new compiled_path(path));
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            return it->second->second;  // added by another thread meanwhile.
+        }
+        if (capacity_limit == 0) {
+            return compiled;
+        }
+        entries.emplace_front(key, compiled);
+        index.emplace(std::move(key), entries.begin());
+        evict();
+        return compiled;
+    }
+
+    bool enabled() const noexcept
+    {
+        return enabled_flag.load(std::memory_order_relaxed);
+    }
+
+    void set_capacity(size_t capacity)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        capacity_limit = capacity;
+        enabled_flag.store(capacity > 0, std::memory_order_relaxed);
+        evict();
+    }
+
+    path_cache_stats stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return path_cache_stats{hits, misses, entries.size(), capacity_limit};
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        index.clear();
+        entries.clear();
+        hits = 0;
+        misses = 0;
+    }
+
+private:
+    using entry = std::pair<std::string, std::shared_ptr<const compiled_path>>;
+
+    void evict()
+    {
+        while (entries.size() > capacity_limit) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+    std::mutex mutex;
+    std::atomic<bool> enabled_flag{false};
+    size_t capacity_limit = 0;
+    size_t hits = 0;
+    size_t misses = 0;
+    // most recently used first.
+    std::list<entry> entries;
+    std::unordered_map<std::string, std::list<entry>::iterator> index;
+};
+
+path_cache global_path_cache;
+
 }
 
 inline static bool is_alnum_or_line(char c)
@@ -58,23 +152,28 @@ inline static bool is_alnum_or_line(char c)
 }
 
 /**
- * parse object key or key list in bracket-notation. when parse success, **path == ']'.
+ * parse object key or key list in bracket-notation. when parse success, **path == ']', otherwise *path is moved to
+ * where parsing stopped.
  */
 static std::unique_ptr<filter_base> parse_bracket_object_key(const char **path)
 {
     const char *start = *path;
     int code = NO_ERROR;
     std::list<std::string> key_list;
+    auto fail = [path](const char *position) -> std::unique_ptr<filter_base> {
+        *path = position;
+        return nullptr;
+    };
 
     while (true) {
         if (*start != '\'') {
-            return nullptr;
+            return fail(start);
         }
 
         ++start;
         auto key_str = read_json_string(&start, &code, '\'');
         if (code != NO_ERROR) {
-            return nullptr;
+            return fail(start - 1);     // the key which fails, from its quote.
         }
 
         if (!key_str.empty()) {
@@ -86,13 +185,13 @@ static std::unique_ptr<filter_base> parse_bracket_object_key(const char **path)
             break;
         }
         if (*start != ',') {
-            return nullptr;
+            return fail(start);
         }
         start = skip_whitespace(start, 1);
     }
 
     if (key_list.empty()) {
-        return nullptr;
+        return fail(start);
     }
 
     *path = start;
@@ -119,20 +218,26 @@ static std::unique_ptr<filter_base> parse_dot_object_key(const char **path)
 }
 
 /**
- * parse array index syntax or script syntax in any notation. when parse success, **path == ']'.
+ * parse array index syntax or script syntax in any notation. when parse success, **path == ']', otherwise *path is
+ * moved to where parsing stopped.
  */
 static std::unique_ptr<filter_base> parse_array_index_or_script(const char **path)
 {
     const char *start = *path;
+    // report where parsing stops.
+    auto fail = [path](const char *position) -> std::unique_ptr<filter_base> {
+        *path = position;
+        return nullptr;
+    };
 
     if (*start == '(') {
         auto expr_script = parse_expr_script(&start);
-        *path = skip_whitespace(start);
+        *path = expr_script ? skip_whitespace(start) : start;
         return expr_script;
     }
     if (*start == '?') {
         auto filter_script = parse_filter_script(&start);
-        *path = skip_whitespace(start);
+        *path = filter_script ? skip_whitespace(start) : start;
         return filter_script;
     }
 
@@ -149,23 +254,25 @@ static std::unique_ptr<filter_base> parse_array_index_or_script(const char **pat
     // as slice operator too.
     if (*start == '-') {
         is_slice_syntax = true;
+        errno = 0;
         slice_start = std::strtoll(start, &end, 10);
         if (end == start || errno == ERANGE) {
-            return nullptr;
+            return fail(start);
         }
 
         start = skip_whitespace(end);
         if (*start != ':') {
-            return nullptr;
+            return fail(start);
         }
         ++start;
     } else if (*start == ':') {
         is_slice_syntax = true;
         ++start;
     } else {
+        errno = 0;
         first_num = std::strtoull(start, &end, 10);
         if (end == start || errno == ERANGE) {
-            return nullptr;
+            return fail(start);
         }
 
         start = skip_whitespace(end);
@@ -177,13 +284,13 @@ static std::unique_ptr<filter_base> parse_array_index_or_script(const char **pat
             is_slice_syntax = true;
             slice_start = static_cast<int64_t>(first_num);
             if (slice_start < 0) {
-                return nullptr;     // overflow.
+                return fail(start);     // overflow.
             }
             ++start;
         } else if (*start == ',') {
             ++start;
         } else {
-            return nullptr;
+            return fail(start);
         }
     }
 
@@ -195,9 +302,10 @@ static std::unique_ptr<filter_base> parse_array_index_or_script(const char **pat
             }
 
             if (*start != ':') {        /* [num:num or [:num */
+                errno = 0;
                 slice_end = std::strtoll(start, &end, 10);
                 if (end == start || errno == ERANGE) {
-                    return nullptr;
+                    return fail(start);
                 }
 
                 start = skip_whitespace(end);
@@ -207,7 +315,7 @@ static std::unique_ptr<filter_base> parse_array_index_or_script(const char **pat
             }
 
             if (*start != ':') {
-                return nullptr;
+                return fail(start);
             }
             /* [num:num: or [:num: or [num:: or [:: */
             start = skip_whitespace(start, 1);
@@ -215,13 +323,14 @@ static std::unique_ptr<filter_base> parse_array_index_or_script(const char **pat
                 break;
             }
 
+            errno = 0;
             slice_step = std::strtoull(start, &end, 10);
             if (end == start || errno == ERANGE) {
-                return nullptr;
+                return fail(start);
             }
             start = skip_whitespace(end);
             if (*start != ']') {
-                return nullptr;
+                return fail(start);
             }
             /* [num:num:num] or [:num:num] or [num::num] or [::num] */
         } while (false);
@@ -234,9 +343,10 @@ static std::unique_ptr<filter_base> parse_array_index_or_script(const char **pat
     std::vector<uint64_t> indices;
     indices.push_back(first_num);
     do {
+        errno = 0;
         first_num = std::strtoull(start, &end, 10);
         if (end == start || errno == ERANGE) {
-            return nullptr;
+            return fail(start);
         }
 
         indices.push_back(first_num);
@@ -245,7 +355,7 @@ static std::unique_ptr<filter_base> parse_array_index_or_script(const char **pat
             break;
         }
         if (*start != ',') {
-            return nullptr;
+            return fail(start);
         }
         start = skip_whitespace(start, 1);
     } while (true);
@@ -254,8 +364,16 @@ static std::unique_ptr<filter_base> parse_array_index_or_script(const char **pat
     return std::unique_ptr<filter_base>(new array_multi_filter(std::move(indices)));
 }
 
-static std::unique_ptr<filter_base> parse_filter(const char *path)
+std::unique_ptr<filter_base> json::parse_filter(const char *path, size_t *error_offset)
 {
+    const char *begin = path;
+    // report the position of the syntax part which fails to parse.
+    auto fail = [&](const char *position) -> std::unique_ptr<filter_base> {
+        if (error_offset) {
+            *error_offset = static_cast<size_t>(position - begin);
+        }
+        return nullptr;
+    };
     parser_state state = parser_state::start;
     const char *last_handle_pos = path;
     std::unique_ptr<filter_base> sentry(new sentry_filter());
@@ -289,7 +407,7 @@ rerun:
                 } else if (c == '[') {
                     state = parser_state::start_bracket;
                 } else {
-                    return nullptr;
+                    return fail(path);
                 }
                 break;
             }
@@ -336,14 +454,14 @@ rerun:
                         state = parser_state::check_end_bracket;
                         goto rerun;
                     } else {
-                        return nullptr;
+                        return fail(path);
                     }
                 }
             }
 
             case parser_state::check_end_bracket: {
                 if (*path != ']') {     // goto rerun, so value of `c` did not update.
-                    return nullptr;
+                    return fail(path);
                 }
 
                 last_handle_pos = ++path;
@@ -357,7 +475,7 @@ rerun:
                 } else if (c == '[') {
                     state = parser_state::start_bracket;
                 } else {
-                    return nullptr;
+                    return fail(path);
                 }
                 break;
             }
@@ -370,7 +488,7 @@ rerun:
                     state = parser_state::dot_continue;
                     continue;
                 } else {
-                    return nullptr;
+                    return fail(path);
                 }
             }
 
@@ -380,7 +498,7 @@ rerun:
                 } else if (c == '[') {
                     state = parser_state::dot_start_bracket;
                 } else {
-                    return nullptr;
+                    return fail(path);
                 }
                 break;
             }
@@ -426,13 +544,13 @@ rerun:
                     state = parser_state::dot_check_end_bracket;
                     goto rerun;
                 } else {
-                    return nullptr;
+                    return fail(path);
                 }
             }
 
             case parser_state::dot_check_end_bracket: {
                 if (*path != ']') {     // goto rerun. we should use current `*path` value.
-                    return nullptr;
+                    return fail(path);
                 }
                 last_handle_pos = ++path;
                 state = parser_state::dot_continue;
@@ -453,7 +571,7 @@ rerun:
                     state = parser_state::bracket_check_end_bracket;
                     goto rerun;
                 } else {
-                    return nullptr;
+                    return fail(path);
                 }
             }
 
@@ -471,14 +589,14 @@ rerun:
                         state = parser_state::bracket_check_end_bracket;
                         goto rerun;
                     } else {
-                        return nullptr;
+                        return fail(path);
                     }
                 }
             }
 
             case parser_state::bracket_check_end_bracket: {
                 if (*path != ']') {     // goto rerun. value of `c` is out of date.
-                    return nullptr;
+                    return fail(path);
                 }
 
                 last_handle_pos = ++path;
@@ -491,7 +609,7 @@ rerun:
                     state = parser_state::bracket_start_bracket;
                     break;
                 } else {
-                    return nullptr;
+                    return fail(path);
                 }
             }
 
@@ -506,15 +624,99 @@ rerun:
     }
 
     if (last_handle_pos != path) {
+        return fail(path);      // the last part is incomplete
+    }
+    if (!sentry->next_filter()) {
+        return fail(path);      // empty path
+    }
+
+    return sentry->fetch_next_filter();
+}
+
+/**
+ * array index of a json pointer token, digits without leading zeros, or {@code pointer_filter::no_index}.
+ */
+static uint64_t pointer_token_index(const std::string &token)
+{
+    if (token.empty() || (token[0] == '0' && token.size() > 1)) {
+        return pointer_filter::no_index;
+    }
+    uint64_t index = 0;
+    for (char c : token) {
+        if (c < '0' || c > '9') {
+            return pointer_filter::no_index;
+        }
+        auto digit = static_cast<uint64_t>(c - '0');
+        if (index > (pointer_filter::no_index - 1 - digit) / 10) {
+            return pointer_filter::no_index;    // too large to be an index.
+        }
+        index = index * 10 + digit;
+    }
+    return index;
+}
+
+std::unique_ptr<filter_base> json::parse_pointer(const char *pointer, size_t *error_offset)
+{
+    if (*pointer != '/') {
+        if (error_offset) {
+            *error_offset = 0;
+        }
         return nullptr;
     }
 
+    std::unique_ptr<filter_base> sentry(new sentry_filter());
+    filter_base *cur = sentry.get();
+    const char *p = pointer;
+    while (*p == '/') {
+        std::string token;
+        for (++p; *p != '\0' && *p != '/'; ++p) {
+            if (*p != '~') {
+                token.push_back(*p);
+                continue;
+            }
+            if (p[1] != '0' && p[1] != '1') {
+                if (error_offset) {
+                    *error_offset = static_cast<size_t>(p - pointer);
+                }
+                return nullptr;
+            }
+            token.push_back(p[1] == '0' ? '~' : '/');
+            ++p;
+        }
+        auto index = pointer_token_index(token);
+        cur = cur->set_next_filter(std::unique_ptr<filter_base>(new pointer_filter(std::move(token), index)));
+    }
     return sentry->fetch_next_filter();
 }
 
-json_token *json::select_token(json_token &token, const char *path)
+json::compiled_path::compiled_path() noexcept = default;
+
+json::compiled_path::compiled_path(const char *path, int *error, size_t *error_offset)
+{
+    compile(path, error, error_offset);
+}
+
+json::compiled_path::compiled_path(compiled_path &&other) noexcept = default;
+
+json::compiled_path &json::compiled_path::operator=(compiled_path &&other) noexcept = default;
+
+json::compiled_path::~compiled_path() = default;
+
+bool json::compiled_path::compile(const char *path, int *error, size_t *error_offset)
+{
+    size_t offset = 0;
+    filter = parse_filter(path, &offset);
+    if (error) {
+        *error = filter ? NO_ERROR : QUERY_PATH_SYNTAX_ERROR;
+    }
+    if (error_offset) {
+        *error_offset = filter ? 0 : offset;
+    }
+    return static_cast<bool>(filter);
+}
+
+json_token *json::compiled_path::select_token(json_token &token) const
 {
-    auto filter = parse_filter(path);
     if (!filter) {
         return nullptr;
     }
@@ -527,14 +729,87 @@ json_token *json::select_token(json_token &token, const char *path)
     return result.front();
 }
 
+void json::compiled_path::select_tokens(json_token &token, std::vector<json_token *> &result) const
+{
+    result.clear();
+    if (filter) {
+        filter->filter(token, result, false);
+    }
+}
+
+size_t json::compiled_path::select_token(const json_tape_view &tape) const
+{
+    if (!filter || tape.empty()) {
+        return json_tape_view::npos;
+    }
+
+    std::vector<size_t> result;
+    filter->filter(tape, tape.root(), result, true);
+    if (result.empty()) {
+        return json_tape_view::npos;
+    }
+    return result.front();
+}
+
+void json::compiled_path::select_tokens(const json_tape_view &tape, std::vector<size_t> &result) const
+{
+    result.clear();
+    if (filter && !tape.empty()) {
+        filter->filter(tape, tape.root(), result, false);
+    }
+}
+
+void json::set_path_cache_capacity(size_t capacity)
+{
+    global_path_cache.set_capacity(capacity);
+}
+
+path_cache_stats json::get_path_cache_stats()
+{
+    return global_path_cache.stats();
+}
+
+void json::clear_path_cache()
+{
+    global_path_cache.clear();
+}
+
+std::shared_ptr<const compiled_path> json::cached_path(const char *path)
+{
+    if (!global_path_cache.enabled()) {
+        return std::make_shared<const compiled_path>(path);
+    }
+    return global_path_cache.get(path);
+}
+
+json_token *json::select_token(json_token &token, const char *path)
+{
+    if (global_path_cache.enabled()) {
+        return global_path_cache.get(path)->select_token(token);
+    }
+    return compiled_path(path).select_token(token);
+}
+
 std::vector<json_token *> json::select_tokens(json_token &token, const char *path)
 {
-    auto filter = parse_filter(path);
-    if (!filter) {
-        return {};
+    if (global_path_cache.enabled()) {
+        return global_path_cache.get(path)->select_tokens(token);
     }
+    return compiled_path(path).select_tokens(token);
+}
 
-    std::vector<json_token *> result;
-    filter->filter(token, result, false);
-    return result;
+size_t json::select_token(const json_tape_view &tape, const char *path)
+{
+    if (global_path_cache.enabled()) {
+        return global_path_cache.get(path)->select_token(tape);
+    }
+    return compiled_path(path).select_token(tape);
+}
+
+std::vector<size_t> json::select_tokens(const json_tape_view &tape, const char *path)
+{
+    if (global_path_cache.enabled()) {
+        return global_path_cache.get(path)->select_tokens(tape);
+    }
+    return compiled_path(path).select_tokens(tape);
 }
@@ -3,58 +3,72 @@
 //
 
 #include <cassert>
+#include <cmath>
 #include "JSONQueryFilter.hpp"
+#include "JSONUtils.hpp"
 
-void json::recursive_filter::do_filter(json::json_token &token, std::vector<json::json_token *> &result, bool single) noexcept
+/**
+ * define both {@code do_filter} overloads of filter {@code name}, forwarding to its {@code filter_impl}.
+ */
+#define DEFINE_FILTER_DOCUMENT_OVERRIDES(name) \
+void json::name::do_filter(json::json_token &token, std::vector<json::json_token *> &result, bool single) noexcept \
+{ \
+    filter_impl(token_document(), &token, result, single); \
+} \
+void json::name::do_filter(const json::json_tape_view &tape, size_t index, std::vector<size_t> &result, bool single) noexcept \
+{ \
+    filter_impl(tape_document(tape), index, result, single); \
+}
+
+template<typename Doc>
+void json::recursive_filter::filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept
 {
-    filter_next(token, result, single);
+    using node = typename Doc::node;
+
+    filter_next(doc, n, result, single);
     if (single && !result.empty()) {
         return;
     }
 
-    if (token.get_type() == json_type::object) {
-        auto &obj = static_cast<json_object &>(token);  // NOLINT
-        for (auto &property : obj) {
-            do_filter(*property.second, result, single);
-            if (single && !result.empty()) {
-                return;
-            }
-        }
-    } else if (token.get_type() == json_type::array) {
-        auto &array = static_cast<json_array &>(token);   // NOLINT
-        for (auto &element : array) {
-            do_filter(*element, result, single);
-            if (single && !result.empty()) {
-                return;
-            }
-        }
+    auto recursive = [&](node child) {
+        filter_impl(doc, child, result, single);
+        return !(single && !result.empty());
+    };
+    if (doc.get_type(n) == json_type::object) {
+        doc.for_each_member(n, recursive);
+    } else if (doc.get_type(n) == json_type::array) {
+        doc.for_each_element(n, recursive);
     }
 }
 
-void json::object_filter::do_filter(json::json_token &token, std::vector<json::json_token *> &result, bool single) noexcept
+DEFINE_FILTER_DOCUMENT_OVERRIDES(recursive_filter)
+
+template<typename Doc>
+void json::object_filter::filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept
 {
-    if (token.get_type() != json_type::object) {
+    if (doc.get_type(n) != json_type::object) {
         return;
     }
 
-    auto &obj = static_cast<json_object &>(token); // NOLINT
-    auto value = obj[property_name];
-    if (value) {
-        filter_next_or_end(*value, result, single);
+    auto value = doc.get_member(n, property_name);
+    if (value != Doc::npos) {
+        filter_next_or_end(doc, value, result, single);
     }
 }
 
-void json::object_multi_filter::do_filter(json::json_token &token, std::vector<json::json_token *> &result, bool single) noexcept
+DEFINE_FILTER_DOCUMENT_OVERRIDES(object_filter)
+
+template<typename Doc>
+void json::object_multi_filter::filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept
 {
-    if (token.get_type() != json_type::object) {
+    if (doc.get_type(n) != json_type::object) {
         return;
     }
 
-    auto &obj = static_cast<json_object &>(token); // NOLINT
     for (const auto &prop_name : property_set) {
-        auto value = obj[prop_name];
-        if (value) {
-            filter_next_or_end(*value, result, single);
+        auto value = doc.get_member(n, prop_name);
+        if (value != Doc::npos) {
+            filter_next_or_end(doc, value, result, single);
             if (single && !result.empty()) {
                 return;
             }
@@ -62,30 +76,34 @@ void json::object_multi_filter::do_filter(json::json_token &token, std::vector<j
     }
 }
 
-void json::array_filter::do_filter(json::json_token &token, std::vector<json::json_token *> &result, bool single) noexcept
+DEFINE_FILTER_DOCUMENT_OVERRIDES(object_multi_filter)
+
+template<typename Doc>
+void json::array_filter::filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept
 {
-    if (token.get_type() != json_type::array) {
+    if (doc.get_type(n) != json_type::array) {
         return;
     }
 
-    auto &array = static_cast<json_array &>(token);   // NOLINT
-    auto value = array.get_value(index);
-    if (value) {
-        filter_next_or_end(*value, result, single);
+    auto value = doc.get_element(n, index);
+    if (value != Doc::npos) {
+        filter_next_or_end(doc, value, result, single);
     }
 }
 
-void json::array_multi_filter::do_filter(json::json_token &token, std::vector<json::json_token *> &result, bool single) noexcept
+DEFINE_FILTER_DOCUMENT_OVERRIDES(array_filter)
+
+template<typename Doc>
+void json::array_multi_filter::filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept
 {
-    if (token.get_type() != json_type::array) {
+    if (doc.get_type(n) != json_type::array) {
         return;
     }
 
-    auto &array = static_cast<json_array &>(token);   // NOLINT
     for (auto index : index_list) {
-        auto value = array.get_value(index);
-        if (value) {
-            filter_next_or_end(*value, result, single);
+        auto value = doc.get_element(n, index);
+        if (value != Doc::npos) {
+            filter_next_or_end(doc, value, result, single);
             if (single && !result.empty()) {
                 return;
             }
@@ -93,113 +111,207 @@ void json::array_multi_filter::do_filter(json::json_token &token, std::vector<js
     }
 }
 
-void json::array_slice_filter::do_filter(json::json_token &token, std::vector<json::json_token *> &result, bool single) noexcept
+DEFINE_FILTER_DOCUMENT_OVERRIDES(array_multi_filter)
+
+template<typename Doc>
+void json::array_slice_filter::filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept
 {
-    if (token.get_type() != json_type::array) {
+    using node = typename Doc::node;
+
+    if (doc.get_type(n) != json_type::array) {
         return;
     }
 
-    auto &array = static_cast<json_array &>(token);   // NOLINT
+    auto size = static_cast<int64_t>(doc.size(n));
     auto s = start;
     if (s < 0) {
-        s += array.size();
+        s += size;
         if (s < 0) {
             s = 0;
         }
     }
     auto e = end;
     if (e < 0) {
-        e += array.size();
+        e += size;
         if (e <= 0) {
             return;
         }
-    } else if (e > array.size()) {
-        e = array.size();
+    } else if (e > size) {
+        e = size;
     }
     if (s >= e) {
         return;
     }
 
-    for (auto i = static_cast<uint64_t>(s), j = static_cast<uint64_t>(e); i < j; i += step) {
-        auto value = array[i];
-        filter_next_or_end(*value, result, single);
+    auto i = static_cast<uint64_t>(s);
+    auto j = static_cast<uint64_t>(e);
+    if (Doc::random_access) {
+        for (; i < j; i += step) {
+            filter_next_or_end(doc, doc.get_element(n, i), result, single);
+            if (single && !result.empty()) {
+                return;
+            }
+            if (i + step < i) {
+                return;     /* roll back */
+            }
+        }
+        return;
+    }
+
+    // walk elements in order, so that documents without random access (tape) are visited only once.
+    uint64_t k = 0;
+    doc.for_each_element(n, [&](node value) {
+        if (k++ != i) {
+            return true;
+        }
+        filter_next_or_end(doc, value, result, single);
         if (single && !result.empty()) {
-            return;
+            return false;
         }
         if (i + step < i) {
-            return;     /* roll back */
+            return false;   /* roll back */
         }
-    }
+        i += step;
+        return i < j;
+    });
 }
 
-void json::object_wildcard_filter::do_filter(json::json_token &token, std::vector<json::json_token *> &result, bool single) noexcept
+DEFINE_FILTER_DOCUMENT_OVERRIDES(array_slice_filter)
+
+template<typename Doc>
+void json::object_wildcard_filter::filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept
 {
-    if (token.get_type() != json_type::object) {
+    using node = typename Doc::node;
+
+    if (doc.get_type(n) != json_type::object) {
         return;
     }
 
-    auto &obj = static_cast<json_object &>(token);      // NOLINT
-    for (auto &property : obj) {
-        filter_next_or_end(*property.second, result, single);
-        if (single && !result.empty()) {
-            return;
-        }
-    }
+    doc.for_each_member(n, [&](node value) {
+        filter_next_or_end(doc, value, result, single);
+        return !(single && !result.empty());
+    });
 }
 
-void json::array_wildcard_filter::do_filter(json::json_token &token, std::vector<json::json_token *> &result, bool single) noexcept
+DEFINE_FILTER_DOCUMENT_OVERRIDES(object_wildcard_filter)
+
+template<typename Doc>
+void json::array_wildcard_filter::filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept
 {
-    if (token.get_type() != json_type::array) {
+    using node = typename Doc::node;
+
+    if (doc.get_type(n) != json_type::array) {
         return;
     }
 
-    auto &array = static_cast<json_array &>(token);     // NOLINT
-    for (auto &element : array) {
-        filter_next_or_end(*element, result, single);
-        if (single && !result.empty()) {
-            return;
-        }
+    doc.for_each_element(n, [&](node element) {
+        filter_next_or_end(doc, element, result, single);
+        return !(single && !result.empty());
+    });
+}
+
+DEFINE_FILTER_DOCUMENT_OVERRIDES(array_wildcard_filter)
+
+template<typename Doc>
+void json::wildcard_filter::filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept
+{
+    using node = typename Doc::node;
+
+    auto each = [&](node child) {
+        filter_next_or_end(doc, child, result, single);
+        return !(single && !result.empty());
+    };
+    if (doc.get_type(n) == json_type::object) {
+        doc.for_each_member(n, each);
+    } else if (doc.get_type(n) == json_type::array) {
+        doc.for_each_element(n, each);
     }
 }
 
-void json::wildcard_filter::do_filter(json::json_token &token, std::vector<json::json_token *> &result, bool single) noexcept
+DEFINE_FILTER_DOCUMENT_OVERRIDES(wildcard_filter)
+
+template<typename Doc>
+void json::pointer_filter::filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept
 {
-    if (token.get_type() == json_type::object) {
-        auto &obj = static_cast<json_object &>(token);  // NOLINT
-        for (auto &property : obj) {
-            filter_next_or_end(*property.second, result, single);
-            if (single && !result.empty()) {
-                return;
-            }
-        }
-    } else if (token.get_type() == json_type::array) {
-        auto &array = static_cast<json_array &>(token); // NOLINT
-        for (auto &element : array) {
-            filter_next_or_end(*element, result, single);
-            if (single && !result.empty()) {
-                return;
-            }
-        }
+    typename Doc::node value = Doc::npos;
+    if (doc.get_type(n) == json_type::object) {
+        value = doc.get_member(n, property_name);
+    } else if (doc.get_type(n) == json_type::array && index != no_index) {
+        value = doc.get_element(n, index);
+    }
+    if (value != Doc::npos) {
+        filter_next_or_end(doc, value, result, single);
     }
 }
 
-void json::script_expr_filter::do_filter(json::json_token &token, std::vector<json::json_token *> &result, bool single) noexcept
+DEFINE_FILTER_DOCUMENT_OVERRIDES(pointer_filter)
+
+template<typename Doc>
+void json::script_expr_filter::filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept
 {
-    //
+    auto type = doc.get_type(n);
+    if (type != json_type::array && type != json_type::object) {
+        return;
+    }
+
+    auto value = expression.evaluate(doc, n);
+    auto child = Doc::npos;
+    if (type == json_type::object) {
+        if (value.type == script_type::string) {
+            child = doc.get_member(n, value.str, value.length);
+        }
+    } else if (value.type == script_type::integer
+               || (value.type == script_type::number && value.float_value == std::trunc(value.float_value)
+                   && std::fabs(value.float_value) < 9.2e18)) {
+        auto index = value.type == script_type::integer ? value.int_value : static_cast<int64_t>(value.float_value);
+        auto size = static_cast<int64_t>(doc.size(n));
+        if (index < 0) {
+            index += size;
+        }
+        if (index >= 0 && index < size) {
+            child = doc.get_element(n, static_cast<size_t>(index));
+        }
+    }
+    if (child != Doc::npos) {
+        filter_next_or_end(doc, child, result, single);
+    }
 }
 
-void json::array_filter_script::do_filter(json::json_token &token, std::vector<json::json_token *> &result, bool single) noexcept
+DEFINE_FILTER_DOCUMENT_OVERRIDES(script_expr_filter)
+
+template<typename Doc>
+void json::array_filter_script::filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept
 {
+    using node = typename Doc::node;
 
+    auto each = [&](node child) {
+        if (expression.test(doc, child)) {
+            filter_next_or_end(doc, child, result, single);
+        }
+        return !(single && !result.empty());
+    };
+    if (doc.get_type(n) == json_type::object) {
+        doc.for_each_member(n, each);
+    } else if (doc.get_type(n) == json_type::array) {
+        doc.for_each_element(n, each);
+    }
 }
 
+DEFINE_FILTER_DOCUMENT_OVERRIDES(array_filter_script)
+
 
 std::unique_ptr<json::filter_base> json::parse_expr_script(const char **path)
 {
     const char *start = *path;
     assert(*start == '(');
 
-    return nullptr;
+    script_expression expression;
+    bool compiled = expression.compile(&start);
+    *path = start;
+    if (!compiled) {
+        return nullptr;
+    }
+    return std::unique_ptr<filter_base>(new script_expr_filter(std::move(expression)));
 }
 
 std::unique_ptr<json::filter_base> json::parse_filter_script(const char **path)
@@ -207,6 +319,17 @@ std::unique_ptr<json::filter_base> json::parse_filter_script(const char **path)
     const char *start = *path;
     assert(*start == '?');
 
-    return nullptr;
+    start = skip_whitespace(start, 1);
+    if (*start != '(') {
+        *path = start;
+        return nullptr;
+    }
+    script_expression expression;
+    bool compiled = expression.compile(&start);
+    *path = start;
+    if (!compiled) {
+        return nullptr;
+    }
+    return std::unique_ptr<filter_base>(new array_filter_script(std::move(expression)));
 }
 
@@ -7,10 +7,212 @@
 
 #include <list>
 #include <limits>
+#include <algorithm>
+#include <regex>
 #include "JSON.hpp"
+#include "JSONTape.hpp"
 
 namespace json {
 
+/**
+ * accessors used by filters to walk the pointer-linked {@code json_token} document.
+ */
+struct token_document
+{
+    using node = json_token *;
+    using result = std::vector<json_token *>;
+
+    static constexpr json_token *npos = nullptr;
+    static constexpr bool random_access = true;
+
+    json_type get_type(node n) const noexcept
+    {
+        return n->get_type();
+    }
+
+    node get_member(node obj, const std::string &name) const noexcept
+    {
+        return static_cast<json_object *>(obj)->get_value(name);  // NOLINT
+    }
+
+    node get_member(node obj, const char *name, size_t length) const
+    {
+        return static_cast<json_object *>(obj)->get_value(std::string(name, length));  // NOLINT
+    }
+
+    size_t size(node ary) const noexcept
+    {
+        return static_cast<json_array *>(ary)->size();    // NOLINT
+    }
+
+    node get_element(node ary, size_t index) const noexcept
+    {
+        return static_cast<json_array *>(ary)->get_value(index);  // NOLINT
+    }
+
+    bool get_bool(node n) const noexcept
+    {
+        return static_cast<bool>(*static_cast<json_bool_value *>(n));  // NOLINT
+    }
+
+    bool is_float(node n) const noexcept
+    {
+        return static_cast<json_number_value *>(n)->is_float_value();  // NOLINT
+    }
+
+    int64_t get_int(node n) const noexcept
+    {
+        return static_cast<int64_t>(*static_cast<json_number_value *>(n));    // NOLINT
+    }
+
+    double get_double(node n) const noexcept
+    {
+        return static_cast<double>(*static_cast<json_number_value *>(n));     // NOLINT
+    }
+
+    const char *string_data(node n) const noexcept
+    {
+        return static_cast<const json_string_value *>(n)->value().data();     // NOLINT
+    }
+
+    size_t string_size(node n) const noexcept
+    {
+        return static_cast<const json_string_value *>(n)->value().size();     // NOLINT
+    }
+
+    /**
+     * call {@code f(value)} on each member value of object, stop when {@code f} returns false.
+     */
+    template<typename F>
+    void for_each_member(node obj, F &&f) const
+    {
+        for (auto &property : *static_cast<json_object *>(obj)) {   // NOLINT
+            if (!f(property.second.get())) {
+                return;
+            }
+        }
+    }
+
+    /**
+     * call {@code f(element)} on each element of array, stop when {@code f} returns false.
+     */
+    template<typename F>
+    void for_each_element(node ary, F &&f) const
+    {
+        for (auto &element : *static_cast<json_array *>(ary)) {   // NOLINT
+            if (!f(element.get())) {
+                return;
+            }
+        }
+    }
+};
+
+/**
+ * accessors used by filters to walk the tape-format document. a node is the index of a value in the tape.
+ */
+struct tape_document
+{
+    using node = size_t;
+    using result = std::vector<size_t>;
+
+    static constexpr size_t npos = json_tape_view::npos;
+    static constexpr bool random_access = false;
+
+    const json_tape_view &tape;
+
+    explicit tape_document(const json_tape_view &t) noexcept : tape(t) { }
+
+    json_type get_type(node n) const noexcept
+    {
+        return tape.get_type(n);
+    }
+
+    node get_member(node obj, const std::string &name) const noexcept
+    {
+        return tape.find(obj, name);
+    }
+
+    node get_member(node obj, const char *name, size_t length) const noexcept
+    {
+        return tape.find(obj, name, length);
+    }
+
+    size_t size(node ary) const noexcept
+    {
+        return tape.size(ary);
+    }
+
+    node get_element(node ary, size_t index) const noexcept
+    {
+        return tape.at(ary, index);
+    }
+
+    bool get_bool(node n) const noexcept
+    {
+        return tape.get_bool(n);
+    }
+
+    bool is_float(node n) const noexcept
+    {
+        return tape.is_float(n);
+    }
+
+    int64_t get_int(node n) const noexcept
+    {
+        return tape.get_int(n);
+    }
+
+    double get_double(node n) const noexcept
+    {
+        return tape.get_double(n);
+    }
+
+    const char *string_data(node n) const noexcept
+    {
+        return tape.string_data(n);
+    }
+
+    size_t string_size(node n) const noexcept
+    {
+        return tape.string_size(n);
+    }
+
+    template<typename F>
+    void for_each_member(node obj, F &&f) const
+    {
+        for (size_t i = tape.begin(obj), e = tape.end(obj); i < e; i = tape.next(i + 1)) {
+            if (!f(i + 1)) {
+                return;
+            }
+        }
+    }
+
+    template<typename F>
+    void for_each_element(node ary, F &&f) const
+    {
+        for (size_t i = tape.begin(ary), e = tape.end(ary); i < e; i = tape.next(i)) {
+            if (!f(i)) {
+                return;
+            }
+        }
+    }
+};
+
+inline void add_result(std::vector<json_token *> &result, json_token *n)
+{
+    result.push_back(n);
+}
+
+inline void add_result(std::vector<size_t> &result, size_t n)
+{
+    result.push_back(n);
+}
+
+/**
+ * base class of the filter chain. a filter implements {@code filter_impl} once as a template over the
+ * document accessors ({@code token_document} or {@code tape_document}), and both virtual {@code do_filter}
+ * overloads forward to it.
+ */
 class filter_base
 {
     std::unique_ptr<filter_base> next;
@@ -19,22 +221,30 @@ protected:
     /**
      * only check if next is exist. if exist, call it.
      */
-    void filter_next(json_token &token, std::vector<json_token *> &result, bool single) noexcept
+    void filter_next(const token_document &, json_token *token, std::vector<json_token *> &result, bool single) noexcept
     {
         if (next) {
-            next->filter(token, result, single);
+            next->filter(*token, result, single);
+        }
+    }
+
+    void filter_next(const tape_document &doc, size_t index, std::vector<size_t> &result, bool single) noexcept
+    {
+        if (next) {
+            next->filter(doc.tape, index, result, single);
         }
     }
 
     /**
      * call next filter if it is not null, otherwise end filter and add result.
      */
-    void filter_next_or_end(json_token &token, std::vector<json_token *> &result, bool single) noexcept
+    template<typename Doc>
+    void filter_next_or_end(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept
     {
         if (next) {
-            next->filter(token, result, single);
+            filter_next(doc, n, result, single);
         } else {
-            result.push_back(&token);
+            add_result(result, n);
         }
     }
 
@@ -43,9 +253,42 @@ protected:
      */
     virtual void do_filter(json_token &token, std::vector<json_token *> &result, bool single) noexcept = 0;
 
+    virtual void do_filter(const json_tape_view &tape, size_t index, std::vector<size_t> &result, bool single) noexcept = 0;
+
 public:
+    /**
+     * how a child of the filtered value is selected by the filter, used by projection parsing.
+     */
+    enum class projection
+    {
+        none,   // never selected.
+        next,   // may be selected, and the next filter decides which of its children are selected.
+        whole   // the whole subtree may be selected.
+    };
+
     filter_base() = default;
 
+    /**
+     * test the object member with name {@code key}. the default is to select the whole subtree.
+     */
+    virtual projection project_member(const std::string &) const noexcept
+    {
+        return projection::whole;
+    }
+
+    /**
+     * test the array element at {@code index}. the default is to select the whole subtree.
+     */
+    virtual projection project_element(uint64_t) const noexcept
+    {
+        return projection::whole;
+    }
+
+    const filter_base *next_filter() const noexcept
+    {
+        return next.get();
+    }
+
     filter_base *set_next_filter(std::unique_ptr<filter_base> &&filter) noexcept
     {
         next = std::move(filter);
@@ -62,16 +305,29 @@ public:
         do_filter(token, result, single);
     }
 
+    void filter(const json_tape_view &tape, size_t index, std::vector<size_t> &result, bool single) noexcept
+    {
+        do_filter(tape, index, result, single);
+    }
+
     virtual ~filter_base() = default;
 };
 
+#define FILTER_DOCUMENT_OVERRIDES \
+    void do_filter(json_token &token, std::vector<json_token *> &result, bool single) noexcept override; \
+    void do_filter(const json_tape_view &tape, size_t index, std::vector<size_t> &result, bool single) noexcept override;
+
 /**
  * recursive descent filter. run filter on self and descendant node. syntax: .. (e.g. ..prop_name or ..[...])
  */
 class recursive_filter final : public filter_base
 {
 protected:
-    void do_filter(json_token &token, std::vector<json_token *> &result, bool single) noexcept override;
+    FILTER_DOCUMENT_OVERRIDES
+
+private:
+    template<typename Doc>
+    void filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept;
 };
 
 /**
@@ -84,8 +340,22 @@ class object_filter final : public filter_base
 public:
     explicit object_filter(std::string &&name) noexcept : property_name(std::move(name)) { }
 
+    projection project_member(const std::string &key) const noexcept override
+    {
+        return key == property_name ? projection::next : projection::none;
+    }
+
+    projection project_element(uint64_t) const noexcept override
+    {
+        return projection::none;
+    }
+
 protected:
-    void do_filter(json_token &token, std::vector<json_token *> &result, bool single) noexcept override;
+    FILTER_DOCUMENT_OVERRIDES
+
+private:
+    template<typename Doc>
+    void filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept;
 };
 
 /**
@@ -98,8 +368,22 @@ class object_multi_filter final : public filter_base
 public:
     explicit object_multi_filter(std::list<std::string> &&prop_set) noexcept : property_set(std::move(prop_set)) { }
 
+    projection project_member(const std::string &key) const noexcept override
+    {
+        return std::find(property_set.begin(), property_set.end(), key) != property_set.end() ? projection::next : projection::none;
+    }
+
+    projection project_element(uint64_t) const noexcept override
+    {
+        return projection::none;
+    }
+
 protected:
-    void do_filter(json_token &token, std::vector<json_token *> &result, bool single) noexcept override;
+    FILTER_DOCUMENT_OVERRIDES
+
+private:
+    template<typename Doc>
+    void filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept;
 };
 
 /**
@@ -112,8 +396,22 @@ class array_filter final : public filter_base
 public:
     explicit array_filter(uint64_t i) noexcept : index(i) { }
 
+    projection project_member(const std::string &) const noexcept override
+    {
+        return projection::none;
+    }
+
+    projection project_element(uint64_t i) const noexcept override
+    {
+        return i == index ? projection::next : projection::none;
+    }
+
 protected:
-    void do_filter(json_token &token, std::vector<json_token *> &result, bool single) noexcept override;
+    FILTER_DOCUMENT_OVERRIDES
+
+private:
+    template<typename Doc>
+    void filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept;
 };
 
 /**
@@ -126,8 +424,22 @@ class array_multi_filter final : public filter_base
 public:
     explicit array_multi_filter(std::vector<uint64_t> &&idx) noexcept : index_list(std::move(idx)) { }
 
+    projection project_member(const std::string &) const noexcept override
+    {
+        return projection::none;
+    }
+
+    projection project_element(uint64_t i) const noexcept override
+    {
+        return std::find(index_list.begin(), index_list.end(), i) != index_list.end() ? projection::next : projection::none;
+    }
+
 protected:
-    void do_filter(json_token &token, std::vector<json_token *> &result, bool single) noexcept override;
+    FILTER_DOCUMENT_OVERRIDES
+
+private:
+    template<typename Doc>
+    void filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept;
 };
 
 /**
@@ -143,8 +455,26 @@ public:
     explicit array_slice_filter(int64_t s = 0, int64_t e = std::numeric_limits<int64_t>::max(), uint64_t st = 1) noexcept
             : start(s), end(e), step(st > 0 ? st : 1) { }
 
+    projection project_member(const std::string &) const noexcept override
+    {
+        return projection::none;
+    }
+
+    projection project_element(uint64_t i) const noexcept override
+    {
+        if (start < 0 || end < 0) {
+            return projection::next;    // array size is unknown while parsing.
+        }
+        auto s = static_cast<uint64_t>(start);
+        return i >= s && i < static_cast<uint64_t>(end) && (i - s) % step == 0 ? projection::next : projection::none;
+    }
+
 protected:
-    void do_filter(json_token &token, std::vector<json_token *> &result, bool single) noexcept override;
+    FILTER_DOCUMENT_OVERRIDES
+
+private:
+    template<typename Doc>
+    void filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept;
 };
 
 /**
@@ -152,8 +482,23 @@ protected:
  */
 class object_wildcard_filter final : public filter_base
 {
+public:
+    projection project_member(const std::string &) const noexcept override
+    {
+        return projection::next;
+    }
+
+    projection project_element(uint64_t) const noexcept override
+    {
+        return projection::none;
+    }
+
 protected:
-    void do_filter(json_token &token, std::vector<json_token *> &result, bool single) noexcept override;
+    FILTER_DOCUMENT_OVERRIDES
+
+private:
+    template<typename Doc>
+    void filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept;
 };
 
 /**
@@ -161,8 +506,23 @@ protected:
  */
 class array_wildcard_filter final : public filter_base
 {
+public:
+    projection project_member(const std::string &) const noexcept override
+    {
+        return projection::none;
+    }
+
+    projection project_element(uint64_t) const noexcept override
+    {
+        return projection::next;
+    }
+
 protected:
-    void do_filter(json_token &token, std::vector<json_token *> &result, bool single) noexcept override;
+    FILTER_DOCUMENT_OVERRIDES
+
+private:
+    template<typename Doc>
+    void filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept;
 };
 
 /**
@@ -170,28 +530,250 @@ protected:
  */
 class wildcard_filter final : public filter_base
 {
+public:
+    projection project_member(const std::string &) const noexcept override
+    {
+        return projection::next;
+    }
+
+    projection project_element(uint64_t) const noexcept override
+    {
+        return projection::next;
+    }
+
 protected:
-    void do_filter(json_token &token, std::vector<json_token *> &result, bool single) noexcept override;
+    FILTER_DOCUMENT_OVERRIDES
+
+private:
+    template<typename Doc>
+    void filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept;
 };
 
 /**
- * filter by script expression, not support currently. syntax: [(expr)] in any notation
+ * filter of a json pointer (RFC 6901) reference token, e.g. {@code a} or {@code 0} of {@code /a/0}. it selects the
+ * object member named by the token, or the array element if the token is an array index without leading zeros.
+ */
+class pointer_filter final : public filter_base
+{
+    const std::string property_name;
+    const uint64_t index;
+
+public:
+    static constexpr uint64_t no_index = std::numeric_limits<uint64_t>::max();
+
+    pointer_filter(std::string &&name, uint64_t i) noexcept : property_name(std::move(name)), index(i) { }
+
+    projection project_member(const std::string &key) const noexcept override
+    {
+        return key == property_name ? projection::next : projection::none;
+    }
+
+    projection project_element(uint64_t i) const noexcept override
+    {
+        return index != no_index && i == index ? projection::next : projection::none;
+    }
+
+protected:
+    FILTER_DOCUMENT_OVERRIDES
+
+private:
+    template<typename Doc>
+    void filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept;
+};
+
+/**
+ * type of the value of script expression.
+ */
+enum class script_type : uint8_t
+{
+    nothing,    // path which does not exist, or result of invalid operation.
+    null,
+    boolean,
+    integer,
+    number,
+    string,
+    node        // object or array in the document.
+};
+
+/**
+ * value of script expression. a string refers to the document or the compiled expression, and an object or array is
+ * referred by its node, so evaluating expression does not allocate memory.
+ */
+template<typename Node>
+struct script_value
+{
+    script_type type = script_type::nothing;
+    bool bool_value = false;
+    int64_t int_value = 0;
+    double float_value = 0;
+    const char *str = nullptr;
+    size_t length = 0;
+    Node node = Node();
+};
+
+/**
+ * compiled expression of script syntaxes. the expression is kept as a tree of operations in a flat array, and is
+ * evaluated on a value of document, which is {@code @} in the expression.
+ *
+ * operators from low to high precedence: {@code ||}, {@code &&}, comparisons ({@code == != < <= > >=}, {@code =~}
+ * with a /regex/ or /regex/i literal, {@code in} and {@code nin} with a [list] literal or an array), {@code + -},
+ * {@code * / %}, and unary {@code ! -}. operands are numbers, 'string' or "string", true, false, null, expressions
+ * in parentheses, and relative paths such as {@code @.name}, {@code @['name']} and {@code @[0]}. {@code .length}
+ * of an array or a string is its size.
+ *
+ * operations on constants are folded when compiling. a path which does not exist equals only another missing path,
+ * numbers compare by value and strings by bytes, objects and arrays are never equal to anything.
+ */
+class script_expression
+{
+public:
+    /**
+     * compile the expression in parentheses.
+     * @param expr in out param, points to '(', and is moved to the char after the matched ')' on success, or to
+     * where parsing stopped on failure.
+     * @return false if the expression has syntax error.
+     */
+    bool compile(const char **expr);
+
+    /**
+     * evaluate the expression on value {@code n}.
+     */
+    template<typename Doc>
+    script_value<typename Doc::node> evaluate(const Doc &doc, typename Doc::node n) const noexcept;
+
+    /**
+     * evaluate the expression on value {@code n} as a condition. a path is true if it exists, other values are
+     * true unless they are false, null, 0 or empty string.
+     */
+    template<typename Doc>
+    bool test(const Doc &doc, typename Doc::node n) const noexcept;
+
+private:
+    friend class script_parser;
+
+    enum class opcode : uint8_t
+    {
+        literal,    // left: literal index
+        path,       // left: first step, right: step count
+        exists,     // left: path operation
+        list,       // left: first literal, right: literal count
+        logical_not,
+        negate,
+        logical_and,
+        logical_or,
+        equal,
+        not_equal,
+        less,
+        less_equal,
+        greater,
+        greater_equal,
+        in,         // right: list or path operation
+        not_in,
+        match,      // right: pattern index
+        add,
+        subtract,
+        multiply,
+        divide,
+        modulo
+    };
+
+    struct operation
+    {
+        opcode code;
+        uint32_t left;
+        uint32_t right;
+    };
+
+    struct literal
+    {
+        script_type type;
+        bool bool_value;
+        int64_t int_value;
+        double float_value;
+        std::string text;
+    };
+
+    struct step
+    {
+        std::string name;
+        uint64_t index;
+        bool by_index;
+    };
+
+    template<typename Doc>
+    script_value<typename Doc::node> eval(const Doc &doc, typename Doc::node n, uint32_t index) const noexcept;
+
+    template<typename Doc>
+    script_value<typename Doc::node> eval_path(const Doc &doc, typename Doc::node n, const operation &op) const noexcept;
+
+    template<typename Doc>
+    bool contains(const Doc &doc, typename Doc::node n, const operation &op) const noexcept;
+
+    std::vector<operation> operations;
+    std::vector<literal> literals;
+    std::vector<step> steps;
+    std::vector<std::regex> patterns;
+    uint32_t root = 0;
+};
+
+/**
+ * filter by script expression, which is evaluated on the array or object. an integer result selects the element at
+ * the index (a negative index counts from the end), and a string result selects the member with the name.
+ * syntax: [(expr)] in any notation, such as [(@.length-1)].
  */
 class script_expr_filter final : public filter_base
 {
+    const script_expression expression;
+
+public:
+    explicit script_expr_filter(script_expression &&expr) noexcept : expression(std::move(expr)) { }
+
 protected:
-    void do_filter(json_token &token, std::vector<json_token *> &result, bool single) noexcept override;
+    FILTER_DOCUMENT_OVERRIDES
+
+private:
+    template<typename Doc>
+    void filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept;
 };
 
 /**
- * filter array by test each child in array. syntax: [?(expr)]
+ * filter array elements or object member values by testing each of them with expression. syntax: [?(expr)]
  */
 class array_filter_script final : public filter_base
 {
+    const script_expression expression;
+
+public:
+    explicit array_filter_script(script_expression &&expr) noexcept : expression(std::move(expr)) { }
+
 protected:
-    void do_filter(json_token &token, std::vector<json_token *> &result, bool single) noexcept override;
+    FILTER_DOCUMENT_OVERRIDES
+
+private:
+    template<typename Doc>
+    void filter_impl(const Doc &doc, typename Doc::node n, typename Doc::result &result, bool single) noexcept;
 };
 
+/**
+ * parse json-path string to a filter chain.
+ * @param error_offset out param, offset where parsing stopped because of syntax error, only set when it fails.
+ * {@code nullptr} can be passed.
+ * @return the first filter of the chain, or {@code nullptr} if the path is empty or has syntax error.
+ */
+std::unique_ptr<filter_base> parse_filter(const char *path, size_t *error_offset = nullptr);
+
+/**
+ * parse json pointer (RFC 6901) string such as {@code /hits/hits/0/_id} to a filter chain. {@code ~1} and {@code ~0}
+ * in a token are unescaped to '/' and '~'.
+ * @param error_offset out param, offset of the invalid escape sequence, only set when it fails. {@code nullptr} can be
+ * passed.
+ * @return the first filter of the chain, or {@code nullptr} if the pointer does not start with '/' or has syntax error.
+ */
+std::unique_ptr<filter_base> parse_pointer(const char *pointer, size_t *error_offset = nullptr);
+
+/**
+ * parse script syntax {@code (...)} and {@code ?(...)}. on failure, {@code *path} is moved to where parsing stopped.
+ */
 std::unique_ptr<filter_base> parse_expr_script(const char **path);
 
 std::unique_ptr<filter_base> parse_filter_script(const char **path);
@@ -0,0 +1,928 @@
+//
+// Created by Charles on 2018/7/27.
+//
+
+#include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include "JSONQueryFilter.hpp"
+#include "JSONUtils.hpp"
+
+using namespace json;
+
+namespace {
+
+// nesting limit of parentheses and unary operators, to bound the recursion of parser and evaluator.
+constexpr int MaxScriptDepth = 64;
+
+template<typename Node>
+inline script_value<Node> make_bool(bool b) noexcept
+{
+    script_value<Node> v;
+    v.type = script_type::boolean;
+    v.bool_value = b;
+    return v;
+}
+
+template<typename Node>
+inline script_value<Node> make_int(int64_t i) noexcept
+{
+    script_value<Node> v;
+    v.type = script_type::integer;
+    v.int_value = i;
+    return v;
+}
+
+template<typename Node>
+inline script_value<Node> make_float(double d) noexcept
+{
+    script_value<Node> v;
+    v.type = script_type::number;
+    v.float_value = d;
+    return v;
+}
+
+template<typename Node>
+inline bool is_number(const script_value<Node> &v) noexcept
+{
+    return v.type == script_type::integer || v.type == script_type::number;
+}
+
+template<typename Node>
+inline double to_double(const script_value<Node> &v) noexcept
+{
+    return v.type == script_type::integer ? static_cast<double>(v.int_value) : v.float_value;
+}
+
+template<typename Node>
+bool truthy(const script_value<Node> &v) noexcept
+{
+    switch (v.type) {
+        case script_type::boolean:
+            return v.bool_value;
+        case script_type::integer:
+            return v.int_value != 0;
+        case script_type::number:
+            return v.float_value != 0;
+        case script_type::string:
+            return v.length > 0;
+        case script_type::node:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * convert value of document to script value, strings are not copied.
+ */
+template<typename Doc>
+script_value<typename Doc::node> node_value(const Doc &doc, typename Doc::node n) noexcept
+{
+    script_value<typename Doc::node> v;
+    switch (doc.get_type(n)) {
+        case json_type::object:
+        case json_type::array:
+            v.type = script_type::node;
+            v.node = n;
+            break;
+        case json_type::string:
+            v.type = script_type::string;
+            v.str = doc.string_data(n);
+            v.length = doc.string_size(n);
+            break;
+        case json_type::number:
+            if (doc.is_float(n)) {
+                v.type = script_type::number;
+                v.float_value = doc.get_double(n);
+            } else {
+                v.type = script_type::integer;
+                v.int_value = doc.get_int(n);
+            }
+            break;
+        case json_type::boolean:
+            v.type = script_type::boolean;
+            v.bool_value = doc.get_bool(n);
+            break;
+        case json_type::null:
+            v.type = script_type::null;
+            break;
+    }
+    return v;
+}
+
+/**
+ * result of comparing two script values.
+ */
+enum class ordering
+{
+    less,
+    equal,
+    greater,
+    unequal,    // different values without order, such as true and false.
+    unordered   // values can not be compared, such as string and number, or NaN.
+};
+
+template<typename Node>
+ordering compare_values(const script_value<Node> &a, const script_value<Node> &b) noexcept
+{
+    if (is_number(a) && is_number(b)) {
+        if (a.type == script_type::integer && b.type == script_type::integer) {
+            return a.int_value < b.int_value ? ordering::less : a.int_value > b.int_value ? ordering::greater
+                                                                                            : ordering::equal;
+        }
+        auto x = to_double(a);
+        auto y = to_double(b);
+        return x < y ? ordering::less : x > y ? ordering::greater : x == y ? ordering::equal : ordering::unordered;
+    }
+    if (a.type != b.type) {
+        return ordering::unordered;
+    }
+    switch (a.type) {
+        case script_type::nothing:
+        case script_type::null:
+            return ordering::equal;
+        case script_type::boolean:
+            return a.bool_value == b.bool_value ? ordering::equal : ordering::unequal;
+        case script_type::string: {
+            auto r = std::memcmp(a.str, b.str, a.length < b.length ? a.length : b.length);
+            if (r == 0) {
+                r = a.length < b.length ? -1 : a.length > b.length ? 1 : 0;
+            }
+            return r < 0 ? ordering::less : r > 0 ? ordering::greater : ordering::equal;
+        }
+        default:
+            return ordering::unordered;
+    }
+}
+
+template<typename Node>
+script_value<Node> arithmetic(const script_value<Node> &a, const script_value<Node> &b, char op) noexcept
+{
+    if (!is_number(a) || !is_number(b)) {
+        return script_value<Node>();
+    }
+    if (a.type == script_type::integer && b.type == script_type::integer) {
+        int64_t x = a.int_value;
+        int64_t y = b.int_value;
+        int64_t r;
+        switch (op) {
+            case '+':
+                if (!__builtin_add_overflow(x, y, &r)) {
+                    return make_int<Node>(r);
+                }
+                break;
+            case '-':
+                if (!__builtin_sub_overflow(x, y, &r)) {
+                    return make_int<Node>(r);
+                }
+                break;
+            case '*':
+                if (!__builtin_mul_overflow(x, y, &r)) {
+                    return make_int<Node>(r);
+                }
+                break;
+            case '/':
+                if (y == 0) {
+                    return script_value<Node>();
+                }
+                if (y != -1 && x % y == 0) {
+                    return make_int<Node>(x / y);
+                }
+                break;
+            default:
+                if (y == 0) {
+                    return script_value<Node>();
+                }
+                return make_int<Node>(y == -1 ? 0 : x % y);
+        }
+    }
+
+    auto x = to_double(a);
+    auto y = to_double(b);
+    switch (op) {
+        case '+':
+            return make_float<Node>(x + y);
+        case '-':
+            return make_float<Node>(x - y);
+        case '*':
+            return make_float<Node>(x * y);
+        case '/':
+            return y == 0 ? script_value<Node>() : make_float<Node>(x / y);
+        default:
+            return y == 0 ? script_value<Node>() : make_float<Node>(std::fmod(x, y));
+    }
+}
+
+/**
+ * convert literal of compiled expression to script value, a string refers to the literal.
+ */
+template<typename Node, typename Literal>
+script_value<Node> literal_value(const Literal &l) noexcept
+{
+    script_value<Node> v;
+    v.type = l.type;
+    v.bool_value = l.bool_value;
+    v.int_value = l.int_value;
+    v.float_value = l.float_value;
+    v.str = l.text.data();
+    v.length = l.text.size();
+    return v;
+}
+
+/**
+ * unlike keys in dot-notation, '-' is not a name char in expression, so that {@code @.length-1} is a subtraction.
+ * such keys can be accessed by {@code @['key-name']}.
+ */
+inline bool is_name_char(char c)
+{
+    return std::isalnum(c) || c == '_';
+}
+
+}
+
+template<typename Doc>
+script_value<typename Doc::node> script_expression::eval_path(const Doc &doc, typename Doc::node n,
+                                                              const operation &op) const noexcept
+{
+    using node = typename Doc::node;
+
+    for (uint32_t i = op.left, e = op.left + op.right; i < e; ++i) {
+        const auto &s = steps[i];
+        auto type = doc.get_type(n);
+        if (s.by_index) {
+            n = type == json_type::array ? doc.get_element(n, static_cast<size_t>(s.index)) : Doc::npos;
+        } else if (type == json_type::object) {
+            n = doc.get_member(n, s.name);
+        } else if (i + 1 == e && s.name == "length" && type == json_type::array) {
+            return make_int<node>(static_cast<int64_t>(doc.size(n)));
+        } else if (i + 1 == e && s.name == "length" && type == json_type::string) {
+            return make_int<node>(static_cast<int64_t>(doc.string_size(n)));
+        } else {
+            n = Doc::npos;
+        }
+        if (n == Doc::npos) {
+            return script_value<node>();
+        }
+    }
+    return node_value(doc, n);
+}
+
+template<typename Doc>
+bool script_expression::contains(const Doc &doc, typename Doc::node n, const operation &op) const noexcept
+{
+    using node = typename Doc::node;
+
+    auto value = eval(doc, n, op.left);
+    const auto &right = operations[op.right];
+    if (right.code == opcode::list) {
+        for (uint32_t i = right.left, e = right.left + right.right; i < e; ++i) {
+            if (compare_values(value, literal_value<node>(literals[i])) == ordering::equal) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    auto list = eval(doc, n, op.right);
+    if (list.type != script_type::node || doc.get_type(list.node) != json_type::array) {
+        return false;
+    }
+    bool found = false;
+    doc.for_each_element(list.node, [&](node element) {
+        found = compare_values(value, node_value(doc, element)) == ordering::equal;
+        return !found;
+    });
+    return found;
+}
+
+template<typename Doc>
+script_value<typename Doc::node> script_expression::eval(const Doc &doc, typename Doc::node n,
+                                                         uint32_t index) const noexcept
+{
+    using node = typename Doc::node;
+
+    const auto &op = operations[index];
+    switch (op.code) {
+        case opcode::literal:
+            return literal_value<node>(literals[op.left]);
+        case opcode::path:
+            return eval_path(doc, n, op);
+        case opcode::exists:
+            return make_bool<node>(eval_path(doc, n, operations[op.left]).type != script_type::nothing);
+        case opcode::list:
+            return script_value<node>();
+        case opcode::logical_not:
+            return make_bool<node>(!truthy(eval(doc, n, op.left)));
+        case opcode::negate: {
+            auto v = eval(doc, n, op.left);
+            if (v.type == script_type::integer && v.int_value != std::numeric_limits<int64_t>::min()) {
+                return make_int<node>(-v.int_value);
+            }
+            return is_number(v) ? make_float<node>(-to_double(v)) : script_value<node>();
+        }
+        case opcode::logical_and:
+            return make_bool<node>(truthy(eval(doc, n, op.left)) && truthy(eval(doc, n, op.right)));
+        case opcode::logical_or:
+            return make_bool<node>(truthy(eval(doc, n, op.left)) || truthy(eval(doc, n, op.right)));
+        case opcode::equal:
+        case opcode::not_equal: {
+            auto r = compare_values(eval(doc, n, op.left), eval(doc, n, op.right));
+            return make_bool<node>((r == ordering::equal) == (op.code == opcode::equal));
+        }
+        case opcode::less:
+            return make_bool<node>(compare_values(eval(doc, n, op.left), eval(doc, n, op.right)) == ordering::less);
+        case opcode::less_equal: {
+            auto r = compare_values(eval(doc, n, op.left), eval(doc, n, op.right));
+            return make_bool<node>(r == ordering::less || r == ordering::equal);
+        }
+        case opcode::greater:
+            return make_bool<node>(compare_values(eval(doc, n, op.left), eval(doc, n, op.right)) == ordering::greater);
+        case opcode::greater_equal: {
+            auto r = compare_values(eval(doc, n, op.left), eval(doc, n, op.right));
+            return make_bool<node>(r == ordering::greater || r == ordering::equal);
+        }
+        case opcode::in:
+            return make_bool<node>(contains(doc, n, op));
+        case opcode::not_in:
+            return make_bool<node>(!contains(doc, n, op));
+        case opcode::match: {
+            auto v = eval(doc, n, op.left);
+            if (v.type != script_type::string) {
+                return make_bool<node>(false);
+            }
+            try {
+                return make_bool<node>(std::regex_search(v.str, v.str + v.length, patterns[op.right]));
+            } catch (...) {
+                return make_bool<node>(false);  // regex_error of complexity or stack.
+            }
+        }
+        case opcode::add:
+            return arithmetic(eval(doc, n, op.left), eval(doc, n, op.right), '+');
+        case opcode::subtract:
+            return arithmetic(eval(doc, n, op.left), eval(doc, n, op.right), '-');
+        case opcode::multiply:
+            return arithmetic(eval(doc, n, op.left), eval(doc, n, op.right), '*');
+        case opcode::divide:
+            return arithmetic(eval(doc, n, op.left), eval(doc, n, op.right), '/');
+        case opcode::modulo:
+            return arithmetic(eval(doc, n, op.left), eval(doc, n, op.right), '%');
+    }
+    return script_value<node>();
+}
+
+template<typename Doc>
+script_value<typename Doc::node> script_expression::evaluate(const Doc &doc, typename Doc::node n) const noexcept
+{
+    return eval(doc, n, root);
+}
+
+template<typename Doc>
+bool script_expression::test(const Doc &doc, typename Doc::node n) const noexcept
+{
+    const auto &op = operations[root];
+    if (op.code == opcode::path) {
+        return eval_path(doc, n, op).type != script_type::nothing;
+    }
+    return truthy(eval(doc, n, root));
+}
+
+template script_value<json_token *> script_expression::evaluate<token_document>(const token_document &doc, json_token *n) const noexcept;
+template script_value<size_t> script_expression::evaluate<tape_document>(const tape_document &doc, size_t n) const noexcept;
+template bool script_expression::test<token_document>(const token_document &doc, json_token *n) const noexcept;
+template bool script_expression::test<tape_document>(const tape_document &doc, size_t n) const noexcept;
+
+namespace json {
+
+/**
+ * recursive descent parser of script expression. operations are appended in post order, so the operations of a
+ * subexpression are contiguous and end with its root. each parse method reads a subexpression at {@code cur} and
+ * returns index of its root operation in {@code index}, or false if there is syntax error.
+ */
+class script_parser
+{
+public:
+    script_parser(script_expression &e, const char *str) noexcept : expr(e), cur(str), depth(0) { }
+
+    bool parse_or(uint32_t &index);
+
+    const char *position() const noexcept
+    {
+        return cur;
+    }
+
+private:
+    using opcode = script_expression::opcode;
+
+    bool parse_and(uint32_t &index);
+
+    bool parse_comparison(uint32_t &index);
+
+    bool parse_additive(uint32_t &index);
+
+    bool parse_multiplicative(uint32_t &index);
+
+    bool parse_unary(uint32_t &index);
+
+    bool parse_primary(uint32_t &index);
+
+    bool parse_path(uint32_t &index);
+
+    bool parse_number(uint32_t &index);
+
+    bool parse_list(uint32_t &index);
+
+    bool parse_regex(uint32_t &index);
+
+    /**
+     * check keyword {@code word} at current position, and skip it if it matches.
+     */
+    bool accept_keyword(const char *word) noexcept;
+
+    uint32_t add_operation(opcode code, uint32_t left, uint32_t right);
+
+    uint32_t add_literal(script_type type, bool b = false, int64_t i = 0, double d = 0, std::string &&text = std::string());
+
+    /**
+     * use path as condition, which tests whether the path exists.
+     */
+    uint32_t condition(uint32_t index);
+
+    /**
+     * sizes of operations and literals before a subexpression, to drop the subexpression when it is folded.
+     */
+    struct mark
+    {
+        size_t operations;
+        size_t literals;
+    };
+
+    mark here() const noexcept
+    {
+        return mark{expr.operations.size(), expr.literals.size()};
+    }
+
+    bool is_literal(uint32_t index) const noexcept
+    {
+        return expr.operations[index].code == opcode::literal;
+    }
+
+    /**
+     * add operation on {@code first}, and {@code second} if it is binary. the operation is folded to a literal when
+     * its operands are constants, or when a constant operand of && and || decides the result.
+     * @param begin position before the operands.
+     */
+    uint32_t combine(opcode code, mark begin, uint32_t first, uint32_t second = 0);
+
+    script_expression &expr;
+    const char *cur;
+    int depth;
+};
+
+}
+
+uint32_t script_parser::add_operation(opcode code, uint32_t left, uint32_t right)
+{
+    expr.operations.push_back(script_expression::operation{code, left, right});
+    return static_cast<uint32_t>(expr.operations.size() - 1);
+}
+
+uint32_t script_parser::add_literal(script_type type, bool b, int64_t i, double d, std::string &&text)
+{
+    expr.literals.push_back(script_expression::literal{type, b, i, d, std::move(text)});
+    return add_operation(opcode::literal, static_cast<uint32_t>(expr.literals.size() - 1), 0);
+}
+
+uint32_t script_parser::condition(uint32_t index)
+{
+    if (expr.operations[index].code == opcode::path) {
+        return add_operation(opcode::exists, index, 0);
+    }
+    return index;
+}
+
+uint32_t script_parser::combine(opcode code, mark begin, uint32_t first, uint32_t second)
+{
+    const auto &ops = expr.operations;
+    bool constant;
+    switch (code) {
+        case opcode::logical_not:
+        case opcode::negate:
+        case opcode::match:     // second is pattern index.
+            constant = is_literal(first);
+            break;
+        case opcode::in:
+        case opcode::not_in:
+            constant = is_literal(first) && ops[second].code == opcode::list;
+            break;
+        case opcode::logical_and:
+        case opcode::logical_or: {
+            // the other operand has no side effect, so it is dropped.
+            bool decisive = code == opcode::logical_or;
+            auto decides = [&](uint32_t i) {
+                return is_literal(i) && truthy(literal_value<json_token *>(expr.literals[ops[i].left])) == decisive;
+            };
+            if (decides(first) || decides(second)) {
+                expr.operations.resize(begin.operations);
+                expr.literals.resize(begin.literals);
+                return add_literal(script_type::boolean, decisive);
+            }
+            constant = is_literal(first) && is_literal(second);
+            break;
+        }
+        default:
+            constant = is_literal(first) && is_literal(second);
+            break;
+    }
+
+    auto index = add_operation(code, first, second);
+    if (!constant) {
+        return index;
+    }
+
+    // only literals are read, so no document is needed.
+    auto v = expr.eval(token_document(), nullptr, index);
+    expr.operations.resize(begin.operations);
+    expr.literals.resize(begin.literals);
+    return add_literal(v.type, v.bool_value, v.int_value, v.float_value);
+}
+
+bool script_parser::accept_keyword(const char *word) noexcept
+{
+    auto length = std::strlen(word);
+    if (std::strncmp(cur, word, length) != 0 || is_name_char(cur[length])) {
+        return false;
+    }
+    cur += length;
+    return true;
+}
+
+bool script_parser::parse_or(uint32_t &index)
+{
+    auto begin = here();
+    if (!parse_and(index)) {
+        return false;
+    }
+    while (true) {
+        cur = skip_whitespace(cur);
+        if (cur[0] != '|' || cur[1] != '|') {
+            return true;
+        }
+        cur += 2;
+        uint32_t right;
+        if (!parse_and(right)) {
+            return false;
+        }
+        index = combine(opcode::logical_or, begin, condition(index), condition(right));
+    }
+}
+
+bool script_parser::parse_and(uint32_t &index)
+{
+    auto begin = here();
+    if (!parse_comparison(index)) {
+        return false;
+    }
+    while (true) {
+        cur = skip_whitespace(cur);
+        if (cur[0] != '&' || cur[1] != '&') {
+            return true;
+        }
+        cur += 2;
+        uint32_t right;
+        if (!parse_comparison(right)) {
+            return false;
+        }
+        index = combine(opcode::logical_and, begin, condition(index), condition(right));
+    }
+}
+
+bool script_parser::parse_comparison(uint32_t &index)
+{
+    auto begin = here();
+    if (!parse_additive(index)) {
+        return false;
+    }
+
+    cur = skip_whitespace(cur);
+    opcode code;
+    if (cur[0] == '=' && cur[1] == '~') {
+        cur = skip_whitespace(cur, 2);
+        uint32_t pattern;
+        if (!parse_regex(pattern)) {
+            return false;
+        }
+        index = combine(opcode::match, begin, index, pattern);
+        return true;
+    } else if (accept_keyword("in")) {
+        code = opcode::in;
+    } else if (accept_keyword("nin")) {
+        code = opcode::not_in;
+    } else {
+        if (cur[0] == '=' && cur[1] == '=') {
+            code = opcode::equal;
+        } else if (cur[0] == '!' && cur[1] == '=') {
+            code = opcode::not_equal;
+        } else if (cur[0] == '<') {
+            code = cur[1] == '=' ? opcode::less_equal : opcode::less;
+        } else if (cur[0] == '>') {
+            code = cur[1] == '=' ? opcode::greater_equal : opcode::greater;
+        } else {
+            return true;
+        }
+        cur += code == opcode::less || code == opcode::greater ? 1 : 2;
+    }
+
+    uint32_t right;
+    if (code == opcode::in || code == opcode::not_in) {
+        cur = skip_whitespace(cur);
+        if (!(*cur == '[' ? parse_list(right) : parse_additive(right))) {
+            return false;
+        }
+    } else if (!parse_additive(right)) {
+        return false;
+    }
+    index = combine(code, begin, index, right);
+    return true;
+}
+
+bool script_parser::parse_additive(uint32_t &index)
+{
+    auto begin = here();
+    if (!parse_multiplicative(index)) {
+        return false;
+    }
+    while (true) {
+        cur = skip_whitespace(cur);
+        if (*cur != '+' && *cur != '-') {
+            return true;
+        }
+        auto code = *cur++ == '+' ? opcode::add : opcode::subtract;
+        uint32_t right;
+        if (!parse_multiplicative(right)) {
+            return false;
+        }
+        index = combine(code, begin, index, right);
+    }
+}
+
+bool script_parser::parse_multiplicative(uint32_t &index)
+{
+    auto begin = here();
+    if (!parse_unary(index)) {
+        return false;
+    }
+    while (true) {
+        cur = skip_whitespace(cur);
+        if (*cur != '*' && *cur != '/' && *cur != '%') {
+            return true;
+        }
+        auto code = *cur == '*' ? opcode::multiply : *cur == '/' ? opcode::divide : opcode::modulo;
+        ++cur;
+        uint32_t right;
+        if (!parse_unary(right)) {
+            return false;
+        }
+        index = combine(code, begin, index, right);
+    }
+}
+
+bool script_parser::parse_unary(uint32_t &index)
+{
+    cur = skip_whitespace(cur);
+    if (*cur != '!' && *cur != '-') {
+        return parse_primary(index);
+    }
+    if (++depth > MaxScriptDepth) {
+        return false;
+    }
+
+    auto begin = here();
+    auto code = *cur++ == '!' ? opcode::logical_not : opcode::negate;
+    if (!parse_unary(index)) {
+        return false;
+    }
+    index = combine(code, begin, code == opcode::logical_not ? condition(index) : index);
+    --depth;
+    return true;
+}
+
+bool script_parser::parse_primary(uint32_t &index)
+{
+    cur = skip_whitespace(cur);
+    switch (*cur) {
+        case '(': {
+            if (++depth > MaxScriptDepth) {
+                return false;
+            }
+            ++cur;
+            if (!parse_or(index)) {
+                return false;
+            }
+            cur = skip_whitespace(cur);
+            if (*cur != ')') {
+                return false;
+            }
+            ++cur;
+            --depth;
+            return true;
+        }
+        case '@':
+            ++cur;
+            return parse_path(index);
+        case '\'':
+        case '"': {
+            int code = NO_ERROR;
+            char quote = *cur++;
+            auto text = read_json_string(&cur, &code, quote);
+            if (code != NO_ERROR) {
+                --cur;      // report the string which fails from its quote.
+                return false;
+            }
+            index = add_literal(script_type::string, false, 0, 0, std::move(text));
+            return true;
+        }
+        default:
+            break;
+    }
+
+    if (std::isdigit(*cur)) {
+        return parse_number(index);
+    }
+    if (accept_keyword("true")) {
+        index = add_literal(script_type::boolean, true);
+    } else if (accept_keyword("false")) {
+        index = add_literal(script_type::boolean, false);
+    } else if (accept_keyword("null")) {
+        index = add_literal(script_type::null);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool script_parser::parse_path(uint32_t &index)
+{
+    auto first = static_cast<uint32_t>(expr.steps.size());
+    while (true) {
+        if (*cur == '.') {
+            const char *end = cur + 1;
+            while (is_name_char(*end)) {
+                ++end;
+            }
+            if (end == cur + 1) {
+                return false;
+            }
+            expr.steps.push_back(script_expression::step{std::string(cur + 1, end), 0, false});
+            cur = end;
+        } else if (*cur == '[') {
+            cur = skip_whitespace(cur, 1);
+            if (*cur == '\'' || *cur == '"') {
+                int code = NO_ERROR;
+                char quote = *cur++;
+                auto name = read_json_string(&cur, &code, quote);
+                if (code != NO_ERROR) {
+                    --cur;
+                    return false;
+                }
+                expr.steps.push_back(script_expression::step{std::move(name), 0, false});
+            } else if (std::isdigit(*cur)) {
+                char *end;
+                errno = 0;
+                auto i = std::strtoull(cur, &end, 10);
+                if (errno == ERANGE) {
+                    return false;
+                }
+                expr.steps.push_back(script_expression::step{std::string(), i, true});
+                cur = end;
+            } else {
+                return false;
+            }
+            cur = skip_whitespace(cur);
+            if (*cur != ']') {
+                return false;
+            }
+            ++cur;
+        } else {
+            break;
+        }
+    }
+    index = add_operation(opcode::path, first, static_cast<uint32_t>(expr.steps.size()) - first);
+    return true;
+}
+
+bool script_parser::parse_number(uint32_t &index)
+{
+    const char *p = cur;
+    while (std::isdigit(*p)) {
+        ++p;
+    }
+    char *end;
+    errno = 0;
+    if (*p != '.' && *p != 'e' && *p != 'E') {
+        auto i = std::strtoll(cur, &end, 10);
+        if (errno != ERANGE) {
+            cur = end;
+            index = add_literal(script_type::integer, false, i);
+            return true;
+        }
+        errno = 0;
+    }
+    auto d = std::strtod(cur, &end);
+    if (end == cur || errno == ERANGE) {
+        return false;
+    }
+    cur = end;
+    index = add_literal(script_type::number, false, 0, d);
+    return true;
+}
+
+bool script_parser::parse_list(uint32_t &index)
+{
+    // literals of items are contiguous, the operations of items are replaced by the list.
+    auto begin = here();
+    cur = skip_whitespace(cur, 1);
+    if (*cur != ']') {
+        while (true) {
+            uint32_t item;
+            if (!parse_additive(item) || !is_literal(item)
+                || expr.operations[item].left != expr.literals.size() - 1
+                || expr.literals.size() - begin.literals != expr.operations.size() - begin.operations) {
+                return false;   // not a constant.
+            }
+            cur = skip_whitespace(cur);
+            if (*cur == ']') {
+                break;
+            }
+            if (*cur != ',') {
+                return false;
+            }
+            ++cur;
+        }
+    }
+    ++cur;
+    expr.operations.resize(begin.operations);
+    index = add_operation(opcode::list, static_cast<uint32_t>(begin.literals),
+                          static_cast<uint32_t>(expr.literals.size() - begin.literals));
+    return true;
+}
+
+bool script_parser::parse_regex(uint32_t &index)
+{
+    if (*cur != '/') {
+        return false;
+    }
+    std::string pattern;
+    for (++cur; *cur != '/'; ++cur) {
+        if (*cur == '\0') {
+            return false;
+        }
+        if (cur[0] == '\\' && cur[1] == '/') {
+            ++cur;      // escaped slash
+        } else if (cur[0] == '\\' && cur[1] != '\0') {
+            pattern += *cur++;
+        }
+        pattern += *cur;
+    }
+    ++cur;
+
+    auto flags = std::regex::ECMAScript;
+    if (*cur == 'i') {
+        flags |= std::regex::icase;
+        ++cur;
+    }
+    try {
+        expr.patterns.emplace_back(pattern, flags);
+    } catch (const std::regex_error &) {
+        return false;
+    }
+    index = static_cast<uint32_t>(expr.patterns.size() - 1);
+    return true;
+}
+
+bool script_expression::compile(const char **expr)
+{
+    const char *start = *expr;
+    assert(*start == '(');
+
+    operations.clear();
+    literals.clear();
+    steps.clear();
+    patterns.clear();
+
+    script_parser parser(*this, start + 1);
+    uint32_t index;
+    if (!parser.parse_or(index)) {
+        *expr = parser.position();
+        return false;
+    }
+    auto end = skip_whitespace(parser.position());
+    if (*end != ')') {
+        *expr = end;
+        return false;
+    }
+    root = index;
+    *expr = end + 1;
+    return true;
+}
@@ -0,0 +1,237 @@
+//
+// Created by Charles on 2018/7/16.
+//
+
+#include <cstring>
+#include "JSONReader.hpp"
+#include "JSONUtils.hpp"
+
+using namespace json;
+
+bool json_reader::enter(char c, int error_code) noexcept
+{
+    if (!expect(c, error_code)) {
+        return false;
+    }
+    if (strict_parse_policy::max_depth != 0 && depth >= strict_parse_policy::max_depth) {
+        --cur;
+        code = NESTING_DEPTH_EXCEEDED;
+        return false;
+    }
+    ++depth;
+    return true;
+}
+
+bool json_reader::expect(char c, int error_code) noexcept
+{
+    if (code != NO_ERROR) {
+        return false;
+    }
+    cur = skip_whitespace(cur);
+    if (*cur != c) {
+        code = error_code;
+        return false;
+    }
+    ++cur;
+    return true;
+}
+
+json_type json_reader::peek() noexcept
+{
+    cur = skip_whitespace(cur);
+    switch (*cur) {
+        case '{':
+            return json_type::object;
+        case '[':
+            return json_type::array;
+        case '\"':
+            return json_type::string;
+        case 't':
+        case 'f':
+            return json_type::boolean;
+        case 'n':
+            return json_type::null;
+        default:
+            if (*cur == '-' || (*cur >= '0' && *cur <= '9')) {
+                return json_type::number;
+            }
+            if (code == NO_ERROR) {
+                code = UNEXPECTED_TOKEN;
+            }
+            return json_type::null;
+    }
+}
+
+bool json_reader::begin_object() noexcept
+{
+    first = true;
+    return enter('{', OBJECT_PARSE_ERROR);
+}
+
+bool json_reader::next_member(const char **key, size_t *length) noexcept
+{
+    if (code != NO_ERROR) {
+        return false;
+    }
+
+    cur = skip_whitespace(cur);
+    if (*cur == '}') {
+        ++cur;
+        --depth;
+        first = false;
+        return false;
+    }
+    if (!first && !expect(',', OBJECT_PARSE_ERROR)) {
+        return false;
+    }
+    first = false;
+    if (!expect('\"', OBJECT_KEY_SYNTAX_ERROR)) {
+        return false;
+    }
+    --cur;  // read_string starts at the quote.
+    return read_string(key, length) && expect(':', OBJECT_KV_SYNTAX_ERROR);
+}
+
+bool json_reader::begin_array() noexcept
+{
+    first = true;
+    return enter('[', ARRAY_PARSE_ERROR);
+}
+
+bool json_reader::next_element() noexcept
+{
+    if (code != NO_ERROR) {
+        return false;
+    }
+
+    cur = skip_whitespace(cur);
+    if (*cur == ']') {
+        ++cur;
+        --depth;
+        first = false;
+        return false;
+    }
+    if (!first && !expect(',', ARRAY_PARSE_ERROR)) {
+        return false;
+    }
+    first = false;
+    return true;
+}
+
+bool json_reader::read_string(std::string &value)
+{
+    if (!expect('\"', STRING_PARSE_ERROR)) {
+        return false;
+    }
+    value.clear();
+    return append_json_string(&cur, &code, value);
+}
+
+bool json_reader::read_string(const char **data, size_t *length)
+{
+    if (!expect('\"', STRING_PARSE_ERROR)) {
+        return false;
+    }
+
+    // fast path: point into the text if there is neither escape sequence nor control character.
+    auto tmp = cur;
+    while (*tmp != '\"' && *tmp != '\\' && static_cast<unsigned char>(*tmp) >= 0x20 && *tmp != 0x7f) {
+        ++tmp;
+    }
+    if (*tmp == '\"') {
+        *data = cur;
+        *length = static_cast<size_t>(tmp - cur);
+        cur = tmp + 1;
+        return true;
+    }
+
+    scratch.clear();
+    if (!append_json_string(&cur, &code, scratch)) {
+        return false;
+    }
+    *data = scratch.data();
+    *length = scratch.size();
+    return true;
+}
+
+bool json_reader::read_number(bool &is_float, int64_t &int_value, double &float_value) noexcept
+{
+    if (code != NO_ERROR) {
+        return false;
+    }
+    cur = skip_whitespace(cur);
+    number_union number{};
+    is_float = read_json_number(&cur, &code, number);
+    if (code != NO_ERROR) {
+        return false;
+    }
+    if (is_float) {
+        float_value = number.float_value;
+    } else {
+        int_value = number.int_value;
+    }
+    return true;
+}
+
+bool json_reader::read_bool(bool &value) noexcept
+{
+    if (code != NO_ERROR) {
+        return false;
+    }
+    cur = skip_whitespace(cur);
+    if (std::strncmp(cur, "true", 4) == 0) {
+        value = true;
+        cur += 4;
+        return true;
+    }
+    if (std::strncmp(cur, "false", 5) == 0) {
+        value = false;
+        cur += 5;
+        return true;
+    }
+    code = UNEXPECTED_TOKEN;
+    return false;
+}
+
+bool json_reader::read_null() noexcept
+{
+    if (code != NO_ERROR) {
+        return false;
+    }
+    cur = skip_whitespace(cur);
+    if (std::strncmp(cur, "null", 4) != 0) {
+        code = UNEXPECTED_TOKEN;
+        return false;
+    }
+    cur += 4;
+    return true;
+}
+
+std::unique_ptr<json_token> json_reader::read_token()
+{
+    if (code != NO_ERROR) {
+        return nullptr;
+    }
+    return read_json_token(&cur, &code, depth);
+}
+
+void json_reader::skip_value() noexcept
+{
+    if (code != NO_ERROR) {
+        return;
+    }
+    skip_json_value(&cur, &code, strict_parse_policy::max_depth, depth);
+}
+
+bool json_reader::finish() noexcept
+{
+    if (code != NO_ERROR) {
+        return false;
+    }
+    cur = skip_whitespace(cur);
+    if (cur != end) {
+        code = UNEXPECTED_END_CHAR;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,331 @@
+//
+// Created by Charles on 2018/7/25.
+//
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "JSONSnapshot.hpp"
+#include "JSONUtils.hpp"
+
+using namespace json;
+
+namespace {
+
+constexpr char snapshot_magic[8] = {'J', 'S', 'O', 'N', 'S', 'N', 'A', 'P'};
+constexpr uint32_t snapshot_version = 1;
+// written in the native byte order, it does not match on a machine with the other byte order.
+constexpr uint32_t byte_order_mark = 0x01020304;
+
+/**
+ * header at the beginning of snapshot. offsets are in bytes from the beginning, counts are in entries.
+ */
+struct snapshot_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t file_size;
+    uint64_t tape_offset;
+    uint64_t tape_count;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    // pairs of object index and table offset.
+    uint64_t directory_offset;
+    uint64_t directory_count;
+    uint64_t tables_offset;
+    uint64_t tables_count;
+};
+
+constexpr size_t align_8(size_t size)
+{
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+}
+
+/**
+ * write a section of the snapshot, empty sections are not written since their data may be null.
+ */
+static bool write_section(json_sink &sink, const void *data, size_t size)
+{
+    return size == 0 || sink.write(static_cast<const char *>(data), size);
+}
+
+bool json::write_snapshot(const json_tape_view &tape, json_sink &sink)
+{
+    std::vector<uint64_t> directory;
+    std::vector<uint64_t> tables;
+    std::vector<uint64_t> keys;
+    for (size_t i = 0, count = tape.entry_count(); i < count; i += tape.is_float(i) || tape.tag(i) == 'l' ? 2 : 1) {
+        if (tape.tag(i) != '{' || tape.size(i) < json_tape_view::IndexedObjectSize) {
+            continue;
+        }
+        keys.clear();
+        for (size_t k = tape.begin(i), e = tape.end(i); k < e; k = tape.next(k + 1)) {
+            keys.push_back(k);
+        }
+        std::stable_sort(keys.begin(), keys.end(), [&tape](uint64_t a, uint64_t b) {
+            auto key = static_cast<size_t>(b);
+            return tape.compare_key(static_cast<size_t>(a), tape.string_data(key), tape.string_size(key)) < 0;
+        });
+        directory.push_back(i);
+        directory.push_back(tables.size());
+        tables.insert(tables.end(), keys.begin(), keys.end());
+    }
+
+    snapshot_header header{};
+    std::memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+    header.version = snapshot_version;
+    header.byte_order = byte_order_mark;
+    header.tape_offset = sizeof(snapshot_header);
+    header.tape_count = tape.entry_count();
+    header.strings_offset = header.tape_offset + header.tape_count * sizeof(uint64_t);
+    header.strings_size = tape.string_buffer_size();
+    header.directory_offset = header.strings_offset + align_8(tape.string_buffer_size());
+    header.directory_count = directory.size() / 2;
+    header.tables_offset = header.directory_offset + directory.size() * sizeof(uint64_t);
+    header.tables_count = tables.size();
+    header.file_size = header.tables_offset + tables.size() * sizeof(uint64_t);
+
+    const char padding[8] = {};
+    return write_section(sink, &header, sizeof(header))
+           && write_section(sink, tape.data(), tape.entry_count() * sizeof(uint64_t))
+           && write_section(sink, tape.string_buffer(), tape.string_buffer_size())
+           && write_section(sink, padding, align_8(tape.string_buffer_size()) - tape.string_buffer_size())
+           && write_section(sink, directory.data(), directory.size() * sizeof(uint64_t))
+           && write_section(sink, tables.data(), tables.size() * sizeof(uint64_t))
+           && sink.flush();
+}
+
+/**
+ * check that a section of {@code count} entries of {@code entry_size} bytes is inside of the file and aligned.
+ */
+static bool check_section(uint64_t offset, uint64_t count, uint64_t entry_size, uint64_t file_size)
+{
+    return offset % sizeof(uint64_t) == 0 && offset <= file_size && count <= (file_size - offset) / entry_size;
+}
+
+/**
+ * check all entries of tape: the containers are matched and their sizes are right, object members are key-value
+ * pairs, and strings are inside of the string buffer.
+ */
+static bool verify_tape(const json_tape_view &tape)
+{
+    struct open_container
+    {
+        size_t index;
+        size_t count;
+    };
+
+    std::vector<open_container> stack;
+    size_t count = tape.entry_count();
+    size_t i = 0;
+    while (i < count) {
+        auto tag = tape.tag(i);
+        auto payload = tape.payload(i);
+        if (tag == '}' || tag == ']') {
+            if (stack.empty() || tape.payload(stack.back().index) != i) {
+                return false;
+            }
+            auto values = stack.back().count;
+            // an object has a value for each key.
+            if (tag == '}' ? (values % 2 != 0 || payload != values / 2) : payload != values) {
+                return false;
+            }
+            stack.pop_back();
+            ++i;
+            continue;
+        }
+
+        if (!stack.empty()) {
+            auto &parent = stack.back();
+            if (tape.tag(parent.index) == '{' && parent.count % 2 == 0 && tag != '"') {
+                return false;   // key of object member must be string
+            }
+            ++parent.count;
+        } else if (i != 0) {
+            return false;   // there is only one root value
+        }
+
+        switch (tag) {
+            case '{':
+            case '[':
+                if (payload <= i || payload >= count || tape.tag(payload) != (tag == '{' ? '}' : ']')) {
+                    return false;
+                }
+                stack.push_back(open_container{i, 0});
+                ++i;
+                break;
+            case '"': {
+                auto size = tape.string_buffer_size();
+                if (size < sizeof(uint32_t) || payload > size - sizeof(uint32_t)
+                    || tape.string_size(i) >= size - sizeof(uint32_t) - payload) {
+                    return false;   // length, bytes and the trailing '\0'
+                }
+                ++i;
+                break;
+            }
+            case 'l':
+            case 'd':
+                if (i + 1 >= count) {
+                    return false;
+                }
+                i += 2;
+                break;
+            case 't':
+            case 'f':
+            case 'n':
+                ++i;
+                break;
+            default:
+                return false;
+        }
+    }
+    return stack.empty();
+}
+
+/**
+ * check the directory and key tables, each table holds the key indices of its object, sorted by the key for the binary
+ * search.
+ */
+static bool verify_tables(const json_tape_view &tape, uint64_t tables_count)
+{
+    auto directory = tape.key_directory();
+    auto tables = tape.key_tables();
+    for (size_t n = 0; n < tape.key_directory_size(); ++n) {
+        auto object = directory[n * 2];
+        auto offset = directory[n * 2 + 1];
+        if (object >= tape.entry_count() || tape.tag(object) != '{' || (n > 0 && object <= directory[n * 2 - 2])) {
+            return false;
+        }
+        auto size = tape.size(object);
+        if (offset > tables_count || size > tables_count - offset) {
+            return false;
+        }
+        for (size_t k = 0; k < size; ++k) {
+            auto key = tables[offset + k];
+            if (key <= object || key >= tape.end(object) || tape.tag(key) != '"') {
+                return false;
+            }
+            auto prev = static_cast<size_t>(k > 0 ? tables[offset + k - 1] : key);
+            if (tape.compare_key(static_cast<size_t>(key), tape.string_data(prev), tape.string_size(prev)) < 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+json_snapshot::json_snapshot(json_snapshot &&other) noexcept
+        : mapping(other.mapping), mapping_size(other.mapping_size), tape_view(other.tape_view)
+{
+    other.mapping = nullptr;
+    other.mapping_size = 0;
+    other.tape_view = json_tape_view();
+}
+
+json_snapshot &json_snapshot::operator=(json_snapshot &&other) noexcept
+{
+    if (this != &other) {
+        close();
+        mapping = other.mapping;
+        mapping_size = other.mapping_size;
+        tape_view = other.tape_view;
+        other.mapping = nullptr;
+        other.mapping_size = 0;
+        other.tape_view = json_tape_view();
+    }
+    return *this;
+}
+
+bool json_snapshot::open(const char *path, int *error, bool verify)
+{
+    close();
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if (fd < 0 || ::fstat(fd, &st) != 0 || st.st_size <= 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        if (error) {
+            *error = fd < 0 ? FILE_ACCESS_ERROR : BINARY_DATA_TRUNCATED;
+        }
+        return false;
+    }
+
+    auto size = static_cast<size_t>(st.st_size);
+    auto data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        if (error) {
+            *error = FILE_ACCESS_ERROR;
+        }
+        return false;
+    }
+    if (!attach(data, size, error, verify)) {
+        ::munmap(data, size);
+        return false;
+    }
+    mapping = data;
+    mapping_size = size;
+    return true;
+}
+
+bool json_snapshot::attach(const void *data, size_t size, int *error, bool verify)
+{
+    close();
+    int code = NO_ERROR;
+    snapshot_header header{};
+    if (size < sizeof(header)) {
+        code = BINARY_DATA_TRUNCATED;
+    } else {
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, snapshot_magic, sizeof(snapshot_magic)) != 0
+            || header.version != snapshot_version || header.byte_order != byte_order_mark
+            || reinterpret_cast<uintptr_t>(data) % sizeof(uint64_t) != 0) {
+            code = BINARY_DATA_MALFORMED;
+        } else if (header.file_size > size) {
+            code = BINARY_DATA_TRUNCATED;
+        } else if (header.tape_count == 0
+                   || !check_section(header.tape_offset, header.tape_count, sizeof(uint64_t), header.file_size)
+                   || !check_section(header.strings_offset, header.strings_size, 1, header.file_size)
+                   || !check_section(header.directory_offset, header.directory_count, sizeof(uint64_t) * 2,
+                                     header.file_size)
+                   || !check_section(header.tables_offset, header.tables_count, sizeof(uint64_t), header.file_size)) {
+            code = BINARY_DATA_MALFORMED;
+        }
+    }
+
+    if (code == NO_ERROR) {
+        auto base = static_cast<const char *>(data);
+        json_tape_view view(reinterpret_cast<const uint64_t *>(base + header.tape_offset),
+                            static_cast<size_t>(header.tape_count), base + header.strings_offset,
+                            static_cast<size_t>(header.strings_size),
+                            reinterpret_cast<const uint64_t *>(base + header.directory_offset),
+                            static_cast<size_t>(header.directory_count),
+                            reinterpret_cast<const uint64_t *>(base + header.tables_offset));
+        if (verify && (!verify_tape(view) || !verify_tables(view, header.tables_count))) {
+            code = BINARY_DATA_MALFORMED;
+        } else {
+            tape_view = view;
+        }
+    }
+    if (error) {
+        *error = code;
+    }
+    return code == NO_ERROR;
+}
+
+void json_snapshot::close() noexcept
+{
+    if (mapping) {
+        ::munmap(mapping, mapping_size);
+    }
+    mapping = nullptr;
+    mapping_size = 0;
+    tape_view = json_tape_view();
+}
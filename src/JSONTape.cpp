@@ -0,0 +1,395 @@
+//
+// Created by Charles on 2018/7/2.
+//
+
+#include <algorithm>
+#include <iostream>
+#include "JSONTape.hpp"
+#include "JSONUtils.hpp"
+
+namespace json {
+
+/**
+ * append entries to the tape while parsing. keys of the objects being parsed are kept in a stack,
+ * to detect duplicated keys without allocation per object.
+ */
+class tape_builder
+{
+public:
+    explicit tape_builder(json_tape &t) : tape(t.tape), strings(t.strings) { }
+
+    template<typename Policy>
+    void read_token(const char **str, int *error, unsigned depth);
+
+private:
+    template<typename Policy>
+    void read_object(const char **object_str, int *error, unsigned depth);
+
+    template<typename Policy>
+    void read_array(const char **array_str, int *error, unsigned depth);
+
+    template<typename Policy>
+    void read_value(const char **value_str, int *error);
+
+    template<typename Policy>
+    size_t read_string(const char **str, int *error);
+
+    bool has_duplicated_key(size_t key_base);
+
+    void append(char tag, uint64_t payload)
+    {
+        tape.push_back((static_cast<uint64_t>(static_cast<unsigned char>(tag)) << json_tape_view::TagShift) | payload);
+    }
+
+    const char *key_data(size_t offset) const
+    {
+        return strings.data() + offset + sizeof(uint32_t);
+    }
+
+    uint32_t key_size(size_t offset) const
+    {
+        uint32_t length;
+        std::memcpy(&length, strings.data() + offset, sizeof(uint32_t));
+        return length;
+    }
+
+    std::vector<uint64_t> &tape;
+    std::string &strings;
+    std::vector<size_t> keys;
+};
+
+}
+
+using namespace json;
+
+template<typename Policy>
+size_t tape_builder::read_string(const char **str, int *error)
+{
+    auto offset = strings.size();
+    strings.append(sizeof(uint32_t), '\0');
+    if (!append_json_string<Policy::check_control_char>(str, error, strings)) {
+        return 0;
+    }
+
+    auto length = strings.size() - offset - sizeof(uint32_t);
+    if (length > std::numeric_limits<uint32_t>::max()) {
+        *error = STRING_PARSE_ERROR;
+        return 0;
+    }
+    auto len32 = static_cast<uint32_t>(length);
+    std::memcpy(&strings[offset], &len32, sizeof(uint32_t));
+    strings.push_back('\0');
+    return offset;
+}
+
+bool tape_builder::has_duplicated_key(size_t key_base)
+{
+    auto first = keys.begin() + key_base;
+    std::sort(first, keys.end(), [this](size_t a, size_t b) {
+        auto la = key_size(a);
+        auto lb = key_size(b);
+        return la != lb ? la < lb : std::memcmp(key_data(a), key_data(b), la) < 0;
+    });
+    return std::adjacent_find(first, keys.end(), [this](size_t a, size_t b) {
+        return key_size(a) == key_size(b) && std::memcmp(key_data(a), key_data(b), key_size(a)) == 0;
+    }) != keys.end();
+}
+
+template<typename Policy>
+void tape_builder::read_object(const char **object_str, int *error, unsigned depth)
+{
+    auto str = skip_whitespace(*object_str, 1);
+    auto start = tape.size();
+    auto key_base = keys.size();
+    uint64_t count = 0;
+    append('{', 0);
+
+    if (*str != '}') {
+        while (true) {
+            if (!assert_equal(*str, '\"')) {
+                *error = OBJECT_KEY_SYNTAX_ERROR;
+                return;
+            }
+            ++str;
+            append('"', 0);
+            auto key = read_string<Policy>(&str, error);
+            if (*error != NO_ERROR) {
+                return;
+            }
+            tape.back() |= key;
+            if (Policy::check_duplicated_key) {
+                keys.push_back(key);
+            }
+
+            str = skip_whitespace(str);
+            if (!assert_equal(*str, ':')) {
+                *error = OBJECT_KV_SYNTAX_ERROR;
+                return;
+            }
+            ++str;
+            read_token<Policy>(&str, error, depth);
+            if (*error != NO_ERROR) {
+                return;
+            }
+            ++count;
+
+            str = skip_whitespace(str);
+            if (*str == ',') {
+                str = skip_whitespace(str, 1);
+                continue;
+            }
+            if (!json_assert(*str == '}')) {
+                *error = OBJECT_PARSE_ERROR;
+                return;
+            }
+            break;
+        }
+    }
+
+    if (Policy::check_duplicated_key) {
+        if (!json_assert(!has_duplicated_key(key_base))) {
+            *error = OBJECT_DUPLICATED_KEY;
+            return;
+        }
+        keys.resize(key_base);
+    }
+
+    tape[start] |= tape.size();
+    append('}', count);
+    *object_str = str + 1;
+}
+
+template<typename Policy>
+void tape_builder::read_array(const char **array_str, int *error, unsigned depth)
+{
+    auto str = skip_whitespace(*array_str, 1);
+    auto start = tape.size();
+    uint64_t count = 0;
+    append('[', 0);
+
+    if (*str != ']') {
+        while (true) {
+            read_token<Policy>(&str, error, depth);
+            if (*error != NO_ERROR) {
+                return;
+            }
+            ++count;
+
+            str = skip_whitespace(str);
+            if (*str == ',') {
+                ++str;
+                continue;
+            }
+            if (!assert_equal(*str, ']')) {
+                *error = ARRAY_PARSE_ERROR;
+                return;
+            }
+            break;
+        }
+    }
+
+    tape[start] |= tape.size();
+    append(']', count);
+    *array_str = str + 1;
+}
+
+template<typename Policy>
+void tape_builder::read_value(const char **value_str, int *error)
+{
+    auto str = *value_str;
+    if (*str == '\"') {
+        ++str;
+        auto offset = read_string<Policy>(&str, error);
+        if (*error != NO_ERROR) {
+            return;
+        }
+        append('"', offset);
+        *value_str = str;
+        return;
+    }
+    if (std::strncmp(str, "true", 4) == 0) {
+        append('t', 0);
+        *value_str = str + 4;
+        return;
+    }
+    if (std::strncmp(str, "false", 5) == 0) {
+        append('f', 0);
+        *value_str = str + 5;
+        return;
+    }
+    if (std::strncmp(str, "null", 4) == 0) {
+        append('n', 0);
+        *value_str = str + 4;
+        return;
+    }
+
+    number_union number{};
+    auto is_float = read_json_number(value_str, error, number);
+    if (*error != NO_ERROR) {
+        return;
+    }
+    if (is_float) {
+        uint64_t raw;
+        std::memcpy(&raw, &number.float_value, sizeof(double));
+        append('d', 0);
+        tape.push_back(raw);
+    } else {
+        append('l', 0);
+        tape.push_back(static_cast<uint64_t>(number.int_value));
+    }
+}
+
+template<typename Policy>
+void tape_builder::read_token(const char **str, int *error, unsigned depth)
+{
+    auto tmp = skip_whitespace(*str);
+    *str = tmp;
+
+    if (*tmp == '{' || *tmp == '[') {
+        if (Policy::max_depth != 0 && depth >= Policy::max_depth) {
+            *error = NESTING_DEPTH_EXCEEDED;
+            return;
+        }
+        if (*tmp == '{') {
+            read_object<Policy>(str, error, depth + 1);
+        } else {
+            read_array<Policy>(str, error, depth + 1);
+        }
+        return;
+    }
+
+    read_value<Policy>(str, error);
+}
+
+template<typename Policy>
+bool json::parse_tape(const char *json, json_tape &tape, int *error)
+{
+    const char *start = json;
+    int code = NO_ERROR;
+    tape.clear();
+    tape_builder builder(tape);
+    builder.read_token<Policy>(&json, &code, 0);
+    if (code == NO_ERROR && !assert_end_str(json)) {
+        code = UNEXPECTED_END_CHAR;
+    }
+    if (error) {
+        *error = code;
+    }
+
+    if (code != NO_ERROR) {
+        if (Policy::log_error) {
+            std::cerr << "unexcepted end character near byte position " << static_cast<int64_t>(json - start)
+                      << ", error code: " << code << ", info: " << get_error_info(code) << std::endl;
+        }
+        tape.clear();
+        return false;
+    }
+    return true;
+}
+
+template bool json::parse_tape<strict_parse_policy>(const char *json, json_tape &tape, int *error);
+template bool json::parse_tape<trusted_parse_policy>(const char *json, json_tape &tape, int *error);
+
+
+static void format_tape_scalar(const json_tape_view &tape, size_t index, std::string &builder)
+{
+    switch (tape.tag(index)) {
+        case '"':
+            format_string(tape.string_data(index), tape.string_size(index), builder);
+            break;
+        case 'l':
+            format_number(tape.get_int(index), builder);
+            break;
+        case 'd':
+            format_number(tape.get_double(index), builder);
+            break;
+        case 't':
+            builder.append("true", 4);
+            break;
+        case 'f':
+            builder.append("false", 5);
+            break;
+        default:
+            builder.append("null", 4);
+            break;
+    }
+}
+
+static void format_tape(const json_tape_view &tape, size_t index, std::string &builder, char indent, unsigned base, unsigned level)
+{
+    char tag = tape.tag(index);
+    if (tag != '{' && tag != '[') {
+        format_tape_scalar(tape, index, builder);
+        return;
+    }
+
+    size_t count = base * (level + 1);
+    builder.push_back(tag);
+    builder.push_back('\n');
+    bool first = true;
+    for (size_t i = tape.begin(index), e = tape.end(index); i < e; i = tape.next(i)) {
+        if (!first) {
+            builder.append(",\n", 2);
+        }
+        first = false;
+        builder.append(count, indent);
+        if (tag == '{') {
+            format_string(tape.string_data(i), tape.string_size(i), builder);
+            builder.append(": ", 2);
+            ++i;
+        }
+        format_tape(tape, i, builder, indent, base, level + 1);
+    }
+    if (!first) {
+        builder.push_back('\n');
+    }
+    builder.append(count - base, indent);
+    builder.push_back(tag == '{' ? '}' : ']');
+}
+
+static void format_tape(const json_tape_view &tape, size_t index, std::string &builder)
+{
+    char tag = tape.tag(index);
+    if (tag != '{' && tag != '[') {
+        format_tape_scalar(tape, index, builder);
+        return;
+    }
+
+    builder.push_back(tag);
+    bool first = true;
+    for (size_t i = tape.begin(index), e = tape.end(index); i < e; i = tape.next(i)) {
+        if (!first) {
+            builder.push_back(',');
+        }
+        first = false;
+        if (tag == '{') {
+            format_string(tape.string_data(i), tape.string_size(i), builder);
+            builder.push_back(':');
+            ++i;
+        }
+        format_tape(tape, i, builder);
+    }
+    builder.push_back(tag == '{' ? '}' : ']');
+}
+
+std::string json::to_string(const json_tape_view &tape, size_t index, json_format_option option, unsigned indention)
+{
+    std::string builder;
+    if (tape.empty()) {
+        return builder;
+    }
+
+    // strings and 8 bytes per entry cover most documents, no need to walk the tape.
+    builder.reserve(tape.string_buffer_size() + (tape.next(index) - index) * 8);
+    switch (option) {
+        case json_format_option::indent_space:
+            format_tape(tape, index, builder, ' ', indention, 0);
+            break;
+        case json_format_option::indent_tab:
+            format_tape(tape, index, builder, '\t', indention, 0);
+            break;
+        default:
+            format_tape(tape, index, builder);
+    }
+    return builder;
+}
@@ -65,13 +65,14 @@ static bool try_parse_hex_short(const char *str, uint16_t &result) noexcept
     return true;
 }
 
-std::string json::read_json_string(const char **str, int *error, char quote)
+template<bool CheckControlChar>
+bool json::append_json_string(const char **str, int *error, std::string &ret, char quote, bool *escape_free)
 {
     auto last_handle_pos = *str;
     bool escape = false;
+    bool plain = true;
     unsigned int count = 0;
 
-    std::string ret;
     for (auto tmp = last_handle_pos; *tmp != quote; ++tmp) {
         if (*tmp == '\\') {
             escape = true;
@@ -79,11 +80,12 @@ std::string json::read_json_string(const char **str, int *error, char quote)
         }
         if (*tmp == 0) {
             *error = STRING_PARSE_ERROR;
-            return std::string();
+            return false;
         }
 
         if (escape) {
             escape = false;
+            plain = false;
             if (count != 0) {
                 ret.append(last_handle_pos, count);
                 count = 0;
@@ -116,7 +118,7 @@ std::string json::read_json_string(const char **str, int *error, char quote)
                     uint16_t unicode_first;
                     if (!try_parse_hex_short(tmp + 1, unicode_first)) {
                         *error = STRING_UNICODE_SYNTAX_ERROR;
-                        return std::string();
+                        return false;
                     }
                     tmp += 4;
                     uint32_t unicode = unicode_first;
@@ -125,7 +127,7 @@ std::string json::read_json_string(const char **str, int *error, char quote)
                         uint16_t unicode_second;
                         if (tmp[1] != '\\' || tmp[2] != 'u' || !try_parse_hex_short(tmp + 3, unicode_second)) {
                             *error = STRING_UNICODE_SYNTAX_ERROR;
-                            return std::string();
+                            return false;
                         }
 
                         if (0xdc00u <= unicode_second && unicode_second <= 0xdfffu) {
@@ -133,7 +135,7 @@ std::string json::read_json_string(const char **str, int *error, char quote)
                             tmp += 6;
                         } else {
                             *error = STRING_UNICODE_SYNTAX_ERROR;
-                            return std::string();
+                            return false;
                         }
                     }
 
@@ -147,13 +149,16 @@ std::string json::read_json_string(const char **str, int *error, char quote)
                 }
                 default:
                     *error = STRING_ESCAPE_SYNTAX_ERROR;
-                    return std::string();
+                    return false;
             }
         }
-        if (!json_assert(std::iscntrl(*tmp) == 0)) {
+        if (CheckControlChar && !json_assert(std::iscntrl(*tmp) == 0)) {
             *error = STRING_CONTROL_CHAR_SYNTAX_ERROR;
-            return std::string();
+            return false;
         }
+        // the same characters as escaped by format_string, without branching.
+        auto c = static_cast<unsigned char>(*tmp);
+        plain = plain & (c >= 0x20) & (c != '/') & (c != 0x7F);
 
         ++count;
     }
@@ -161,11 +166,152 @@ std::string json::read_json_string(const char **str, int *error, char quote)
     if (count != 0) {
         ret.append(last_handle_pos, count);
     }
+    if (escape_free) {
+        *escape_free = plain;
+    }
 
     *str = last_handle_pos + count + 1;
+    return true;
+}
+
+template<bool CheckControlChar>
+std::string json::read_json_string(const char **str, int *error, char quote, bool *escape_free)
+{
+    std::string ret;
+    if (!append_json_string<CheckControlChar>(str, error, ret, quote, escape_free)) {
+        return std::string();
+    }
     return ret;
 }
 
+template std::string json::read_json_string<true>(const char **str, int *error, char quote, bool *escape_free);
+template std::string json::read_json_string<false>(const char **str, int *error, char quote, bool *escape_free);
+template bool json::append_json_string<true>(const char **str, int *error, std::string &ret, char quote, bool *escape_free);
+template bool json::append_json_string<false>(const char **str, int *error, std::string &ret, char quote, bool *escape_free);
+
+static void skip_json_string(const char **str, int *error)
+{
+    auto tmp = *str;
+    while (*tmp != '\"') {
+        if (*tmp == '\\') {
+            ++tmp;
+        }
+        if (*tmp == 0) {
+            *error = json::STRING_PARSE_ERROR;
+            return;
+        }
+        ++tmp;
+    }
+    *str = tmp + 1;
+}
+
+void json::skip_json_value(const char **str, int *error, unsigned max_depth, unsigned depth)
+{
+    auto tmp = skip_whitespace(*str);
+    if ((*tmp == '{' || *tmp == '[') && max_depth != 0 && depth >= max_depth) {
+        *error = NESTING_DEPTH_EXCEEDED;
+        return;
+    }
+    switch (*tmp) {
+        case '{': {
+            tmp = skip_whitespace(tmp, 1);
+            if (*tmp == '}') {
+                break;
+            }
+            while (true) {
+                if (*tmp != '\"') {
+                    *error = OBJECT_KEY_SYNTAX_ERROR;
+                    return;
+                }
+                ++tmp;
+                skip_json_string(&tmp, error);
+                if (*error != NO_ERROR) {
+                    return;
+                }
+                tmp = skip_whitespace(tmp);
+                if (*tmp != ':') {
+                    *error = OBJECT_KV_SYNTAX_ERROR;
+                    return;
+                }
+                ++tmp;
+                skip_json_value(&tmp, error, max_depth, depth + 1);
+                if (*error != NO_ERROR) {
+                    return;
+                }
+                tmp = skip_whitespace(tmp);
+                if (*tmp == ',') {
+                    tmp = skip_whitespace(tmp, 1);
+                    continue;
+                }
+                if (*tmp != '}') {
+                    *error = OBJECT_PARSE_ERROR;
+                    return;
+                }
+                break;
+            }
+            break;
+        }
+        case '[': {
+            tmp = skip_whitespace(tmp, 1);
+            if (*tmp == ']') {
+                break;
+            }
+            while (true) {
+                skip_json_value(&tmp, error, max_depth, depth + 1);
+                if (*error != NO_ERROR) {
+                    return;
+                }
+                tmp = skip_whitespace(tmp);
+                if (*tmp == ',') {
+                    ++tmp;
+                    continue;
+                }
+                if (*tmp != ']') {
+                    *error = ARRAY_PARSE_ERROR;
+                    return;
+                }
+                break;
+            }
+            break;
+        }
+        case '\"':
+            ++tmp;
+            skip_json_string(&tmp, error);
+            *str = tmp;
+            return;
+        case 't':
+        case 'n':
+            if (std::strncmp(tmp, *tmp == 't' ? "true" : "null", 4) != 0) {
+                *error = UNEXPECTED_TOKEN;
+                return;
+            }
+            *str = tmp + 4;
+            return;
+        case 'f':
+            if (std::strncmp(tmp, "false", 5) != 0) {
+                *error = UNEXPECTED_TOKEN;
+                return;
+            }
+            *str = tmp + 5;
+            return;
+        default: {
+            auto start = tmp;
+            while ((*tmp >= '0' && *tmp <= '9') || *tmp == '-' || *tmp == '+' || *tmp == '.' || *tmp == 'e' || *tmp == 'E') {
+                ++tmp;
+            }
+            if (tmp == start) {
+                *error = UNEXPECTED_TOKEN;
+                return;
+            }
+            *str = tmp;
+            return;
+        }
+    }
+
+    // end of object or array.
+    *str = tmp + 1;
+}
+
 // String parse end
 
 
@@ -482,26 +628,22 @@ char *json::dtoa(double value, char *buffer, int max_decimal_places)
         uint64_t i;
     } u = {value};
 
+    if (is_sign_double(u.i)) {
+        *buffer++ = '-';    // -0.0, Issue #289
+    }
     if (is_zero_double(u.i)) {
-        if (is_sign_double(u.i)) {
-            *buffer++ = '-';
-        }     // -0.0, Issue #289
         buffer[0] = '0';
         buffer[1] = '.';
         buffer[2] = '0';
         return &buffer[3];
     } else {
-        if (value < 0) {
-            *buffer++ = '-';
-            value = -value;
-        }
-        int length, K;
-        grisu2(value, buffer, &length, &K);
-        return prettify(buffer, length, K, max_decimal_places);
+        auto decimal = shortest_decimal(value);
+        auto length = static_cast<int>(u64toa(decimal.mantissa, buffer) - buffer);
+        return prettify(buffer, length, decimal.exponent, max_decimal_places);
     }
 }
 
-static char *u64toa(uint64_t value, char *buffer)
+char *json::u64toa(uint64_t value, char *buffer)
 {
     const char *const_digits_lut = get_digits_lut();
     constexpr uint64_t ten_8 = 100000000;
@@ -689,3 +831,43 @@ char *json::i64toa(int64_t value, char *buffer)
 
     return u64toa(u, buffer);
 }
+
+char *json::i64toa(const int64_t *values, size_t count, const char *separator, size_t length, char *buffer)
+{
+    if (count == 0) {
+        return buffer;
+    }
+    buffer = i64toa(values[0], buffer);
+    for (size_t i = 1; i < count; ++i) {
+        std::memcpy(buffer, separator, length);
+        buffer = i64toa(values[i], buffer + length);
+    }
+    return buffer;
+}
+
+void json::append_base64url(const char *bytes, size_t size, std::string &value)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+    auto data = reinterpret_cast<const uint8_t *>(bytes);
+    value.reserve(value.size() + (size + 2) / 3 * 4);
+    size_t i = 0;
+    for (; i + 3 <= size; i += 3) {
+        uint32_t n = (uint32_t(data[i]) << 16u) | (uint32_t(data[i + 1]) << 8u) | data[i + 2];
+        value.push_back(alphabet[n >> 18u]);
+        value.push_back(alphabet[(n >> 12u) & 0x3fu]);
+        value.push_back(alphabet[(n >> 6u) & 0x3fu]);
+        value.push_back(alphabet[n & 0x3fu]);
+    }
+    if (i < size) {
+        uint32_t n = uint32_t(data[i]) << 16u;
+        if (i + 1 < size) {
+            n |= uint32_t(data[i + 1]) << 8u;
+        }
+        value.push_back(alphabet[n >> 18u]);
+        value.push_back(alphabet[(n >> 12u) & 0x3fu]);
+        if (i + 1 < size) {
+            value.push_back(alphabet[(n >> 6u) & 0x3fu]);
+        }
+    }
+}
@@ -9,6 +9,7 @@
 #include <limits>
 #include <cassert>
 #include <string>
+#include <memory>
 
 inline static const char *skip_whitespace(const char *str)
 {
@@ -44,7 +45,13 @@ enum
     NUMBER_EXPONENT_FORMAT_ERROR,
     NUMBER_FLOAT_OVERFLOW,
     UNEXPECTED_TOKEN,
-    UNEXPECTED_END_CHAR
+    UNEXPECTED_END_CHAR,
+    NESTING_DEPTH_EXCEEDED,
+    QUERY_PATH_SYNTAX_ERROR,
+    NUMBER_NOT_FINITE,
+    BINARY_DATA_TRUNCATED,
+    BINARY_DATA_MALFORMED,
+    FILE_ACCESS_ERROR
 };
 
 union number_union
@@ -78,9 +85,20 @@ inline static bool assert_end_str(const char *str)
  * @param str in out param, c-style utf8 string.
  * @param error out param, if an error occurs, which value will be set.
  * @param quote in param, quote character used in string syntax.
+ * @param escape_free optional out param, set to true if the parsed value contains nothing to be escaped when it is
+ * formatted, i.e. there is no escape sequence in the text, and no control character, '/' or DEL.
+ * @tparam CheckControlChar whether to reject the unescaped control characters.
  * @return parsed value. or empty string if error occurs.
  */
-std::string read_json_string(const char **str, int *error, char quote = '\"');
+template<bool CheckControlChar = true>
+std::string read_json_string(const char **str, int *error, char quote = '\"', bool *escape_free = nullptr);
+
+/**
+ * read json string type value and append the parsed value to {@code ret}, for the detail see {@code read_json_string}.
+ * @return true if no error occurs. otherwise {@code ret} may contain a part of the string.
+ */
+template<bool CheckControlChar = true>
+bool append_json_string(const char **str, int *error, std::string &ret, char quote = '\"', bool *escape_free = nullptr);
 
 /**
  * parse number type string. for number pattern detail see http://www.json.org/index.html
@@ -92,6 +110,28 @@ std::string read_json_string(const char **str, int *error, char quote = '\"');
  */
 bool read_json_number(const char **number_str, int *error, number_union &number);
 
+/**
+ * skip a json value of any type without building it. the structure of object and array and the end of string
+ * are checked, but the content of string and number is not validated.
+ * @param str in out param, c-style utf8 string, point to the next character after the value when returns.
+ * @param error out param, if an error occurs, which value will be set.
+ * @param max_depth max nesting depth of object and array like {@code Policy::max_depth}, 0 means no limit. it is
+ * required, so that no caller skips untrusted input without the limit.
+ * @param depth nesting depth of the value, counted the same as the parser.
+ */
+void skip_json_value(const char **str, int *error, unsigned max_depth, unsigned depth);
+
+class json_token;
+
+/**
+ * read a json value of any type with {@code strict_parse_policy}. implemented by the parser in JSON.cpp.
+ * @param str in out param, c-style utf8 string.
+ * @param error out param, if an error occurs, which value will be set.
+ * @param depth nesting depth of the value, checked against {@code strict_parse_policy::max_depth}.
+ * @return parsed value, or {@code nullptr} if error occurs.
+ */
+std::unique_ptr<json_token> read_json_token(const char **str, int *error, unsigned depth = 0);
+
 /**
  * double to ascii string. buffer size must be greater than 25.
  * @param value double value to format.
@@ -109,6 +149,28 @@ char* dtoa(double value, char* buffer, int max_decimal_places = 324);
  */
 char* i64toa(int64_t value, char* buffer);
 
+/**
+ * uint64 value to ascii string, like {@code i64toa}.
+ */
+char* u64toa(uint64_t value, char* buffer);
+
+/**
+ * format int64 values joined by {@code separator} in a batch, e.g. a packed array.
+ * @param values values to format.
+ * @param count count of values.
+ * @param separator separator written between values.
+ * @param length length of separator.
+ * @param buffer buffer to place the format-string, its size must be at least
+ * {@code count * (20 + length)}.
+ * @return pointer to the next character in the buffer after the format-string.
+ */
+char* i64toa(const int64_t *values, size_t count, const char *separator, size_t length, char *buffer);
+
+/**
+ * append binary data encoded as base64url (RFC 4648) without padding, used for the byte strings of binary formats.
+ */
+void append_base64url(const char *bytes, size_t size, std::string &value);
+
 }
 
 #endif //CPPPARSER_JSONUTILS_H
@@ -0,0 +1,266 @@
+//
+// Created by Charles on 2018/7/23.
+//
+
+#include <cstring>
+#include "JSONWriter.hpp"
+
+using namespace json;
+
+json_writer::json_writer(std::string &o, const format_options &opts)
+        : output(o), sink(nullptr), options(opts), pending_key(false), has_root(false), failed(false) { }
+
+json_writer::json_writer(json_sink &s, const format_options &opts)
+        : output(buffer), sink(&s), options(opts), pending_key(false), has_root(false), failed(false)
+{
+    buffer.reserve(options.buffer_size);
+}
+
+json_writer::~json_writer()
+{
+    flush();
+}
+
+bool json_writer::flush()
+{
+    if (sink && !buffer.empty()) {
+        failed = failed || !sink->write(buffer.data(), buffer.size());
+        buffer.clear();
+        failed = failed || !sink->flush();
+    }
+    return !failed;
+}
+
+void json_writer::indent(size_t level_count)
+{
+    if (options.option == json_format_option::indent_space) {
+        output.append(level_count * options.indention, ' ');
+    } else if (options.option == json_format_option::indent_tab) {
+        output.append(level_count * options.indention, '\t');
+    }
+}
+
+bool json_writer::before_value()
+{
+    if (failed) {
+        return false;
+    }
+    if (levels.empty()) {
+        if (has_root) {
+            output.push_back('\n');
+        }
+        return true;
+    }
+
+    auto &top = levels.back();
+    if (top.type == '{') {
+        if (!pending_key) {
+            failed = true;
+            return false;
+        }
+        pending_key = false;
+        return true;
+    }
+
+    bool pretty = options.option != json_format_option::no_format;
+    if (top.count > 0) {
+        output.append(",\n", pretty ? 2 : 1);
+    }
+    ++top.count;
+    indent(levels.size());
+    return true;
+}
+
+void json_writer::after_value()
+{
+    if (levels.empty()) {
+        has_root = true;
+    }
+    if (sink && buffer.size() >= options.buffer_size) {
+        auto ok = sink->write(buffer.data(), buffer.size());
+        failed = failed || !ok;
+        buffer.clear();
+    }
+}
+
+json_writer &json_writer::begin_container(char type)
+{
+    if (!before_value()) {
+        return *this;
+    }
+    output.push_back(type);
+    if (options.option != json_format_option::no_format) {
+        output.push_back('\n');
+    }
+    levels.push_back(level{type, 0});
+    return *this;
+}
+
+json_writer &json_writer::end_container(char type)
+{
+    if (failed || levels.empty() || levels.back().type != type || pending_key) {
+        failed = true;
+        return *this;
+    }
+
+    if (options.option != json_format_option::no_format && levels.back().count > 0) {
+        output.push_back('\n');
+    }
+    levels.pop_back();
+    indent(levels.size());
+    output.push_back(type == '{' ? '}' : ']');
+    after_value();
+    return *this;
+}
+
+json_writer &json_writer::begin_object()
+{
+    return begin_container('{');
+}
+
+json_writer &json_writer::end_object()
+{
+    return end_container('{');
+}
+
+json_writer &json_writer::begin_array()
+{
+    return begin_container('[');
+}
+
+json_writer &json_writer::end_array()
+{
+    return end_container('[');
+}
+
+json_writer &json_writer::key(const char *name, size_t length)
+{
+    if (failed || levels.empty() || levels.back().type != '{' || pending_key) {
+        failed = true;
+        return *this;
+    }
+
+    bool pretty = options.option != json_format_option::no_format;
+    auto &top = levels.back();
+    if (top.count > 0) {
+        output.append(",\n", pretty ? 2 : 1);
+    }
+    ++top.count;
+    indent(levels.size());
+    format_string(name, length, output);
+    output.append(": ", pretty ? 2 : 1);
+    pending_key = true;
+    return *this;
+}
+
+json_writer &json_writer::value(int64_t v)
+{
+    if (before_value()) {
+        format_number(v, output);   // options only apply to float numbers.
+        after_value();
+    }
+    return *this;
+}
+
+json_writer &json_writer::value(uint64_t v)
+{
+    if (before_value()) {
+        format_number(v, output);
+        after_value();
+    }
+    return *this;
+}
+
+json_writer &json_writer::value(double v)
+{
+    if (before_value()) {
+        failed = !format_number(v, output, options) || failed;
+        after_value();
+    }
+    return *this;
+}
+
+json_writer &json_writer::value(bool v)
+{
+    if (before_value()) {
+        if (v) {
+            output.append("true", 4);
+        } else {
+            output.append("false", 5);
+        }
+        after_value();
+    }
+    return *this;
+}
+
+json_writer &json_writer::value(const char *str, size_t length)
+{
+    if (before_value()) {
+        format_string(str, length, output);
+        after_value();
+    }
+    return *this;
+}
+
+json_writer &json_writer::value(std::nullptr_t)
+{
+    if (before_value()) {
+        output.append("null", 4);
+        after_value();
+    }
+    return *this;
+}
+
+json_writer &json_writer::value(const json_token &token)
+{
+    switch (token.get_type()) {
+        case json_type::object:
+            begin_object();
+            for (const auto &property : static_cast<const json_object &>(token)) {
+                key(property.first);
+                value(*property.second);
+            }
+            return end_object();
+        case json_type::array: {
+            auto &ary = static_cast<const json_array &>(token);
+            begin_array();
+            auto packed = ary.get_packed();
+            if (packed.type == json_array::packing::int64) {
+                for (size_t i = 0; i < packed.size; ++i) {
+                    value(packed.ints[i]);
+                }
+            } else if (packed.type == json_array::packing::float64) {
+                for (size_t i = 0; i < packed.size; ++i) {
+                    value(packed.floats[i]);
+                }
+            } else {
+                for (const auto &element : ary) {
+                    value(*element);
+                }
+            }
+            return end_array();
+        }
+        case json_type::string: {
+            auto &str = static_cast<const json_string_value &>(token);
+            if (str.get_escaping() != json_string_value::escaping::none) {
+                return value(str.value());
+            }
+            // known to need no escaping, copy it directly.
+            if (before_value()) {
+                output.push_back('\"');
+                output.append(str.value());
+                output.push_back('\"');
+                after_value();
+            }
+            return *this;
+        }
+        case json_type::number: {
+            auto &num = static_cast<const json_number_value &>(token);
+            return num.is_float_value() ? value((double)num) : value((int64_t)num);
+        }
+        case json_type::boolean:
+            return value((bool)static_cast<const json_bool_value &>(token));
+        default:
+            return value(nullptr);
+    }
+}
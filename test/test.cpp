@@ -5,9 +5,23 @@
 #include <iostream>
 #include <fstream>
 #include <chrono>
-
+#include <random>
+#include <limits>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <algorithm>
+
+#include "../src/JSONUtils.hpp"
 #include "JSONConvert.hpp"
 #include "JSONQuery.hpp"
+#include "JSONWriter.hpp"
+#include "JSONSnapshot.hpp"
+#ifdef JSONCPP_MSGPACK_SUPPORT
+#include "JSONMsgpack.hpp"
+#endif
 
 using namespace std;
 using namespace json;
@@ -110,6 +124,27 @@ DESERIALIZE_CLASS(es_search_result::hits_info, DESERIALIZE(_id), DESERIALIZE(_in
 DESERIALIZE_CLASS(es_search_result::hits_overview, DESERIALIZE(hits), DESERIALIZE(max_score), DESERIALIZE(total));
 
 DESERIALIZE_CLASS(es_search_result, DESERIALIZE(hits), DESERIALIZE(time_out), DESERIALIZE(took), DESERIALIZE(_shared));
+
+SERIALIZE_CLASS(es_search_result::shared, SERIALIZE(failed), SERIALIZE(skipped), SERIALIZE(successful), SERIALIZE(total));
+
+SERIALIZE_CLASS(es_search_result::beat_info, SERIALIZE(hostname), SERIALIZE(version), SERIALIZE(name));
+
+SERIALIZE_CLASS(es_search_result::metricset_info, SERIALIZE(module), SERIALIZE(name), SERIALIZE(rtt));
+
+SERIALIZE_CLASS(es_search_result::fs_used, SERIALIZE(bytes), SERIALIZE(pct));
+
+SERIALIZE_CLASS(es_search_result::file_system_info, SERIALIZE(free_files), SERIALIZE(type), SERIALIZE(used), SERIALIZE(device_name),
+                SERIALIZE(mount_point), SERIALIZE(total), SERIALIZE(files), SERIALIZE(free), SERIALIZE(available));
+
+SERIALIZE_CLASS(es_search_result::system_info, SERIALIZE(filesystem));
+
+SERIALIZE_CLASS(es_search_result::source, SERIALIZE(beat), SERIALIZE(metricset), SERIALIZE(system));
+
+SERIALIZE_CLASS(es_search_result::hits_info, SERIALIZE(_id), SERIALIZE(_index), SERIALIZE(_score), SERIALIZE(_source), SERIALIZE(_type));
+
+SERIALIZE_CLASS(es_search_result::hits_overview, SERIALIZE(hits), SERIALIZE(max_score), SERIALIZE(total));
+
+SERIALIZE_CLASS(es_search_result, SERIALIZE(hits), SERIALIZE(time_out), SERIALIZE(took), SERIALIZE(_shared));
 }
 
 class count_timer
@@ -139,6 +174,497 @@ public:
 };
 
 
+/**
+ * format strings with escapes at various positions (including across 16/32-byte blocks), parse them back,
+ * and format the parsed values again, which are copied directly if they need no escaping.
+ */
+static bool check_string_escapes()
+{
+    const std::string samples[] = {
+            "", "plain", "\"", "\\", "/", "a\"b\\c/d", std::string("nul\0inside", 11), "tab\tnew\nline\r\b\f",
+            "\x01\x1f\x7f", "utf8 \xe4\xb8\xad\xe6\x96\x87 text",
+            "0123456789abcde\"0123456789abcdef\\0123456789abcdefghijklmnopqrstu/",
+            std::string(31, 'x') + "\n" + std::string(32, 'y') + "\"" + std::string(40, 'z') + "\x05"
+    };
+
+    bool ok = true;
+    for (const auto &sample : samples) {
+        json_string_value value(sample);
+        auto text = to_string(value);
+        int error = 0;
+        auto back = parse(text, &error);
+        if (!back || back->get_type() != json_type::string || to_string(*back) != text ||
+            static_cast<const json_string_value &>(*back).value() != sample) {
+            cerr << "string escape failed: " << text << endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+/**
+ * format doubles of random bits in the shortest form, read them back by {@code std::strtod} (which is correctly
+ * rounded, unlike the fast path of {@code parse}) and compare. NaN and infinity are formatted by the non-finite option.
+ */
+static bool check_float_round_trip()
+{
+    std::mt19937_64 random(20180719);
+    bool ok = true;
+    for (int i = 0; i < 100000 && ok; ++i) {
+        union
+        {
+            uint64_t i;
+            double d;
+        } u = {random()};
+        if (u.d != u.d || u.d == std::numeric_limits<double>::infinity() || u.d == -std::numeric_limits<double>::infinity()) {
+            continue;
+        }
+        auto text = to_string(json_number_value(u.d));
+        if (std::strtod(text.c_str(), nullptr) != u.d) {
+            cerr << "float round trip failed: " << text << endl;
+            ok = false;
+        }
+    }
+
+    json_number_value nan(std::numeric_limits<double>::quiet_NaN());
+    format_options options;
+    ok = ok && to_string(nan, options) == "null";
+    options.nonfinite = json_nonfinite_option::string;
+    ok = ok && to_string(nan, options) == "\"NaN\"";
+    options.nonfinite = json_nonfinite_option::error;
+    int error = 0;
+    ok = ok && to_string(nan, options, &error).empty() && error != 0;
+    return ok;
+}
+
+/**
+ * input nested up to {@code strict_parse_policy::max_depth} is parsed, one more level is rejected instead of
+ * overflowing the stack, by the token, projection, tape and CBOR parsers and the json reader.
+ */
+static bool check_nesting_depth()
+{
+    auto nested = [](unsigned depth) {
+        return std::string(depth, '[') + std::string(depth, ']');
+    };
+    auto max_depth = strict_parse_policy::max_depth;
+    int error = 0;
+    bool ok = parse(nested(max_depth), &error) && error == NO_ERROR;
+    ok = ok && !parse(nested(max_depth + 1), &error) && error == NESTING_DEPTH_EXCEEDED;
+    ok = ok && !parse(nested(100000), &error) && error == NESTING_DEPTH_EXCEEDED;
+
+    // projection counts the depth the same way, whether the deep member is skipped, projected or read whole.
+    auto member = [&nested](unsigned depth) {
+        return "{\"a\":1,\"b\":" + nested(depth) + "}";
+    };
+    const std::vector<std::string> skipped{"$.a"}, projected{"$.b[0][0]"}, whole{"$.b"};
+    for (const auto &paths : {skipped, projected, whole}) {
+        ok = ok && parse(member(max_depth - 1), paths, &error) && error == NO_ERROR;
+        ok = ok && !parse(member(max_depth), paths, &error) && error == NESTING_DEPTH_EXCEEDED;
+        ok = ok && !parse(member(200000), paths, &error) && error == NESTING_DEPTH_EXCEEDED;
+    }
+
+    // skipped objects are counted like arrays, e.g. {"a":1,"b":{"b":{...}}}.
+    es_search_result::shared shared;
+    for (unsigned depth : {max_depth - 1, max_depth, 200000u}) {
+        std::string text = "{\"a\":1,\"b\":";
+        for (unsigned i = 1; i < depth; ++i) {
+            text += "{\"b\":";
+        }
+        text += "{}" + std::string(depth, '}');
+        bool projected_ok = parse(text.c_str(), skipped, &error) != nullptr;
+        ok = ok && (depth < max_depth ? projected_ok && error == NO_ERROR : !projected_ok && error == NESTING_DEPTH_EXCEEDED);
+        bool parsed = deserialize_from_text(shared, text.c_str(), text.size(), &error);
+        ok = ok && (depth < max_depth ? parsed && error == NO_ERROR : !parsed && error == NESTING_DEPTH_EXCEEDED);
+    }
+
+    // so does the deserialization skipping unknown members.
+    for (unsigned depth : {max_depth - 1, max_depth, 200000u}) {
+        auto text = member(depth);
+        bool parsed = deserialize_from_text(shared, text.c_str(), text.size(), &error);
+        ok = ok && (depth < max_depth ? parsed && error == NO_ERROR : !parsed && error == NESTING_DEPTH_EXCEEDED);
+    }
+
+    json_tape tape;
+    ok = ok && parse_tape(nested(max_depth), tape, &error) && error == NO_ERROR;
+    ok = ok && !parse_tape(nested(max_depth + 1), tape, &error) && error == NESTING_DEPTH_EXCEEDED;
+
+    std::vector<uint8_t> cbor(max_depth, 0x81);   // one array more than the limit, the last is empty.
+    cbor.push_back(0x80);
+    ok = ok && !parse_cbor(cbor, &error) && error == NESTING_DEPTH_EXCEEDED;
+    cbor.erase(cbor.begin());
+    ok = ok && parse_cbor(cbor, &error) && error == NO_ERROR;
+
+    // {"a":1,"b":[[...]]} in CBOR, "b" holds nested arrays and is skipped as an unknown member.
+    for (unsigned depth : {max_depth - 1, max_depth, 200000u}) {
+        std::vector<uint8_t> map{0xa2, 0x61, 'a', 0x01, 0x61, 'b'};
+        map.insert(map.end(), depth - 1, 0x81);
+        map.push_back(0x80);
+        bool parsed = deserialize_from_cbor(shared, map.data(), map.size(), &error);
+        ok = ok && (depth < max_depth ? parsed && error == NO_ERROR : !parsed && error == NESTING_DEPTH_EXCEEDED);
+    }
+    return ok;
+}
+
+/**
+ * unsigned integers above {@code INT64_MAX} are serialized and written as unsigned, not wrapped to negative.
+ */
+static bool check_unsigned_numbers()
+{
+    const uint64_t max = std::numeric_limits<uint64_t>::max();
+    std::vector<uint64_t> values{max, static_cast<uint64_t>(std::numeric_limits<int64_t>::max()) + 1, 0};
+    std::string written;
+    json_writer writer(written);
+    writer.begin_array().value(max).value(static_cast<unsigned long long>(max)).value(int64_t(-1)).end_array();
+    return serialize(max) == "18446744073709551615" && serialize(static_cast<uint8_t>(255)) == "255"
+           && serialize(values) == "[18446744073709551615,9223372036854775808,0]"
+           && writer.good() && written == "[18446744073709551615,18446744073709551615,-1]";
+}
+
+/**
+ * a path with syntax error reports the offset where parsing stopped, not the beginning of the failing part.
+ */
+static bool check_path_error_offsets()
+{
+    const std::pair<const char *, size_t> samples[] = {
+            {"$.a[?(@.x <)]", 11}, {"$.a[1:2:3:4]", 9}, {"$.a[?(@.x == 'unterminated)]", 13}, {"$..", 3},
+            {"$.a.", 4}, {"$x", 1}, {"$[]", 2}, {"$['a',b]", 6}, {"$['a'", 5}, {"$.a[1,x]", 6}, {"$.a[?@.x]", 5},
+            {"$.a[(@.length-)]", 14}, {"$.a[?(@.x > 1)x]", 14}, {"$.a[*]x", 6}, {"", 0}
+    };
+    bool ok = true;
+    for (const auto &sample : samples) {
+        int error = 0;
+        size_t offset = 0;
+        compiled_path path(sample.first, &error, &offset);
+        if (error != QUERY_PATH_SYNTAX_ERROR || offset != sample.second) {
+            cerr << "path error offset failed: " << sample.first << " at " << offset << endl;
+            ok = false;
+        }
+    }
+    int error = 0;
+    size_t offset = 1;
+    return compiled_path("$.a[?(@.x > 1)]", &error, &offset).valid() && error == NO_ERROR && offset == 0 && ok;
+}
+
+/**
+ * json pointers select values in projection parsing like json-path, with the escaped tokens unescaped.
+ */
+static bool check_pointer_projection()
+{
+    const char *json = R"({"a/b":{"m~n":[1,{"x":2,"y":3}]},"01":4,"c":[5,6]})";
+    int error = 0;
+    auto pointer = parse(json, {"/a~1b/m~0n/1/x", "/c/1"}, &error);
+    auto path = parse(json, {"$.c[1]"}, &error);
+    bool ok = pointer && to_string(*pointer) == R"({"a\/b":{"m~n":[null,{"x":2}]},"c":[null,6]})";
+    ok = ok && path && to_string(*path) == R"({"c":[null,6]})";
+    // "01" is not an array index, but still a member name.
+    auto member = parse(json, {"/01", "/c/01"}, &error);
+    ok = ok && member && to_string(*member) == R"({"01":4,"c":[null,null]})";
+    ok = ok && !parse(json, {"/a~2"}, &error) && error == QUERY_PATH_SYNTAX_ERROR;
+    return ok;
+}
+
+/**
+ * misuses of {@code json_writer} make it fail, and a correct sequence keeps it good.
+ */
+static bool check_writer_misuse()
+{
+    std::string out;
+    bool ok = json_writer(out).begin_object().key("a").value(int64_t(1)).end_object().good();
+
+    json_writer value_without_key(out);
+    ok = ok && !value_without_key.begin_object().value(int64_t(1)).good();
+    json_writer mismatched_end(out);
+    ok = ok && !mismatched_end.begin_object().end_array().good();
+    json_writer end_without_begin(out);
+    ok = ok && !end_without_begin.end_object().good();
+    json_writer key_in_array(out);
+    ok = ok && !key_in_array.begin_array().key("a").good();
+    json_writer dangling_key(out);
+    ok = ok && !dangling_key.begin_object().key("a").end_object().good();
+    json_writer two_keys(out);
+    ok = ok && !two_keys.begin_object().key("a").key("b").good();
+    return ok;
+}
+
+/**
+ * moving a packed array, by construction and by assignment, takes over its elements and packing.
+ */
+static bool check_array_move()
+{
+    json_array ints, floats;
+    ints.add(int64_t(1));
+    ints.add(int64_t(2));
+    floats.add(0.5);
+
+    json_array constructed(std::move(ints));
+    json_array assigned;
+    assigned.add(int64_t(3));
+    assigned = std::move(floats);
+    return to_string(constructed) == "[1,2]" && constructed.get_packing() == json_array::packing::int64
+           && to_string(assigned) == "[0.5]" && assigned.get_packing() == json_array::packing::float64
+           && floats.size() == 0 && floats.get_packing() == json_array::packing::none;
+}
+
+static std::vector<uint8_t> from_hex(const char *hex)
+{
+    std::vector<uint8_t> data;
+    for (; hex[0] && hex[1]; hex += 2) {
+        data.push_back(static_cast<uint8_t>(std::stoi(std::string(hex, 2), nullptr, 16)));
+    }
+    return data;
+}
+
+struct binary_vector
+{
+    const char *json;
+    const char *hex;
+};
+
+struct malformed_vector
+{
+    const char *hex;
+    int error;
+};
+
+/**
+ * encode and decode the examples of RFC 8949 appendix A, and decode truncated and malformed data.
+ */
+static bool check_cbor_vectors()
+{
+    // encoded in the shortest form, and decoded back.
+    const binary_vector encoded[] = {
+            {"0", "00"}, {"1", "01"}, {"10", "0a"}, {"23", "17"}, {"24", "1818"}, {"25", "1819"}, {"100", "1864"},
+            {"255", "18ff"}, {"256", "190100"}, {"1000", "1903e8"}, {"65535", "19ffff"}, {"65536", "1a00010000"},
+            {"1000000", "1a000f4240"}, {"4294967295", "1affffffff"}, {"4294967296", "1b0000000100000000"},
+            {"1000000000000", "1b000000e8d4a51000"}, {"9223372036854775807", "1b7fffffffffffffff"},
+            {"-1", "20"}, {"-10", "29"}, {"-24", "37"}, {"-25", "3818"}, {"-100", "3863"}, {"-256", "38ff"},
+            {"-257", "390100"}, {"-1000", "3903e7"}, {"-9223372036854775808", "3b7fffffffffffffff"},
+            {"0.0", "f90000"}, {"-0.0", "f98000"}, {"1.0", "f93c00"}, {"1.1", "fb3ff199999999999a"},
+            {"1.5", "f93e00"}, {"65504.0", "f97bff"}, {"100000.0", "fa47c35000"}, {"1.0e+300", "fb7e37e43c8800759c"},
+            {"0.00006103515625", "f90400"}, {"-4.0", "f9c400"}, {"-4.1", "fbc010666666666666"},
+            {"false", "f4"}, {"true", "f5"}, {"null", "f6"},
+            {"\"\"", "60"}, {"\"a\"", "6161"}, {"\"IETF\"", "6449455446"}, {"\"\\\"\\\\\"", "62225c"},
+            {"\"\\u00fc\"", "62c3bc"}, {"\"\\u6c34\"", "63e6b0b4"}, {"\"\\ud800\\udd51\"", "64f0908591"},
+            {"[]", "80"}, {"[1,2,3]", "83010203"}, {"[1,[2,3],[4,5]]", "8301820203820405"},
+            {"[1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25]",
+             "98190102030405060708090a0b0c0d0e0f101112131415161718181819"},
+            {"{}", "a0"}, {"{\"a\":1,\"b\":[2,3]}", "a26161016162820203"}, {"[\"a\",{\"b\":\"c\"}]", "826161a161626163"},
+            {"{\"a\":\"A\",\"b\":\"B\",\"c\":\"C\",\"d\":\"D\",\"e\":\"E\"}", "a56161614161626142616361436164614461656145"}
+    };
+    // indefinite length, tags, byte strings, non-shortest and out of int64 forms, decoded only.
+    const binary_vector decoded[] = {
+            {"18446744073709551615.0", "1bffffffffffffffff"}, {"-18446744073709551616.0", "3bffffffffffffffff"},
+            {"1", "1b0000000000000001"}, {"1.5", "fb3ff8000000000000"}, {"null", "f7"}, {"null", "f0"},
+            {"null", "f8ff"},
+            {"\"2013-03-21T20:04:00Z\"", "c074323031332d30332d32315432303a30343a30305a"},
+            {"1363896240", "c11a514b67b0"}, {"1363896240.5", "c1fb41d452d9ec200000"}, {"\"AQIDBA\"", "d74401020304"},
+            {"\"http://www.example.com\"", "d82076687474703a2f2f7777772e6578616d706c652e636f6d"},
+            {"\"\"", "40"}, {"\"AQIDBA\"", "4401020304"}, {"\"AQIDBAU\"", "5f42010243030405ff"},
+            {"\"streaming\"", "7f657374726561646d696e67ff"}, {"[]", "9fff"},
+            {"[1,[2,3],[4,5]]", "9f018202039f0405ffff"}, {"[1,[2,3],[4,5]]", "9f01820203820405ff"},
+            {"[1,[2,3],[4,5]]", "83018202039f0405ff"}, {"[1,[2,3],[4,5]]", "83019f0203ff820405"},
+            {"[1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25]",
+             "9f0102030405060708090a0b0c0d0e0f101112131415161718181819ff"},
+            {"{\"a\":1,\"b\":[2,3]}", "bf61610161629f0203ffff"}, {"[\"a\",{\"b\":\"c\"}]", "826161bf61626163ff"},
+            {"{\"Fun\":true,\"Amt\":-2}", "bf6346756ef563416d7421ff"}
+    };
+    const malformed_vector malformed[] = {
+            {"", BINARY_DATA_TRUNCATED}, {"18", BINARY_DATA_TRUNCATED}, {"1a0000", BINARY_DATA_TRUNCATED},
+            {"f900", BINARY_DATA_TRUNCATED}, {"62c3", BINARY_DATA_TRUNCATED}, {"83", BINARY_DATA_TRUNCATED},
+            {"9f01", BINARY_DATA_TRUNCATED}, {"a16161", BINARY_DATA_TRUNCATED}, {"bf6161", BINARY_DATA_TRUNCATED},
+            {"5f4101", BINARY_DATA_TRUNCATED}, {"c0", BINARY_DATA_TRUNCATED},
+            {"1c", BINARY_DATA_MALFORMED}, {"1f", BINARY_DATA_MALFORMED}, {"ff", BINARY_DATA_MALFORMED},
+            {"5f6161ff", BINARY_DATA_MALFORMED}, {"7f4101ff", BINARY_DATA_MALFORMED}, {"f818", BINARY_DATA_MALFORMED},
+            {"a201020304", OBJECT_KEY_SYNTAX_ERROR}, {"0001", UNEXPECTED_END_CHAR}
+    };
+
+    bool ok = true;
+    for (const auto &v : encoded) {
+        int error = 0;
+        auto token = parse(v.json, &error);
+        auto data = from_hex(v.hex);
+        auto back = parse_cbor(data, &error);
+        if (!token || to_cbor(*token) != data || !back || to_string(*back) != to_string(*token)) {
+            cerr << "cbor encode failed: " << v.json << endl;
+            ok = false;
+        }
+    }
+    // the fast path of parse does not read these doubles exactly, so they are built directly.
+    const std::pair<double, const char *> floats[] = {
+            {std::ldexp(1.0, -24), "f90001"}, {static_cast<double>(std::numeric_limits<float>::max()), "fa7f7fffff"}
+    };
+    for (const auto &v : floats) {
+        json_number_value number(v.first);
+        int error = 0;
+        auto back = parse_cbor(from_hex(v.second), &error);
+        if (to_cbor(number) != from_hex(v.second) || !back || to_string(*back) != to_string(number)) {
+            cerr << "cbor float failed: " << v.second << endl;
+            ok = false;
+        }
+    }
+    for (const auto &v : decoded) {
+        int error = 0;
+        auto back = parse_cbor(from_hex(v.hex), &error);
+        auto token = parse(v.json, &error);
+        if (!back || to_string(*back) != to_string(*token)) {
+            cerr << "cbor decode failed: " << v.hex << endl;
+            ok = false;
+        }
+    }
+    for (const auto &v : malformed) {
+        int error = 0;
+        if (parse_cbor(from_hex(v.hex), &error) || error != v.error) {
+            cerr << "cbor malformed data accepted: " << v.hex << endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+/**
+ * attach a snapshot with verification after corrupting its header, sections, tape and key tables.
+ */
+static bool check_snapshot_verify()
+{
+    std::string json = "{\"nested\":[1,2.5,\"s\",null]";
+    for (int i = 0; i < 16; ++i) {
+        json += ",\"k" + std::to_string(i) + "\":" + std::to_string(i);
+    }
+    json += "}";
+    json_tape tape;
+    std::string bytes;
+    callback_sink sink([&bytes](const char *data, size_t size) {
+        bytes.append(data, size);
+        return true;
+    });
+    if (!parse_tape(json, tape, nullptr) || !write_snapshot(tape.view(), sink)) {
+        return false;
+    }
+
+    // header fields, in 8-byte words: magic, version and byte order, file size, tape offset and count, strings
+    // offset and size, directory offset and count, tables offset and count.
+    const size_t words = (bytes.size() + 7) / 8;
+    auto attach = [&](const std::function<void(uint64_t *)> &corrupt, size_t size, int expected) {
+        std::vector<uint64_t> data(words);
+        std::memcpy(data.data(), bytes.data(), bytes.size());
+        corrupt(data.data());
+        json_snapshot snapshot;
+        int error = 0;
+        return !snapshot.attach(data.data(), size, &error, true) && error == expected && snapshot.empty();
+    };
+    std::vector<uint64_t> data(words);
+    std::memcpy(data.data(), bytes.data(), bytes.size());
+    json_snapshot snapshot;
+    bool ok = snapshot.attach(data.data(), bytes.size(), nullptr, true) && to_string(snapshot.view(), 0) == json;
+    auto tape_word = [](uint64_t *d, size_t index) -> uint64_t & { return d[d[3] / 8 + index]; };
+    auto payload_mask = (static_cast<uint64_t>(1) << 56) - 1;
+
+    ok = ok && attach([](uint64_t *d) { reinterpret_cast<char *>(d)[0] = 'X'; }, bytes.size(), BINARY_DATA_MALFORMED);
+    ok = ok && attach([](uint64_t *d) { ++reinterpret_cast<uint32_t *>(d)[2]; }, bytes.size(), BINARY_DATA_MALFORMED);
+    ok = ok && attach([](uint64_t *) { }, bytes.size() - 8, BINARY_DATA_TRUNCATED);
+    ok = ok && attach([](uint64_t *) { }, 16, BINARY_DATA_TRUNCATED);
+    ok = ok && attach([](uint64_t *d) { d[6] = d[2]; }, bytes.size(), BINARY_DATA_MALFORMED);   // strings size
+    ok = ok && attach([](uint64_t *d) { d[4] = d[2]; }, bytes.size(), BINARY_DATA_MALFORMED);   // tape count
+    // the root object ends past the last entry of tape.
+    ok = ok && attach([&](uint64_t *d) { tape_word(d, 0) = (tape_word(d, 0) & ~payload_mask) | (d[4] + 1); },
+                      bytes.size(), BINARY_DATA_MALFORMED);
+    // a string past the end of the string buffer.
+    ok = ok && attach([&](uint64_t *d) { tape_word(d, 1) = (tape_word(d, 1) & ~payload_mask) | d[6]; },
+                      bytes.size(), BINARY_DATA_MALFORMED);
+    // the key tables of the root object point to itself, and to an entry after it.
+    ok = ok && attach([](uint64_t *d) { d[d[9] / 8] = 0; }, bytes.size(), BINARY_DATA_MALFORMED);
+    ok = ok && attach([](uint64_t *d) { d[d[9] / 8] = d[4] - 1; }, bytes.size(), BINARY_DATA_MALFORMED);
+    // the keys of the table are out of order.
+    ok = ok && attach([](uint64_t *d) { std::swap(d[d[9] / 8], d[d[9] / 8 + 1]); }, bytes.size(), BINARY_DATA_MALFORMED);
+
+    // a snapshot without strings and key tables writes no empty sections.
+    callback_sink nonempty([](const char *, size_t size) { return size > 0; });
+    ok = ok && parse_tape("[1,[]]", tape, nullptr) && write_snapshot(tape.view(), nonempty);
+    return ok;
+}
+
+#ifdef JSONCPP_MSGPACK_SUPPORT
+/**
+ * encode and decode fixed MessagePack byte vectors of each format, and decode truncated and malformed data.
+ */
+static bool check_msgpack_vectors()
+{
+    // encoded in the smallest format, and decoded back.
+    const binary_vector encoded[] = {
+            {"0", "00"}, {"127", "7f"}, {"128", "cc80"}, {"255", "ccff"}, {"256", "cd0100"}, {"65535", "cdffff"},
+            {"65536", "ce00010000"}, {"4294967295", "ceffffffff"}, {"4294967296", "cf0000000100000000"},
+            {"9223372036854775807", "cf7fffffffffffffff"}, {"-1", "ff"}, {"-32", "e0"}, {"-33", "d0df"},
+            {"-128", "d080"}, {"-129", "d1ff7f"}, {"-32768", "d18000"}, {"-32769", "d2ffff7fff"},
+            {"-2147483648", "d280000000"}, {"-2147483649", "d3ffffffff7fffffff"},
+            {"-9223372036854775808", "d38000000000000000"}, {"null", "c0"}, {"false", "c2"}, {"true", "c3"},
+            {"1.5", "ca3fc00000"}, {"-0.0", "ca80000000"}, {"1.1", "cb3ff199999999999a"},
+            {"\"\"", "a0"}, {"\"a\"", "a161"}, {"[]", "90"}, {"[1,2,3]", "93010203"},
+            {"[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15]", "dc0010000102030405060708090a0b0c0d0e0f"},
+            {"{}", "80"}, {"{\"a\":1}", "81a16101"}
+    };
+    // wider formats than needed, bin and ext, decoded only.
+    const binary_vector decoded[] = {
+            {"1", "cc01"}, {"-1", "d0ff"}, {"-1", "d1ffff"}, {"18446744073709551615.0", "cfffffffffffffffff"},
+            {"1.5", "cb3ff8000000000000"}, {"\"a\"", "d90161"}, {"\"a\"", "da000161"}, {"\"a\"", "db0000000161"},
+            {"\"AQID\"", "c403010203"}, {"\"AQID\"", "c50003010203"}, {"\"AQID\"", "c600000003010203"},
+            {"\"qg\"", "d401aa"}, {"\"AQIDBA\"", "d6ff01020304"}, {"\"AQI\"", "c702050102"},
+            {"[1]", "dc000101"}, {"[1]", "dd0000000101"}, {"{\"a\":1}", "de0001a16101"},
+            {"{\"a\":1}", "df00000001a16101"}
+    };
+    const malformed_vector malformed[] = {
+            {"", BINARY_DATA_TRUNCATED}, {"cc", BINARY_DATA_TRUNCATED}, {"d3000000", BINARY_DATA_TRUNCATED},
+            {"ca3f", BINARY_DATA_TRUNCATED}, {"d90561", BINARY_DATA_TRUNCATED}, {"c40500", BINARY_DATA_TRUNCATED},
+            {"c702", BINARY_DATA_TRUNCATED}, {"d8", BINARY_DATA_TRUNCATED}, {"9201", BINARY_DATA_TRUNCATED},
+            {"dc00", BINARY_DATA_TRUNCATED}, {"81a161", BINARY_DATA_TRUNCATED}, {"c1", BINARY_DATA_MALFORMED},
+            {"810101", OBJECT_KEY_SYNTAX_ERROR}, {"0000", UNEXPECTED_END_CHAR}
+    };
+
+    bool ok = true;
+    for (const auto &v : encoded) {
+        int error = 0;
+        auto token = parse(v.json, &error);
+        auto data = from_hex(v.hex);
+        auto back = parse_msgpack(data, &error);
+        if (!token || to_msgpack(*token) != data || !back || to_string(*back) != to_string(*token)) {
+            cerr << "msgpack encode failed: " << v.json << endl;
+            ok = false;
+        }
+    }
+    // the length boundaries of fixstr, str8, str16 and str32.
+    const std::pair<size_t, const char *> strings[] = {
+            {31, "bf"}, {32, "d920"}, {255, "d9ff"}, {256, "da0100"}, {65535, "daffff"}, {65536, "db00010000"}
+    };
+    for (const auto &v : strings) {
+        auto head = from_hex(v.second);
+        auto data = to_msgpack(json_string_value(std::string(v.first, 'a')));
+        int error = 0;
+        auto back = parse_msgpack(data, &error);
+        if (data.size() != head.size() + v.first || !std::equal(head.begin(), head.end(), data.begin()) || !back
+            || static_cast<const json_string_value &>(*back).value().size() != v.first) {
+            cerr << "msgpack str failed: " << v.first << endl;
+            ok = false;
+        }
+    }
+    for (const auto &v : decoded) {
+        int error = 0;
+        auto back = parse_msgpack(from_hex(v.hex), &error);
+        auto token = parse(v.json, &error);
+        if (!back || to_string(*back) != to_string(*token)) {
+            cerr << "msgpack decode failed: " << v.hex << endl;
+            ok = false;
+        }
+    }
+    for (const auto &v : malformed) {
+        int error = 0;
+        if (parse_msgpack(from_hex(v.hex), &error) || error != v.error) {
+            cerr << "msgpack malformed data accepted: " << v.hex << endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+#endif
+
 int main(int argc, char **argv)
 {
     if (argc != 2) {
@@ -146,7 +672,35 @@ int main(int argc, char **argv)
         return -1;
     }
 
+    cout << "string escapes: " << (check_string_escapes() ? "ok" : "failed") << endl;
+    cout << "float round trip: " << (check_float_round_trip() ? "ok" : "failed") << endl;
+    cout << "nesting depth: " << (check_nesting_depth() ? "ok" : "failed") << endl;
+    cout << "writer misuse: " << (check_writer_misuse() ? "ok" : "failed") << endl;
+    cout << "unsigned numbers: " << (check_unsigned_numbers() ? "ok" : "failed") << endl;
+    cout << "path error offsets: " << (check_path_error_offsets() ? "ok" : "failed") << endl;
+    cout << "pointer projection: " << (check_pointer_projection() ? "ok" : "failed") << endl;
+    cout << "array move: " << (check_array_move() ? "ok" : "failed") << endl;
+    cout << "cbor vectors: " << (check_cbor_vectors() ? "ok" : "failed") << endl;
+    cout << "snapshot verify: " << (check_snapshot_verify() ? "ok" : "failed") << endl;
+#ifdef JSONCPP_MSGPACK_SUPPORT
+    cout << "msgpack vectors: " << (check_msgpack_vectors() ? "ok" : "failed") << endl;
+#endif
+    cout << endl;
+
     count_timer ct;
+    std::mt19937_64 random(20181019);
+    std::string ids = "[";
+    for (int i = 0; i < 1000000; ++i) {
+        ids += (i > 0 ? "," : "") + std::to_string(static_cast<int64_t>(random() >> (random() % 64)));
+    }
+    ids += "]";
+    auto id_array = parse(ids, nullptr);
+    ct.start();
+    auto id_json = to_string(*id_array);
+    ct.stop();
+    ct.print("to_string packed integers");
+    cout << "same as input: " << (id_json == ids ? "true" : "false") << endl << endl;
+
     ifstream test_file(argv[1]);
     if (!test_file) {
         cerr << "can not open file: " << argv[1] << endl;
@@ -175,6 +729,81 @@ int main(int argc, char **argv)
         ct.print("to_string format");
         // cout << "formatted json: " << std::endl << format_json << std::endl;
 
+        cout << std::endl;
+        format_options parallel_options(json_format_option::indent_tab);
+        parallel_options.threads = 0;
+        ct.start();
+        auto parallel_json = to_string(*token, parallel_options);
+        ct.stop();
+        ct.print("to_string parallel");
+        cout << "same as sequential: " << (parallel_json == format_json ? "true" : "false") << endl;
+
+        cout << std::endl;
+        size_t written = 0;
+        callback_sink counter([&written](const char *, size_t size) {
+            written += size;
+            return true;
+        });
+        ct.start();
+        write(*token, counter);
+        ct.stop();
+        ct.print("write");
+        cout << "written size: " << written << endl;
+
+#ifndef _WIN32
+        cout << std::endl;
+        std::string side;
+        ct.start();
+        auto buffers = to_iovec(*token, side);
+        ct.stop();
+        ct.print("to_iovec");
+        cout << "buffer count: " << buffers.size() << "; side size: " << side.size() << endl;
+#endif
+
+        cout << std::endl;
+        std::string writer_json;
+        ct.start();
+        json_writer writer(writer_json);
+        writer.value(*token);
+        ct.stop();
+        ct.print("json_writer");
+        cout << "same as to_string: " << (writer_json == non_format_json ? "true" : "false") << endl;
+        bool writer_same = true;
+        for (auto option : {json_format_option::indent_space, json_format_option::indent_tab}) {
+            std::string pretty_json;
+            json_writer(pretty_json, format_options(option)).value(*token);
+            writer_same = writer_same && pretty_json == to_string(*token, option);
+        }
+        cout << "same as to_string format: " << (writer_same ? "true" : "false") << endl;
+
+        cout << std::endl;
+        ct.start();
+        auto cbor = to_cbor(*token);
+        ct.stop();
+        ct.print("to_cbor");
+        cout << "cbor size: " << cbor.size() << endl;
+
+        ct.start();
+        auto cbor_token = parse_cbor(cbor, &error_code);
+        ct.stop();
+        ct.print("parse_cbor");
+        cout << "same as input: " << (cbor_token && to_string(*cbor_token) == non_format_json ? "true" : "false") << endl;
+
+#ifdef JSONCPP_MSGPACK_SUPPORT
+        cout << std::endl;
+        ct.start();
+        auto msgpack = to_msgpack(*token);
+        ct.stop();
+        ct.print("to_msgpack");
+        cout << "msgpack size: " << msgpack.size() << endl;
+
+        ct.start();
+        auto msgpack_token = parse_msgpack(msgpack, &error_code);
+        ct.stop();
+        ct.print("parse_msgpack");
+        cout << "same as input: " << (msgpack_token && to_string(*msgpack_token) == non_format_json ? "true" : "false") << endl;
+#endif
+
         cout << std::endl;
         es_search_result result;
         ct.start();
@@ -183,6 +812,49 @@ int main(int argc, char **argv)
         ct.print("deserialize");
         cout << "took: " << result.took << "; hits item count: " << result.hits.hits.size() << endl;
 
+        cout << std::endl;
+        auto consumed = parse(content, &error_code);
+        es_search_result moved_result;
+        ct.start();
+        deserialize(moved_result, std::move(*consumed));
+        ct.stop();
+        ct.print("deserialize consuming");
+        cout << "took: " << moved_result.took << "; hits item count: " << moved_result.hits.hits.size() << endl;
+
+        cout << std::endl;
+        es_search_result text_result;
+        ct.start();
+        deserialize_from_text(text_result, content.c_str(), content.size(), &error_code);
+        ct.stop();
+        ct.print("deserialize_from_text");
+        cout << "took: " << text_result.took << "; hits item count: " << text_result.hits.hits.size() << endl;
+
+        cout << std::endl;
+        es_search_result cbor_result;
+        ct.start();
+        deserialize_from_cbor(cbor_result, cbor.data(), cbor.size(), &error_code);
+        ct.stop();
+        ct.print("deserialize_from_cbor");
+        cout << "took: " << cbor_result.took << "; hits item count: " << cbor_result.hits.hits.size() << endl;
+
+        cout << std::endl;
+        ct.start();
+        auto serialized = serialize(result);
+        ct.stop();
+        ct.print("serialize");
+        cout << "serialized size: " << serialized.size() << endl;
+
+        std::string streamed;
+        callback_sink serialize_sink([&streamed](const char *data, size_t size) {
+            streamed.append(data, size);
+            return true;
+        });
+        ct.start();
+        serialize(result, serialize_sink, 4096);
+        ct.stop();
+        ct.print("serialize to sink");
+        cout << "same as serialize: " << (streamed == serialized ? "true" : "false") << endl;
+
         cout << std::endl;
         const char *dot_json_path = "$.hits.hits[*]._source.system.filesystem.used.bytes";
         ct.start();
@@ -198,6 +870,108 @@ int main(int argc, char **argv)
         ct.stop();
         ct.print("bracket_json_path");
         cout << "query result count: " << b_query_result.size() << endl;
+
+        cout << std::endl;
+        const char *filter_json_path = "$.hits.hits[?(@._source.system.filesystem.used.bytes > 50000000000 && "
+                                       "@._source.beat.hostname != 'host-3')]._id";
+        ct.start();
+        auto filter_query_result = select_tokens(*token, filter_json_path);
+        ct.stop();
+        ct.print("filter_json_path");
+        cout << "query result count: " << filter_query_result.size() << endl;
+
+        const char *script_json_path = "$.hits.hits[(@.length-1)]._id";
+        ct.start();
+        auto script_query_result = select_token(*token, script_json_path);
+        ct.stop();
+        ct.print("script_json_path");
+        cout << "query result: " << (script_query_result ? to_string(*script_query_result) : "null") << endl;
+
+        cout << std::endl;
+        const compiled_path compiled_dot_path(dot_json_path);
+        std::vector<json_token *> compiled_query_result;
+        ct.start();
+        for (int i = 0; i < 10; ++i) {
+            compiled_dot_path.select_tokens(*token, compiled_query_result);
+        }
+        ct.stop();
+        ct.print("compiled dot_json_path x10");
+        cout << "same as dot_json_path: " << (compiled_query_result == query_result ? "true" : "false") << endl;
+
+        cout << std::endl;
+        ct.start();
+        auto projected = parse(content, {dot_json_path}, &error_code);
+        ct.stop();
+        ct.print("parse projected");
+        cout << "query result count: " << select_tokens(*projected, dot_json_path).size() << endl;
+
+        cout << std::endl;
+        json_tape tape;
+        ct.start();
+        parse_tape(content, tape, &error_code);
+        ct.stop();
+        ct.print("parse_tape");
+
+        ct.start();
+        auto tape_json = to_string(tape);
+        ct.stop();
+        ct.print("tape to_string");
+
+        ct.start();
+        auto tape_query_result = select_tokens(tape.view(), dot_json_path);
+        ct.stop();
+        ct.print("tape dot_json_path");
+        cout << "query result count: " << tape_query_result.size() << endl;
+
+        ct.start();
+        auto tape_filter_result = select_tokens(tape.view(), filter_json_path);
+        ct.stop();
+        ct.print("tape filter_json_path");
+        cout << "query result count: " << tape_filter_result.size() << endl;
+
+        ct.start();
+        auto tape_script_result = select_token(tape.view(), script_json_path);
+        ct.stop();
+        ct.print("tape script_json_path");
+        cout << "query result: " << (tape_script_result != json_tape_view::npos ? to_string(tape.view(), tape_script_result) : "null") << endl;
+
+        set_path_cache_capacity(16);
+        ct.start();
+        for (int i = 0; i < 10; ++i) {
+            tape_query_result = select_tokens(tape.view(), dot_json_path);
+        }
+        ct.stop();
+        ct.print("tape cached dot_json_path x10");
+        auto cache_stats = get_path_cache_stats();
+        cout << "path cache hits: " << cache_stats.hits << ", misses: " << cache_stats.misses << endl;
+        set_path_cache_capacity(0);
+
+        cout << std::endl;
+        auto snapshot_path = std::string(argv[1]) + ".snapshot";
+        auto snapshot_file = std::fopen(snapshot_path.c_str(), "wb");
+        if (snapshot_file) {
+            file_sink snapshot_sink(snapshot_file);
+            ct.start();
+            write_snapshot(tape.view(), snapshot_sink);
+            ct.stop();
+            std::fclose(snapshot_file);
+            ct.print("write_snapshot");
+
+            json_snapshot snapshot;
+            ct.start();
+            snapshot.open(snapshot_path.c_str(), &error_code);
+            ct.stop();
+            ct.print("snapshot open");
+            cout << "same as input: " << (to_string(snapshot.view(), 0) == tape_json ? "true" : "false") << endl;
+
+            ct.start();
+            auto snapshot_query_result = select_tokens(snapshot.view(), dot_json_path);
+            ct.stop();
+            ct.print("snapshot dot_json_path");
+            cout << "query result count: " << snapshot_query_result.size() << endl;
+            snapshot.close();
+            std::remove(snapshot_path.c_str());
+        }
     } else {
         cerr << "parse failed. error code: " << error_code << ", msg: " << get_error_info(error_code) << std::endl;
     }